@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ungive/update/internal/util.h"
+
+// Minimal helpers shared by the benchmark executables.
+// Benchmarks print one line per measured case to stdout.
+
+namespace bench
+{
+
+namespace fs = std::filesystem;
+
+// A temporary directory that is deleted once it goes out of scope.
+struct temp_dir
+{
+    temp_dir() : m_path{ ungive::update::internal::create_temporary_directory() }
+    {
+    }
+
+    ~temp_dir()
+    {
+        std::error_code ec;
+        fs::remove_all(m_path, ec);
+    }
+
+    fs::path const& path() const { return m_path; }
+
+private:
+    fs::path m_path;
+};
+
+// Writes a file with the given size and pseudo-random content.
+inline void write_random_file(fs::path const& path, uint64_t size)
+{
+    std::mt19937_64 prng(size);
+    std::vector<uint64_t> buffer(1024 * 1024 / sizeof(uint64_t));
+    std::ofstream out(path, std::ios::out | std::ios::binary);
+    while (size > 0) {
+        for (auto& word : buffer) {
+            word = prng();
+        }
+        auto n = std::min<uint64_t>(size, buffer.size() * sizeof(uint64_t));
+        out.write(reinterpret_cast<char const*>(buffer.data()), n);
+        size -= n;
+    }
+}
+
+// Runs the function the given number of times
+// and returns the fastest run in seconds.
+inline double measure(std::function<void()> const& func, int runs = 3)
+{
+    double best = 0;
+    for (int i = 0; i < runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        if (i == 0 || elapsed.count() < best) {
+            best = elapsed.count();
+        }
+    }
+    return best;
+}
+
+// Prints the duration of a case and optionally its throughput.
+inline void report(
+    std::string const& name, double seconds, uint64_t bytes = 0)
+{
+    std::cout << std::left << std::setw(40) << name << std::right
+              << std::fixed << std::setprecision(3) << std::setw(10)
+              << seconds * 1000.0 << " ms";
+    if (bytes > 0) {
+        std::cout << std::setw(12) << std::setprecision(1)
+                  << (bytes / (1024.0 * 1024.0)) / seconds << " MiB/s";
+    }
+    std::cout << std::endl;
+}
+
+} // namespace bench
@@ -0,0 +1,105 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "ungive/update/internal/batch_writer.h"
+#include "ungive/update/internal/extract.h"
+
+// Compares writing the files of a release with many small files
+// one after another, like extraction did before, with the batch writer
+// on the thread pool and with io_uring, where available,
+// and measures the extraction of the same release as a tar archive.
+// Usage: ungive_update_extract_bench [file count] [file size in bytes]
+
+using namespace ungive::update;
+
+// Returns a tar entry for a regular file.
+static std::string tar_entry(std::string const& name, std::string const& data)
+{
+    std::string header(internal::tar_block_size, '\0');
+    std::copy(name.begin(), name.end(), header.begin());
+    std::snprintf(header.data() + 100, 8, "%07o", 0644);
+    std::snprintf(header.data() + 124, 12, "%011o",
+        static_cast<unsigned int>(data.size()));
+    header[156] = '0';
+    std::copy_n("ustar", 6, header.data() + 257);
+    std::fill_n(header.data() + 148, 8, ' ');
+    unsigned int checksum = 0;
+    for (auto c : header) {
+        checksum += static_cast<unsigned char>(c);
+    }
+    std::snprintf(header.data() + 148, 8, "%06o", checksum);
+    auto padding = (512 - data.size() % 512) % 512;
+    return header + data + std::string(padding, '\0');
+}
+
+int main(int argc, char* argv[])
+{
+    int count = argc > 1 ? std::stoi(argv[1]) : 50000;
+    std::size_t size = argc > 2 ? std::stoul(argv[2]) : 1024;
+    bench::temp_dir dir;
+    std::vector<std::string> names;
+    for (int i = 0; i < count; i++) {
+        names.push_back("app/dir" + std::to_string(i % 64) + "/file" +
+            std::to_string(i) + ".txt");
+    }
+    std::string content(size, 'c');
+    uint64_t total = static_cast<uint64_t>(count) * size;
+    auto label = std::to_string(count) + " files";
+    // Each case writes to a new directory, since removing the files
+    // of an earlier case would take longer than writing them.
+    int runs = 0;
+    auto run = [&](auto extract) {
+        auto target = dir.path() / ("out" + std::to_string(runs++));
+        std::filesystem::create_directories(target);
+        return bench::measure(
+            [&] {
+                extract(target);
+            },
+            1);
+    };
+    bench::report("sequential writes " + label,
+        run([&](std::filesystem::path const& target) {
+            for (auto const& name : names) {
+                auto out = internal::create_archive_file(target / name);
+                out.write(content.data(), content.size());
+            }
+        }),
+        total);
+    using backend = internal::batch_writer::backend;
+    auto batched = [&](backend type) {
+        return [&, type](std::filesystem::path const& target) {
+            internal::batch_writer writer(type);
+            for (auto const& name : names) {
+                writer.add(target / name, content);
+            }
+            writer.finish();
+        };
+    };
+    bench::report("batch writer (thread pool) " + label,
+        run(batched(backend::thread_pool)), total);
+    if (internal::batch_writer().uses_io_uring()) {
+        bench::report("batch writer (io_uring) " + label,
+            run(batched(backend::io_uring)), total);
+    }
+    std::string tar;
+    for (auto const& name : names) {
+        tar += tar_entry(name, content);
+    }
+    tar += std::string(1024, '\0');
+    bench::report("tar extract_stream " + label,
+        run([&](std::filesystem::path const& target) {
+            std::size_t offset = 0;
+            internal::stream_reader reader(
+                [&](char* data, std::size_t n) -> std::size_t {
+                    n = std::min(n, tar.size() - offset);
+                    std::copy_n(tar.data() + offset, n, data);
+                    offset += n;
+                    return n;
+                });
+            internal::tar_extract(reader, target);
+        }),
+        total);
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include <string>
+
+#include "common.h"
+#include "ungive/update/internal/crypto.h"
+
+// Compares SHA-256 and BLAKE3 file hashing on large archives.
+// Usage: ungive_update_hash_bench [size in MiB...]
+
+using namespace ungive::update;
+
+int main(int argc, char* argv[])
+{
+    std::vector<uint64_t> sizes_mib = { 64, 512, 2048 };
+    if (argc > 1) {
+        sizes_mib.clear();
+        for (int i = 1; i < argc; i++) {
+            sizes_mib.push_back(std::stoull(argv[i]));
+        }
+    }
+    bench::temp_dir dir;
+    for (auto size_mib : sizes_mib) {
+        auto size = size_mib * 1024 * 1024;
+        auto path = dir.path() / "archive.bin";
+        bench::write_random_file(path, size);
+        auto label = std::to_string(size_mib) + " MiB";
+        bench::report("sha256 " + label, bench::measure([&] {
+            internal::crypto::sha256_file(path);
+        }),
+            size);
+        bench::report("blake3 (single thread) " + label, bench::measure([&] {
+            internal::blake3::hasher hasher;
+            std::ifstream ifs(path, std::ios::binary);
+            std::vector<char> buffer(1024 * 1024);
+            while (ifs.read(buffer.data(), buffer.size()) || ifs.gcount()) {
+                hasher.update(buffer.data(), ifs.gcount());
+            }
+            hasher.hexdigest();
+        }),
+            size);
+        bench::report("blake3 (thread pool) " + label, bench::measure([&] {
+            internal::crypto::blake3_file(path);
+        }),
+            size);
+        std::filesystem::remove(path);
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "ungive/update/internal/posix/lock.h"
+#include "ungive/update/internal/posix/process.h"
+
+// Measures the latency of handing off from the main executable
+// to the launcher and from the launcher back to the main executable,
+// like when an update is applied, until the started main executable
+// holds the update lock. Each hand-off either starts a detached process,
+// which waits for the previous one to exit, or replaces the process.
+// Usage: ungive_update_launch_bench [hand-off count]
+
+using namespace ungive::update;
+
+// The number of processes in one chain: main, launcher and main.
+static constexpr int chain_length = 3;
+
+// Runs one process of a chain and starts the next one,
+// or reports to the benchmark through the pipe, if it is the last one.
+static int run(std::vector<std::string> const& arguments)
+{
+    auto const& mode = arguments.at(0);
+    auto directory = std::filesystem::path(arguments.at(1));
+    int pipe = std::stoi(arguments.at(2));
+    int index = std::stoi(arguments.at(3));
+    pid_t previous = std::stoi(arguments.at(4));
+    // A started process must wait for its predecessor to exit,
+    // like the launcher does when it applies an update.
+    while (previous != 0 && !internal::posix::has_exited(previous)) {
+        ::usleep(100);
+    }
+    {
+        internal::posix::lock_file lock(directory / "update.lock");
+    }
+    // The next chain may start once the lock has been released.
+    if (index + 1 == chain_length) {
+        char done = 1;
+        return ::write(pipe, &done, 1) == 1 ? 0 : 1;
+    }
+    auto executable = internal::posix::current_process_executable();
+    std::vector<std::string> next{ "--run", mode, directory.string(),
+        std::to_string(pipe), std::to_string(index + 1),
+        mode == "replace" ? "0" : std::to_string(::getpid()) };
+    if (mode == "replace") {
+        internal::posix::replace_process(executable, next);
+    }
+    internal::posix::start_process_detached(executable, next);
+    return 0;
+}
+
+// Starts a chain and waits until its last process has had the lock.
+static void run_chain(
+    std::string const& mode, bench::fs::path const& directory)
+{
+    int fds[2];
+    if (::pipe(fds) != 0) {
+        throw std::runtime_error("failed to create pipe");
+    }
+    auto pid = ::fork();
+    if (pid == 0) {
+        ::close(fds[0]);
+        ::_exit(run({ mode, directory.string(), std::to_string(fds[1]), "0",
+            "0" }));
+    }
+    ::close(fds[1]);
+    // The first process exits before the next one may run.
+    ::waitpid(pid, nullptr, 0);
+    char done = 0;
+    auto n = ::read(fds[0], &done, 1);
+    ::close(fds[0]);
+    if (n != 1) {
+        throw std::runtime_error("the chain did not finish");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && std::string(argv[1]) == "--run") {
+        return run(std::vector<std::string>(argv + 2, argv + argc));
+    }
+    int count = argc > 1 ? std::stoi(argv[1]) : 100;
+    bench::temp_dir dir;
+    for (std::string mode : { "detached", "replace" }) {
+        auto seconds = bench::measure([&] {
+            for (int i = 0; i < count; i++) {
+                run_chain(mode, dir.path());
+            }
+        });
+        auto label = mode + ", " + std::to_string(count) + " updates";
+        bench::report(label, seconds);
+    }
+    return 0;
+}
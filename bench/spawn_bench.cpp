@@ -0,0 +1,56 @@
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "ungive/update/internal/posix/process.h"
+
+// Measures how long it takes to start a detached process
+// with start_process_detached(), which uses posix_spawn(),
+// compared to fork() followed by exec(), whose cost grows
+// with the memory of the parent process.
+// Usage: ungive_update_spawn_bench [process count] [parent memory in MiB]
+
+using namespace ungive::update;
+
+// Waits for all child processes to exit.
+static void reap_children()
+{
+    while (::waitpid(-1, nullptr, 0) > 0) {
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int count = argc > 1 ? std::stoi(argv[1]) : 200;
+    std::size_t memory = (argc > 2 ? std::stoul(argv[2]) : 256) << 20;
+    // Memory that was written to is what makes fork() expensive.
+    std::vector<char> ballast(memory);
+    std::memset(ballast.data(), 1, ballast.size());
+    std::filesystem::path executable = "/bin/true";
+    auto label = std::to_string(count) + " processes, " +
+        std::to_string(memory >> 20) + " MiB";
+    auto fork_exec = bench::measure([&] {
+        for (int i = 0; i < count; i++) {
+            auto pid = ::fork();
+            if (pid == 0) {
+                ::setsid();
+                ::execl(executable.c_str(), executable.c_str(), nullptr);
+                ::_exit(127);
+            }
+        }
+    });
+    reap_children();
+    bench::report("fork and exec " + label, fork_exec);
+    auto spawn = bench::measure([&] {
+        for (int i = 0; i < count; i++) {
+            internal::posix::start_process_detached(executable);
+        }
+    });
+    reap_children();
+    bench::report("start_process_detached " + label, spawn);
+    return 0;
+}
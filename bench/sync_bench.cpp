@@ -0,0 +1,41 @@
+#include <string>
+
+#include "common.h"
+#include "ungive/update/internal/sync.h"
+
+// Compares the cost of each durability mode when installing an update,
+// i.e. writing a directory of files and flushing it with sync_tree().
+// The temporary directory should be on the disk that is to be measured.
+// Usage: ungive_update_sync_bench [file count] [file size in KiB]
+
+using namespace ungive::update;
+
+int main(int argc, char* argv[])
+{
+    int count = argc > 1 ? std::stoi(argv[1]) : 2000;
+    uint64_t size = (argc > 2 ? std::stoull(argv[2]) : 64) * 1024;
+    bench::temp_dir dir;
+    auto label = std::to_string(count) + " files";
+    std::string content(size, 'u');
+    auto run = [&](durability mode) {
+        return bench::measure([&] {
+            auto target = dir.path() / "out";
+            std::filesystem::remove_all(target);
+            for (int i = 0; i < count; i++) {
+                auto subdirectory =
+                    target / ("dir" + std::to_string(i % 16));
+                std::filesystem::create_directories(subdirectory);
+                internal::write_file(
+                    subdirectory / ("file" + std::to_string(i)), content);
+            }
+            internal::sync_tree(target, mode);
+        });
+    };
+    uint64_t total = static_cast<uint64_t>(count) * size;
+    bench::report("durability none " + label, run(durability::none), total);
+    bench::report(
+        "durability sync_files " + label, run(durability::sync_files), total);
+    bench::report("durability sync_filesystem " + label,
+        run(durability::sync_filesystem), total);
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include <string>
+
+#include <zlib.h>
+
+#include "common.h"
+#include "ungive/update/internal/extract.h"
+#include "ungive/update/internal/zip_reader.h"
+
+// Compares ZIP extraction through the memory-mapped central directory,
+// on one thread and across entries on the thread pool,
+// with reading the archive from start to end.
+// Usage: ungive_update_zip_bench [file count] [file size in KiB]
+
+using namespace ungive::update;
+
+static void append_le(std::string& out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+static std::string deflate_raw(std::string const& data)
+{
+    z_stream stream{};
+    deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+        Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&stream, data.size()), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(out.data());
+    stream.avail_out = static_cast<uInt>(out.size());
+    deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return out;
+}
+
+// Writes a ZIP file with deflated files of compressible content.
+static uint64_t write_zip(
+    std::filesystem::path const& path, int count, uint64_t size)
+{
+    std::string archive;
+    std::string directory;
+    uint64_t total = 0;
+    for (int i = 0; i < count; i++) {
+        auto name = "app/dir" + std::to_string(i % 16) + "/file" +
+            std::to_string(i) + ".bin";
+        std::string content;
+        while (content.size() < size) {
+            content += "line " + std::to_string(content.size() * 31 + i) + "\n";
+        }
+        content.resize(size);
+        auto crc = crc32(0L, reinterpret_cast<Bytef const*>(content.data()),
+            static_cast<uInt>(content.size()));
+        auto compressed = deflate_raw(content);
+        auto offset = archive.size();
+        append_le(archive, internal::zip_local_header_signature, 4);
+        append_le(archive, 20, 2);
+        append_le(archive, 0, 2);
+        append_le(archive, internal::zip_method_deflated, 2);
+        append_le(archive, 0, 4);
+        append_le(archive, crc, 4);
+        append_le(archive, compressed.size(), 4);
+        append_le(archive, content.size(), 4);
+        append_le(archive, name.size(), 2);
+        append_le(archive, 0, 2);
+        archive += name + compressed;
+        append_le(directory, internal::zip_central_header_signature, 4);
+        append_le(directory, 20, 2);
+        append_le(directory, 20, 2);
+        append_le(directory, 0, 2);
+        append_le(directory, internal::zip_method_deflated, 2);
+        append_le(directory, 0, 4);
+        append_le(directory, crc, 4);
+        append_le(directory, compressed.size(), 4);
+        append_le(directory, content.size(), 4);
+        append_le(directory, name.size(), 2);
+        append_le(directory, 0, 6);
+        append_le(directory, 0, 6);
+        append_le(directory, offset, 4);
+        directory += name;
+        total += content.size();
+    }
+    auto directory_offset = archive.size();
+    archive += directory;
+    append_le(archive, internal::zip_end_signature, 4);
+    append_le(archive, 0, 4);
+    append_le(archive, count, 2);
+    append_le(archive, count, 2);
+    append_le(archive, directory.size(), 4);
+    append_le(archive, directory_offset, 4);
+    append_le(archive, 0, 2);
+    std::ofstream(path, std::ios::out | std::ios::binary) << archive;
+    return total;
+}
+
+int main(int argc, char* argv[])
+{
+    int count = argc > 1 ? std::stoi(argv[1]) : 2000;
+    uint64_t size = (argc > 2 ? std::stoull(argv[2]) : 64) * 1024;
+    bench::temp_dir dir;
+    auto path = dir.path() / "archive.zip";
+    auto total = write_zip(path, count, size);
+    auto label = std::to_string(count) + " files";
+    auto run = [&](auto extract) {
+        return bench::measure([&] {
+            auto target = dir.path() / "out";
+            std::filesystem::remove_all(target);
+            std::filesystem::create_directories(target);
+            extract(target);
+        });
+    };
+    bench::report("zip mapped (single thread) " + label,
+        run([&](std::filesystem::path const& target) {
+            internal::zip_reader reader(path);
+            std::vector<char> buffer(256 * 1024);
+            for (auto const& entry : reader.entries()) {
+                reader.extract(entry, target, buffer);
+            }
+        }),
+        total);
+    bench::report("zip mapped (thread pool) " + label,
+        run([&](std::filesystem::path const& target) {
+            internal::zip_file_extract(path, target);
+        }),
+        total);
+    bench::report("zip sequential stream " + label,
+        run([&](std::filesystem::path const& target) {
+            std::ifstream in(path, std::ios::in | std::ios::binary);
+            internal::extract_stream(
+                archive_type::zip,
+                [&in](char* data, std::size_t size) -> std::size_t {
+                    in.read(data, static_cast<std::streamsize>(size));
+                    return static_cast<std::size_t>(in.gcount());
+                },
+                target);
+        }),
+        total);
+    return 0;
+}
@@ -1,9 +1,13 @@
 #pragma once
 
 #include <cassert>
+#include <chrono>
 #include <fstream>
+#include <cstdint>
 #include <functional>
 #include <ios>
+#include <limits>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <unordered_map>
@@ -205,16 +209,102 @@ enum class archive_type
     unknown,
     zip,
     dmg,
+    tar_gz,
+    // Requires zstd, which is used if it is found during configuration.
+    tar_zst,
+    // Requires liblzma, which is used if it is found during configuration.
+    tar_xz,
+};
+
+// Limits for the resources an update may use,
+// which guard against unexpectedly large or malicious archives.
+// Updates that exceed any of them are cancelled.
+struct resource_limits
+{
+    // The maximum size of a downloaded file in bytes.
+    uint64_t max_download_size{ std::numeric_limits<uint64_t>::max() };
+    // The maximum total size of extracted files in bytes.
+    uint64_t max_extracted_size{ std::numeric_limits<uint64_t>::max() };
+    // The maximum number of files and directories in an archive.
+    uint64_t max_entry_count{ std::numeric_limits<uint64_t>::max() };
+    // The maximum window size of Zstandard frames as a power of two,
+    // which the decoder allocates. The default of 128 MiB matches zstd.
+    // Raise it for archives that were compressed with e.g. "zstd --long".
+    int max_zstd_window_log{ 27 };
+    // The maximum memory the xz decoder may use in bytes. The default
+    // suffices for any preset of xz. Where blocks are decoded in parallel,
+    // fewer threads are used if they would need more memory.
+    uint64_t max_xz_memory{ 256 * 1024 * 1024 };
+};
+
+// How installed updates are flushed to disk, which determines
+// whether a version is intact after a power loss or system crash.
+enum class durability
+{
+    // Nothing is flushed explicitly. Fastest, but after a crash
+    // a version may appear installed while its files are incomplete.
+    none,
+    // Every installed file is flushed, concurrently,
+    // followed by the directories and the sentinel of the version.
+    sync_files,
+    // Like sync_files, but all files are flushed with a single call
+    // for the whole file system where supported (syncfs on Linux).
+    // Faster for many files, but it also flushes unrelated data.
+    sync_filesystem,
+};
+
+// Which versions are kept when they are replaced in the latest directory,
+// so that they can be restored without downloading them again.
+struct retention_policy
+{
+    // The maximum number of replaced versions to keep.
+    // By default replaced versions are deleted.
+    std::size_t versions{ 0 };
+    // The maximum number of bytes that kept versions may occupy.
+    // Least recently used versions are deleted first. Files that are
+    // shared with other versions through deduplication are not counted,
+    // since deleting a kept version does not free their space.
+    std::optional<uint64_t> disk_budget{};
+};
+
+// How the manager starts the launcher or the latest version.
+enum class launch_mode
+{
+    // A detached process is started and the caller should exit.
+    detached,
+    // The current process is replaced with the started executable,
+    // keeping its pid, which saves creating a process and waiting
+    // for the caller to exit. Launching does not return then.
+    // Not supported on Windows.
+    replace,
+};
+
+// How running processes are stopped before their files are replaced.
+// All processes are asked to exit at once and then awaited together,
+// until the budget of the current step has passed, before escalating
+// to the next step. Steps with a budget of zero are skipped.
+struct shutdown_policy
+{
+    // How long processes have to exit after being asked politely,
+    // with WM_CLOSE on Windows and SIGINT elsewhere.
+    std::chrono::milliseconds polite{ 20000 };
+    // How long processes have to exit after SIGTERM.
+    // Windows has no equivalent, so there it extends the polite step.
+    std::chrono::milliseconds terminate{ 8000 };
+    // How long processes have to exit after being killed forcefully,
+    // with SIGKILL or TerminateProcess(), which they cannot handle.
+    std::chrono::milliseconds kill{ 2000 };
 };
 
 struct update_info
 {
-    update_info(state state, version_number const& version, file_url const& url)
+    update_info(ungive::update::state state, version_number const& version,
+        file_url const& url)
         : m_state{ state }, m_version{ version }, m_url{ url }
     {
     }
 
-    state state() const { return m_state; }
+    ungive::update::state state() const { return m_state; }
 
     version_number const& version() const { return m_version; }
 
@@ -1,6 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <exception>
 #include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -8,8 +15,16 @@
 
 #include <yhirose/httplib.h>
 
+#include "ungive/update/detail/log.h"
+#include "ungive/update/detail/verifiers.h"
+#include "ungive/update/internal/blake3.h"
+#include "ungive/update/internal/chunks.h"
+#include "ungive/update/internal/crypto.h"
+#include "ungive/update/internal/resources.h"
+#include "ungive/update/internal/thread_pool.h"
 #include "ungive/update/internal/types.h"
 #include "ungive/update/internal/util.h"
+#include "ungive/update/internal/verification_record.h"
 
 namespace ungive::update
 {
@@ -44,10 +59,22 @@ public:
             std::is_base_of<types::verifier, V>::value>::type* = nullptr>
     void add_verification(V const& verifier)
     {
-        m_verification_funcs.push_back(verifier);
+        if constexpr (std::is_base_of<types::chunked_verifier, V>::value) {
+            auto shared = std::make_shared<V>(verifier);
+            m_chunked_verifiers.emplace_back(
+                shared, [shared](types::verification_payload const& payload) {
+                    (*shared)(payload);
+                });
+        } else {
+            m_verification_funcs.push_back(verifier);
+        }
+        if constexpr (std::is_base_of<verifiers::checksums, V>::value) {
+            m_stream_digests.insert(verifier.hash_name());
+        }
         for (auto const& file : verifier.files()) {
             m_additional_files.insert(file);
         }
+        m_verifier_ids.push_back(verifier.id());
     }
 
     void override_file_url(std::string const& filename, std::string const& url)
@@ -55,10 +82,60 @@ public:
         m_file_url_overrides[filename] = url;
     }
 
+    // Sets whether verification steps are executed concurrently.
+    // Verifiers are independent of each other, so by default they run
+    // in parallel on the shared thread pool and the first failing verifier
+    // cancels all others. If disabled, they run in the order they were added.
+    void parallel_verification(bool state) { m_parallel_verification = state; }
+
+    // Sets how often chunks which failed verification are downloaded again,
+    // when a chunked verifier like verifiers::chunk_manifest is used.
+    void chunk_retries(size_t count) { m_chunk_retries = count; }
+
+    // Sets the maximum size of a downloaded file in bytes. Downloads
+    // fail before any data is received if the server announces a larger
+    // size, or once more data than that has been received otherwise.
+    void max_download_size(uint64_t size) { m_max_download_size = size; }
+
+    // Sets a function which is called with the size of each file,
+    // as announced by the server, before any of its data is received,
+    // and the location it is stored at, which is empty if its data
+    // is passed to a sink instead (see stream()).
+    // If the function throws, the download fails with that exception.
+    void preflight(
+        std::function<void(uint64_t, std::filesystem::path const&)> func)
+    {
+        m_preflight = std::move(func);
+    }
+
+    // Sets whether files that are stored on disk are checked against
+    // the free space of the volume they are stored on, before any
+    // of their data is received. Enabled by default.
+    void check_disk_space(bool state) { m_check_disk_space = state; }
+
+    // Sets a directory in which downloaded files are kept across updates.
+    // After verification a record of the outcome is written next to the file
+    // (see internal::verification_record). If a download is requested again
+    // and the file is unchanged since, the download is skipped and digests
+    // are taken from the record instead of hashing the file again.
+    // Only the requested file is kept, additional files are always
+    // downloaded again. By default files are downloaded to a temporary
+    // directory which is deleted once the downloader is destructed.
+    void download_directory(std::filesystem::path const& path)
+    {
+        m_download_directory = path;
+    }
+
+    // Sets whether files are always hashed again during verification,
+    // instead of using digests from earlier verifications of unchanged files.
+    void always_reverify(bool state) { m_always_reverify = state; }
+
     // Downloads the given path from the server to disk.
     // The path is appended to the base URL that was passed in the constructor.
     // Any verification steps that were added before the invocation of get()
-    // are executed in the order they were added.
+    // are executed once the download has finished. With a chunked verifier
+    // chunks are verified during the download instead, and chunks that
+    // fail verification are downloaded again with range requests.
     // Fails if any of the verification steps failed
     // or if any of the files could not be stored on disk.
     // Returns the downloaded file.
@@ -71,23 +148,121 @@ public:
         httplib::Client cli(m_host);
         // Always follow redirects.
         cli.set_follow_location(true);
-        // Get the additional files first, as they are usually smaller
-        // and faster to download. If one of them does not exist on the remote,
-        // the download operation will fail sooner and we won't
-        // have unnecessarily downloaded a possibly large file.
-        for (auto const& additional_path : m_additional_files) {
-            auto it = m_file_url_overrides.find(additional_path);
-            if (it != m_file_url_overrides.end()) {
-                get_external_file(additional_path, it->second);
-            } else {
-                get_file(cli, additional_path);
+        get_additional_files(cli);
+        if (reuse_download(path)) {
+            try {
+                verify(path);
+                return m_downloaded_files.at(path);
+            }
+            catch (std::exception const& e) {
+                logger()(log_level::warning,
+                    "kept download failed verification, downloading again: " +
+                        std::string(e.what()));
+                discard_download(path);
             }
         }
-        auto result = get_file(cli, path);
-        for (auto const& verify : m_verification_funcs) {
-            verify(types::verification_payload(path, m_downloaded_files));
+        if (m_chunked_verifiers.empty() ||
+            m_downloaded_files.find(path) != m_downloaded_files.end()) {
+            auto result = get_file(cli, path, remote_path(path), nullptr,
+                download_location(path));
+            verify(path);
+            return result;
         }
-        return result;
+        // The first chunked verifier is satisfied by the download,
+        // unless chunks still mismatch after all retries.
+        auto const& chunked = m_chunked_verifiers.front().first;
+        auto layout = chunked->chunks(
+            types::verification_payload(path, m_downloaded_files));
+        auto result = get_chunked_file(cli, path, layout);
+        verify(path, result.second ? &result.second.value() : nullptr);
+        return result.first;
+    }
+
+    // Downloads the given path like get(), but passes its data to the sink
+    // instead of storing it on disk, e.g. to extract it while it is being
+    // downloaded. The sink may return false to stop the download.
+    // The data is hashed while it is streamed and since the file is never
+    // stored, verifiers must take its digests from the payload,
+    // like verifiers::checksums and verifiers::chunk_manifest do.
+    // Chunks of a chunked verifier are verified during the download too,
+    // but they cannot be downloaded again, so any mismatch is an error.
+    // The sink has received unverified data if this method throws.
+    // Returns information about the verified file.
+    // This method is not thread-safe.
+    internal::verification_info stream(std::string const& path,
+        std::function<bool(char const*, size_t)> const& sink)
+    {
+        if (m_base_url.empty()) {
+            throw std::runtime_error("downloader base url cannot be empty");
+        }
+        httplib::Client cli(m_host);
+        cli.set_follow_location(true);
+        get_additional_files(cli);
+        std::optional<types::chunk_layout> layout;
+        std::unique_ptr<internal::chunk_hasher> chunks;
+        if (!m_chunked_verifiers.empty()) {
+            auto const& chunked = m_chunked_verifiers.front().first;
+            layout = chunked->chunks(
+                types::verification_payload(path, m_downloaded_files));
+            chunks = std::make_unique<internal::chunk_hasher>(layout.value());
+        }
+        std::unique_ptr<internal::crypto::sha256_hasher> sha256;
+        if (m_stream_digests.count("SHA256") > 0) {
+            sha256 = std::make_unique<internal::crypto::sha256_hasher>();
+        }
+        std::unique_ptr<internal::blake3::hasher> blake3;
+        if (m_stream_digests.count("BLAKE3") > 0) {
+            blake3 = std::make_unique<internal::blake3::hasher>();
+        }
+        internal::verification_info info;
+        download_to_sink(
+            cli, remote_path(path), [&](char const* data, size_t size) {
+                if (sha256) {
+                    sha256->update(data, size);
+                }
+                if (blake3) {
+                    blake3->update(data, size);
+                }
+                if (chunks) {
+                    chunks->update(data, size);
+                }
+                info.size += size;
+                return sink(data, size);
+            });
+        if (sha256) {
+            info.digests["SHA256"] = sha256->hexdigest();
+        }
+        if (blake3) {
+            info.digests["BLAKE3"] = blake3->hexdigest();
+        }
+        if (chunks) {
+            auto bad = chunks->finish();
+            if (!bad.empty() || info.size != layout->size) {
+                throw verifiers::verification_failed(
+                    "chunks of streamed file " + path +
+                    " failed verification");
+            }
+            auto algorithm =
+                "SHA256-chunks-" + std::to_string(layout->chunk_size);
+            info.digests[algorithm] =
+                internal::crypto::merkle_root(chunks->digests());
+        }
+        // Verifiers expect the file among the downloaded files,
+        // but its location is never read, as its digests are known.
+        auto location = cwd() / internal::random_string(8) /
+            internal::strip_leading_slash(path);
+        m_downloaded_files.emplace(path, downloaded_file(location));
+        internal::stream_digest_cache digests(location, info);
+        try {
+            run_verifiers(path, digests, layout.has_value());
+        }
+        catch (...) {
+            m_downloaded_files.erase(path);
+            throw;
+        }
+        m_downloaded_files.erase(path);
+        info.verifiers = m_verifier_ids;
+        return info;
     }
 
     // Sets the cancellation state for any current or future downloads.
@@ -110,20 +285,276 @@ public:
     }
 
 protected:
+    // Runs all verification steps for the downloaded file with the given path
+    // and rethrows the exception of the first verifier that failed.
+    // If the file's chunks were verified during the download against
+    // the layout of the first chunked verifier, that verifier is skipped
+    // and the layout must be the one that was computed from the chunks.
+    // Records the outcome next to the file once all verifiers passed.
+    void verify(std::string const& path,
+        types::chunk_layout const* streamed = nullptr)
+    {
+        auto const& file = m_downloaded_files.at(path).path();
+        internal::record_digest_cache digests(!m_always_reverify);
+        if (streamed != nullptr) {
+            // Seeds the record with the root that was computed
+            // from the downloaded data, as if the file had been hashed.
+            digests.get(file,
+                "SHA256-chunks-" + std::to_string(streamed->chunk_size), [&] {
+                    return streamed->root;
+                });
+        }
+        run_verifiers(path, digests, streamed != nullptr);
+        try {
+            digests.commit(file, m_verifier_ids);
+        }
+        catch (std::exception const& e) {
+            logger()(log_level::warning,
+                "failed to write verification record: " +
+                    std::string(e.what()));
+        }
+    }
+
+    // Runs all verification steps with the given digest cache. Skips
+    // the first chunked verifier if the file's chunks were already verified.
+    void run_verifiers(std::string const& path, types::digest_cache& digests,
+        bool skip_chunked)
+    {
+        std::vector<internal::types::verifier_func> funcs =
+            m_verification_funcs;
+        for (size_t i = 0; i < m_chunked_verifiers.size(); i++) {
+            if (i > 0 || !skip_chunked) {
+                funcs.push_back(m_chunked_verifiers[i].second);
+            }
+        }
+        if (!m_parallel_verification) {
+            for (auto const& verify : funcs) {
+                verify(types::verification_payload(
+                    path, m_downloaded_files, nullptr, &digests));
+            }
+        } else {
+            internal::task_group group;
+            for (auto const& verify : funcs) {
+                group.add([&](std::atomic<bool> const& cancelled) {
+                    verify(types::verification_payload(
+                        path, m_downloaded_files, &cancelled, &digests));
+                });
+            }
+            group.run();
+        }
+    }
+
+    // Gets the additional files first, as they are usually smaller
+    // and faster to download. If one of them does not exist on the remote,
+    // the download operation will fail sooner and we won't
+    // have unnecessarily downloaded a possibly large file.
+    void get_additional_files(httplib::Client& cli)
+    {
+        for (auto const& additional_path : m_additional_files) {
+            auto it = m_file_url_overrides.find(additional_path);
+            if (it != m_file_url_overrides.end()) {
+                get_external_file(additional_path, it->second);
+            } else {
+                get_file(cli, additional_path);
+            }
+        }
+    }
+
+    // Returns the local location for the requested file.
+    // Returns an empty path if it should be downloaded to a temporary location.
+    std::filesystem::path download_location(std::string const& filename)
+    {
+        if (m_download_directory.empty() || filename.empty()) {
+            return {};
+        }
+        return m_download_directory / internal::strip_leading_slash(filename);
+    }
+
+    // Checks whether a file in the download directory can be used
+    // instead of downloading it again, which is the case if it was
+    // verified before and has not been modified since.
+    bool reuse_download(std::string const& filename)
+    {
+        auto location = download_location(filename);
+        if (location.empty() ||
+            m_downloaded_files.find(filename) != m_downloaded_files.end()) {
+            return false;
+        }
+        internal::verification_record record(location);
+        if (!record.read() ||
+            !record.matches(internal::file_stat::of(location)) ||
+            record.info().verifiers.empty() ||
+            record.info().verifiers != m_verifier_ids ||
+            std::find(m_verifier_ids.begin(), m_verifier_ids.end(), "") !=
+                m_verifier_ids.end()) {
+            return false;
+        }
+        logger()(log_level::info,
+            "using previously verified download " + location.string());
+        m_downloaded_files.emplace(filename, downloaded_file(location));
+        return true;
+    }
+
+    // Deletes a kept download and its verification record.
+    void discard_download(std::string const& filename)
+    {
+        auto it = m_downloaded_files.find(filename);
+        if (it == m_downloaded_files.end()) {
+            return;
+        }
+        internal::verification_record(it->second.path()).remove();
+        std::error_code ec;
+        std::filesystem::remove(it->second.path(), ec);
+        m_downloaded_files.erase(it);
+    }
+
+    // Downloads a file while verifying its chunks against the given layout.
+    // Chunks that fail verification are downloaded again and written
+    // in place. A file that is longer than the layout is truncated
+    // and its last chunk is downloaded again. Returns the file and,
+    // if all of its chunks match and it has the expected size,
+    // the layout that was computed from its chunks.
+    std::pair<downloaded_file, std::optional<types::chunk_layout>>
+    get_chunked_file(httplib::Client& cli, std::string const& filename,
+        types::chunk_layout const& layout)
+    {
+        internal::chunk_hasher hasher(layout);
+        auto const& file = get_file(
+            cli, filename, remote_path(filename),
+            [&](char const* data, size_t size) {
+                hasher.update(data, size);
+            },
+            download_location(filename));
+        auto bad = hasher.finish();
+        if (bad.empty() &&
+            std::filesystem::file_size(file.path()) == layout.size) {
+            return std::make_pair(file, computed_layout(layout, hasher));
+        }
+        if (std::filesystem::file_size(file.path()) != layout.size) {
+            std::filesystem::resize_file(file.path(), layout.size);
+            // The end of the file must be verified again.
+            if (bad.empty() || bad.back() + 1 != layout.digests.size()) {
+                bad.push_back(layout.digests.size() - 1);
+            }
+        }
+        for (size_t attempt = 0; attempt < m_chunk_retries && !bad.empty();
+             attempt++) {
+            logger()(log_level::warning,
+                std::to_string(bad.size()) + " of " +
+                    std::to_string(layout.digests.size()) +
+                    " chunks failed verification, downloading them again");
+            std::fstream out(
+                file.path(), std::ios::in | std::ios::out | std::ios::binary);
+            std::vector<size_t> remaining;
+            for (auto index : bad) {
+                auto offset = index * layout.chunk_size;
+                auto data = download_range(cli, remote_path(filename), offset,
+                    internal::chunk_length(layout, index));
+                if (!hasher.replace(index, data)) {
+                    remaining.push_back(index);
+                    continue;
+                }
+                out.seekp(static_cast<std::streamoff>(offset));
+                out.write(data.data(), data.size());
+                if (out.fail()) {
+                    throw std::runtime_error(
+                        "failed to write chunk to " + file.path().string());
+                }
+            }
+            bad = std::move(remaining);
+        }
+        if (!bad.empty() ||
+            std::filesystem::file_size(file.path()) != layout.size) {
+            return std::make_pair(file, std::nullopt);
+        }
+        return std::make_pair(file, computed_layout(layout, hasher));
+    }
+
+    // Returns the layout of the chunks that were hashed by the hasher.
+    static types::chunk_layout computed_layout(
+        types::chunk_layout const& expected, internal::chunk_hasher& hasher)
+    {
+        types::chunk_layout result;
+        result.size = expected.size;
+        result.chunk_size = expected.chunk_size;
+        result.digests = hasher.digests();
+        result.root = internal::crypto::merkle_root(result.digests);
+        return result;
+    }
+
+    // Downloads a byte range of a path into memory.
+    // Fails if the server does not support range requests.
+    std::string download_range(httplib::Client& cli, std::string const& path,
+        uint64_t offset, uint64_t length)
+    {
+        std::string data;
+        auto range = "bytes=" + std::to_string(offset) + "-" +
+            std::to_string(offset + length - 1);
+        auto res = cli.Get(
+            internal::ensure_nonempty_prefix(path, '/'),
+            httplib::Headers{ { "Range", range } },
+            [&](const httplib::Response& response) {
+                if (m_cancel_all.load()) {
+                    return false;
+                }
+                return response.status ==
+                    httplib::StatusCode::PartialContent_206;
+            },
+            [&](const char* chunk, size_t chunk_length) {
+                if (m_cancel_all.load() ||
+                    data.size() + chunk_length > length) {
+                    return false;
+                }
+                data.append(chunk, chunk_length);
+                return true;
+            });
+        if (!res) {
+            auto err = res.error();
+            throw std::runtime_error("failed to download " + m_host + path +
+                " (" + range + "): " + httplib::to_string(err));
+        }
+        if (data.size() != length) {
+            throw std::runtime_error("incomplete range download of " + m_host +
+                path + " (" + range + ")");
+        }
+        return data;
+    }
+
+    // Returns the path of a file on the server.
+    std::string remote_path(std::string const& filename) const
+    {
+        auto path = filename;
+        if (m_base_path != "/") {
+            path = internal::ensure_nonempty_prefix(path, '/');
+        }
+        return m_base_path + path;
+    }
+
     // Downloads a file once and returns the local path to it.
     // If the file is already downloaded it returns the path to it instead.
+    // Calls on_data with each received part of the file, if set.
+    // The file is stored at the given location or in a temporary directory.
     downloaded_file const& get_file(httplib::Client& cli,
-        std::string const& filename, std::string const& path)
+        std::string const& filename, std::string const& path,
+        std::function<void(char const*, size_t)> const& on_data = nullptr,
+        std::filesystem::path const& location = {})
     {
         auto it = m_downloaded_files.find(filename);
         if (it != m_downloaded_files.end()) {
             return it->second;
         }
-        auto local_path = cwd() / internal::random_string(8);
-        if (filename.size() > 0) {
-            local_path = local_path / internal::strip_leading_slash(filename);
+        auto local_path = location;
+        if (local_path.empty()) {
+            local_path = cwd() / internal::random_string(8);
+            if (filename.size() > 0) {
+                local_path =
+                    local_path / internal::strip_leading_slash(filename);
+            }
+        } else {
+            // Any record belongs to a previous download of this file.
+            internal::verification_record(local_path).remove();
         }
-        download_to_file(cli, path, local_path);
+        download_to_file(cli, path, local_path, on_data);
         m_downloaded_files.emplace(filename, downloaded_file(local_path));
         return m_downloaded_files.at(filename);
     }
@@ -131,11 +562,7 @@ protected:
     downloaded_file const& get_file(
         httplib::Client& cli, std::string const& filename)
     {
-        auto path = filename;
-        if (m_base_path != "/") {
-            path = internal::ensure_nonempty_prefix(path, '/');
-        }
-        return get_file(cli, filename, m_base_path + path);
+        return get_file(cli, filename, remote_path(filename));
     }
 
     downloaded_file const& get_external_file(
@@ -148,27 +575,90 @@ protected:
 
     // Downloads a path and saves it in the given output file.
     void download_to_file(httplib::Client& cli, std::string path,
-        std::filesystem::path const& output_file)
+        std::filesystem::path const& output_file,
+        std::function<void(char const*, size_t)> const& on_data = nullptr)
     {
         if (output_file.has_parent_path()) {
             std::filesystem::create_directories(output_file.parent_path());
         }
         std::ofstream out(output_file, std::ios::out | std::ios::binary);
+        auto directory = output_file.parent_path();
+        download_to_sink(
+            cli, path,
+            [&](char const* data, size_t size) {
+                out.write(data, size);
+                if (on_data) {
+                    on_data(data, size);
+                }
+                return !out.fail();
+            },
+            [&](uint64_t size) {
+                if (m_check_disk_space) {
+                    internal::require_free_space(
+                        { directory.empty() ? "." : directory }, size);
+                }
+            },
+            output_file);
+    }
+
+    // Downloads a path and passes its data to the sink.
+    // Stops the download if the sink returns false.
+    // Calls on_size with the announced size of the file before its data.
+    // The location is where the data is stored, if it is stored on disk.
+    void download_to_sink(httplib::Client& cli, std::string path,
+        std::function<bool(char const*, size_t)> const& sink,
+        std::function<void(uint64_t)> const& on_size = nullptr,
+        std::filesystem::path const& location = {})
+    {
+        // Exceptions must not be thrown through the HTTP library.
+        std::exception_ptr error{};
+        uint64_t received = 0;
         auto res = cli.Get(
             internal::ensure_nonempty_prefix(path, '/'), httplib::Headers(),
             [&](const httplib::Response& response) {
                 if (m_cancel_all.load()) {
                     return false;
                 }
-                return response.status == httplib::StatusCode::OK_200;
+                if (response.status != httplib::StatusCode::OK_200) {
+                    return false;
+                }
+                if (!response.has_header("Content-Length")) {
+                    return true;
+                }
+                try {
+                    auto length = response.get_header_value("Content-Length");
+                    auto size = std::stoull(length);
+                    check_download_size(path, size);
+                    if (m_preflight) {
+                        m_preflight(size, location);
+                    }
+                    if (on_size) {
+                        on_size(size);
+                    }
+                }
+                catch (...) {
+                    error = std::current_exception();
+                    return false;
+                }
+                return true;
             },
             [&](const char* data, size_t data_length) {
                 if (m_cancel_all.load()) {
                     return false;
                 }
-                out.write(data, data_length);
-                return !out.fail();
+                received += data_length;
+                try {
+                    check_download_size(path, received);
+                }
+                catch (...) {
+                    error = std::current_exception();
+                    return false;
+                }
+                return sink(data, data_length);
             });
+        if (error) {
+            std::rethrow_exception(error);
+        }
         if (!res) {
             auto err = res.error();
             throw std::runtime_error("failed to download " + m_host + path +
@@ -176,6 +666,14 @@ protected:
         }
     }
 
+    void check_download_size(std::string const& path, uint64_t size) const
+    {
+        if (size > m_max_download_size) {
+            throw std::runtime_error(m_host + path + " exceeds the limit of " +
+                std::to_string(m_max_download_size) + " bytes");
+        }
+    }
+
     inline std::filesystem::path cwd()
     {
         if (m_temp_dir.empty()) {
@@ -226,9 +724,22 @@ protected:
     std::filesystem::path m_temp_dir{};
     std::unordered_set<std::string> m_additional_files{};
     std::vector<internal::types::verifier_func> m_verification_funcs{};
+    std::vector<std::string> m_verifier_ids{};
+    std::unordered_set<std::string> m_stream_digests{};
+    std::vector<std::pair<std::shared_ptr<types::chunked_verifier>,
+        internal::types::verifier_func>>
+        m_chunked_verifiers{};
     std::unordered_map<std::string, downloaded_file> m_downloaded_files{};
     std::atomic<bool> m_cancel_all{ false };
     std::unordered_map<std::string, std::string> m_file_url_overrides;
+    bool m_parallel_verification{ true };
+    size_t m_chunk_retries{ 3 };
+    uint64_t m_max_download_size{ std::numeric_limits<uint64_t>::max() };
+    std::function<void(uint64_t, std::filesystem::path const&)>
+        m_preflight{};
+    bool m_check_disk_space{ true };
+    std::filesystem::path m_download_directory{};
+    bool m_always_reverify{ false };
 };
 
 } // namespace ungive::update
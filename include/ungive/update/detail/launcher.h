@@ -1,13 +1,11 @@
 #pragma once
 
 #include <filesystem>
+#include <optional>
 #include <stdexcept>
+#include <string>
 #include <vector>
 
-#include <winrt/base.h>
-
-// TODO: this is only required on Windows, not other platforms (probably).
-
 namespace ungive::update
 {
 
@@ -112,7 +110,7 @@ private:
         if (!std::filesystem::exists(source)) {
             if (must_exist) {
                 throw std::runtime_error("launcher file does not exist: " +
-                    winrt::to_string(source.wstring()));
+                    source.u8string());
             }
             return std::nullopt;
         }
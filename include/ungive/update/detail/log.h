@@ -26,6 +26,8 @@ using logger_func =
 // e.g. because exceptions are caught and ignored.
 // Must be set before any update operations are performed in other threads
 // any may not be updated while update operations could be in progress.
+// The logger may be called concurrently from worker threads,
+// e.g. by verifiers that run in parallel, so it must be thread-safe.
 inline logger_func& logger()
 {
     // No-op by default.
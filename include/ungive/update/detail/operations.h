@@ -1,14 +1,24 @@
 #pragma once
 
+#include <atomic>
 #include <filesystem>
 #include <optional>
 #include <string>
+#include <unordered_set>
+#include <vector>
 
 #include "ungive/update/detail/log.h"
+#include "ungive/update/detail/verifiers.h"
+#include "ungive/update/internal/crypto.h"
+#include "ungive/update/internal/file_manifest.h"
+#include "ungive/update/internal/thread_pool.h"
 #include "ungive/update/internal/types.h"
-#include "ungive/update/internal/win/startmenu.h"
 #include "ungive/update/internal/zip.h"
 
+#ifdef WIN32
+#include "ungive/update/internal/win/startmenu.h"
+#endif
+
 namespace ungive::update::operations
 {
 
@@ -27,6 +37,8 @@ public:
     }
 };
 
+#ifdef WIN32
+
 class create_start_menu_shortcut : public types::content_operation
 {
 public:
@@ -111,6 +123,104 @@ public:
     }
 };
 
+#endif // WIN32
+
+class verify_file_manifest : public types::content_operation
+{
+public:
+    // Verifies the extracted files against a signed file manifest,
+    // which must be located in the extracted directory and lists the path,
+    // size and SHA-256 digest of every file (see parse_file_manifest()).
+    // The manifest is authenticated with its signature first,
+    // like with the message_digest verifier. Fails if any file is missing,
+    // has a different size or digest, or if there are unlisted files.
+    // Files are hashed concurrently on the shared thread pool.
+    verify_file_manifest(std::string const& manifest_filename,
+        std::string const& signature_filename, std::string const& key_format,
+        std::string const& key_type,
+        std::vector<std::string> const& encoded_public_keys)
+        : m_manifest_filename{ manifest_filename },
+          m_signature_filename{ signature_filename },
+          m_signature(manifest_filename, signature_filename, key_format,
+              key_type, encoded_public_keys)
+    {
+    }
+
+    verify_file_manifest(std::string const& manifest_filename,
+        std::string const& signature_filename, std::string const& key_format,
+        std::string const& key_type, std::string const& encoded_public_key)
+        : verify_file_manifest(manifest_filename, signature_filename,
+              key_format, key_type,
+              std::vector<std::string>{ encoded_public_key })
+    {
+    }
+
+    void operator()(std::filesystem::path const& extracted_directory) override
+    {
+        auto manifest = internal::read_file(
+            extracted_directory / m_manifest_filename, std::ios::binary);
+        auto signature = internal::read_file(
+            extracted_directory / m_signature_filename, std::ios::binary);
+        m_signature.verify(manifest, signature);
+        auto entries = internal::parse_file_manifest(manifest);
+        check_listed_files(extracted_directory, entries);
+        internal::task_group group;
+        for (auto const& entry : entries) {
+            group.add([&](std::atomic<bool> const& cancelled) {
+                auto path =
+                    extracted_directory / std::filesystem::u8path(entry.path);
+                if (std::filesystem::file_size(path) != entry.size) {
+                    throw verifiers::verification_failed(
+                        "file size does not match for file " + entry.path);
+                }
+                auto digest = internal::crypto::sha256_file(path, &cancelled);
+                if (digest != entry.digest) {
+                    throw verifiers::verification_failed(
+                        "SHA256 hashes do not match for file " + entry.path +
+                        ": expected " + entry.digest + ", got " + digest);
+                }
+            });
+        }
+        group.run();
+        logger()(log_level::info,
+            "content integrity OK, all " + std::to_string(entries.size()) +
+                " files match the file manifest");
+    }
+
+private:
+    // Checks that exactly the listed files exist, before hashing anything.
+    void check_listed_files(std::filesystem::path const& directory,
+        std::vector<internal::file_manifest_entry> const& entries) const
+    {
+        std::unordered_set<std::string> listed;
+        for (auto const& entry : entries) {
+            if (!listed.insert(entry.path).second) {
+                throw verifiers::verification_failed(
+                    "file is listed twice in file manifest: " + entry.path);
+            }
+        }
+        auto manifest = std::filesystem::u8path(m_manifest_filename);
+        auto signature = std::filesystem::u8path(m_signature_filename);
+        for (auto const& file : internal::list_files(directory)) {
+            if (listed.erase(file) > 0 ||
+                file == manifest.generic_u8string() ||
+                file == signature.generic_u8string()) {
+                continue;
+            }
+            throw verifiers::verification_failed(
+                "file is not listed in file manifest: " + file);
+        }
+        if (!listed.empty()) {
+            throw verifiers::verification_failed(
+                "file listed in file manifest is missing: " + *listed.begin());
+        }
+    }
+
+    std::string m_manifest_filename;
+    std::string m_signature_filename;
+    verifiers::message_digest m_signature;
+};
+
 class ignore_failure : public types::content_operation
 {
 public:
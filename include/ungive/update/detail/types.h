@@ -1,5 +1,8 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
 #include <functional>
 #include <regex>
 #include <string>
@@ -12,18 +15,61 @@
 namespace ungive::update::types
 {
 
+// Caches the digests of files, so that a file which has not been modified
+// since it was last hashed does not need to be hashed again.
+// Implementations must be thread-safe.
+class digest_cache
+{
+public:
+    virtual ~digest_cache() = default;
+
+    // Returns the digest of a file for the given algorithm name,
+    // which is computed with the given function if it is not cached.
+    virtual std::string get(std::filesystem::path const& file,
+        std::string const& algorithm,
+        std::function<std::string()> const& compute) = 0;
+};
+
 struct verification_payload
 {
     std::string const& file;
     std::unordered_map<std::string, downloaded_file> const& additional_files;
+    // Set once verification should be aborted, e.g. because another verifier
+    // that runs concurrently has already failed. May be null.
+    std::atomic<bool> const* cancelled;
+    // Digests of files that were hashed in an earlier verification.
+    // Null if files should always be hashed again.
+    digest_cache* digests;
 
-    verification_payload(
-        decltype(file) file, decltype(additional_files) additional_files)
-        : file{ file }, additional_files{ additional_files }
+    verification_payload(decltype(file) file,
+        decltype(additional_files) additional_files,
+        decltype(cancelled) cancelled = nullptr,
+        decltype(digests) digests = nullptr)
+        : file{ file }, additional_files{ additional_files },
+          cancelled{ cancelled }, digests{ digests }
     {
     }
 
     verification_payload(verification_payload const&) = delete;
+
+    // Whether verification has been cancelled.
+    // Long-running verifiers should check this regularly and stop early.
+    inline bool is_cancelled() const
+    {
+        return cancelled != nullptr && cancelled->load();
+    }
+
+    // Returns the digest of a file, either from the digest cache
+    // or by computing it with the given function.
+    inline std::string digest(std::filesystem::path const& file,
+        std::string const& algorithm,
+        std::function<std::string()> const& compute) const
+    {
+        if (digests == nullptr) {
+            return compute();
+        }
+        return digests->get(file, algorithm, compute);
+    }
 };
 
 class verifier
@@ -36,6 +82,42 @@ public:
 
     // Returns the additional files needed for this verification.
     virtual std::vector<std::string> const& files() const = 0;
+
+    // Returns a stable identifier of this verifier and its parameters,
+    // e.g. the fingerprints of its keys, under which the outcome
+    // of a verification is recorded. A kept download is only reused
+    // if it was recorded with the same verifiers. An empty identifier,
+    // the default, means that downloads are never reused.
+    virtual std::string id() const { return {}; }
+};
+
+// Expected layout of a file that is verified in fixed-size chunks.
+struct chunk_layout
+{
+    // The size of the entire file in bytes.
+    uint64_t size{ 0 };
+    // The size of each chunk, only the last chunk may be smaller.
+    uint64_t chunk_size{ 0 };
+    // The hex-encoded SHA-256 digest of each chunk.
+    std::vector<std::string> digests{};
+    // The hex-encoded root of the Merkle tree over all chunk digests.
+    std::string root{};
+};
+
+// A verifier which checks a file in fixed-size chunks.
+// Chunks can then be verified while the file is being downloaded
+// and only chunks that fail verification need to be downloaded again.
+// Implemented by verifiers in addition to the verifier interface.
+class chunked_verifier
+{
+public:
+    virtual ~chunked_verifier() = default;
+
+    // Authenticates the additional files and returns the expected chunks
+    // for the file of the payload. This is called before that file
+    // is downloaded, so it may not be present in the payload yet.
+    // Must throw an exception if the layout could not be authenticated.
+    virtual chunk_layout chunks(verification_payload const& payload) const = 0;
 };
 
 class latest_extractor
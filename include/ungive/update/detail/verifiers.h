@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ungive/update/detail/common.h"
+#include "ungive/update/internal/chunks.h"
 #include "ungive/update/internal/crypto.h"
 #include "ungive/update/internal/types.h"
 #include "ungive/update/internal/util.h"
@@ -40,25 +41,45 @@ public:
 
     void operator()(types::verification_payload const& payload) const override
     {
-        bool has_valid = false;
+        verify(payload.additional_files.at(m_message_filename)
+                   .read(std::ios::binary),
+            payload.additional_files.at(m_digest_filename)
+                .read(std::ios::binary),
+            payload.cancelled);
+        logger()(log_level::info,
+            "file authenticity OK, " + m_key_type + " signatures match");
+    }
+
+    // Verifies that the signature of the message was made
+    // with the private key of any of the public keys.
+    // Throws verification_failed if it was not.
+    void verify(std::string const& message, std::string const& signature,
+        std::atomic<bool> const* cancelled = nullptr) const
+    {
         for (auto const& encoded_public_key : m_encoded_public_keys) {
+            if (cancelled != nullptr && cancelled->load()) {
+                throw std::runtime_error("signature verification cancelled");
+            }
             auto key = internal::crypto::parse_public_key(
                 encoded_public_key, m_key_format, m_key_type);
-            auto valid_signature = internal::crypto::verify_signature(key.get(),
-                payload.additional_files.at(m_digest_filename)
-                    .read(std::ios::binary),
-                payload.additional_files.at(m_message_filename)
-                    .read(std::ios::binary));
-            if (valid_signature) {
-                has_valid = valid_signature;
-                break;
+            if (internal::crypto::verify_signature(
+                    key.get(), signature, message)) {
+                return;
             }
         }
-        if (!has_valid) {
-            throw verification_failed("invalid " + m_key_type + " signature");
+        throw verification_failed("invalid " + m_key_type + " signature");
+    }
+
+    // Includes the algorithm and the fingerprint of each public key,
+    // so that records are not trusted once the keys are changed.
+    std::string id() const override
+    {
+        std::string result = "message_digest:" + m_key_type + ":" +
+            m_key_format + ":" + m_message_filename + ":" + m_digest_filename;
+        for (auto const& key : m_encoded_public_keys) {
+            result += ":" + internal::crypto::sha256(key.data(), key.size());
         }
-        logger()(log_level::info,
-            "file authenticity OK, " + m_key_type + " signatures match");
+        return result;
     }
 
 private:
@@ -69,22 +90,18 @@ private:
     std::string m_key_type;
 };
 
-// Verifier for "SHA256SUMS" type of files.
-class sha256sums : public internal::types::base_verifier
+// Base class for verifiers of checksum files, as they are generated
+// by command line utilities like "sha256sum" or "b3sum".
+class checksums : public internal::types::base_verifier
 {
 public:
-    sha256sums(std::string const& shasums_filename)
-        : base_verifier(shasums_filename), m_sums_filename{ shasums_filename }
-    {
-    }
-
     void operator()(types::verification_payload const& payload) const override
     {
         auto it = payload.additional_files.find(m_sums_filename);
         if (it == payload.additional_files.end()) {
-            throw std::runtime_error("sha256sums file not available");
+            throw std::runtime_error(m_sums_name + " file not available");
         }
-        auto sums = internal::crypto::parse_sha256sums(it->second.read());
+        auto sums = parse(it->second.read());
         auto found = payload.additional_files.end();
         std::string expected_hash;
         for (auto const& pair : sums) {
@@ -107,25 +124,189 @@ public:
             throw std::runtime_error(
                 "file to verify not present in shasums file: " + payload.file);
         }
-        auto actual_hash = internal::crypto::sha256_file(found->second.path());
+        auto const& path = found->second.path();
+        auto actual_hash = payload.digest(path, m_hash_name, [&] {
+            return hash(path, payload.cancelled);
+        });
         if (actual_hash != expected_hash) {
-            throw verification_failed("SHA256 hashes do not match for file " +
+            throw verification_failed(m_hash_name +
+                " hashes do not match for file " + payload.file +
+                ": expected " + expected_hash + ", got " + actual_hash);
+        }
+        logger()(log_level::info,
+            "file integrity OK, " + m_hash_name + " hashes match for file " +
                 payload.file + ": expected " + expected_hash + ", got " +
                 actual_hash);
+    }
+
+    // The name of the hash algorithm, under which digests are cached.
+    inline std::string const& hash_name() const { return m_hash_name; }
+
+    std::string id() const override
+    {
+        return "checksums:" + m_hash_name + ":" + m_sums_filename;
+    }
+
+protected:
+    checksums(std::string const& sums_filename, std::string const& sums_name,
+        std::string const& hash_name)
+        : base_verifier(sums_filename), m_sums_filename{ sums_filename },
+          m_sums_name{ sums_name }, m_hash_name{ hash_name }
+    {
+    }
+
+    // Parses the checksum file into pairs of hashes and paths.
+    virtual std::vector<std::pair<std::string, std::string>> parse(
+        std::string const& data) const = 0;
+
+    // Computes the hash of a file. Should stop early once cancelled.
+    virtual std::string hash(std::filesystem::path const& path,
+        std::atomic<bool> const* cancelled) const = 0;
+
+private:
+    std::string m_sums_filename;
+    std::string m_sums_name;
+    std::string m_hash_name;
+};
+
+// Verifier for "SHA256SUMS" type of files.
+class sha256sums : public checksums
+{
+public:
+    sha256sums(std::string const& shasums_filename)
+        : checksums(shasums_filename, "sha256sums", "SHA256")
+    {
+    }
+
+protected:
+    std::vector<std::pair<std::string, std::string>> parse(
+        std::string const& data) const override
+    {
+        return internal::crypto::parse_sha256sums(data);
+    }
+
+    std::string hash(std::filesystem::path const& path,
+        std::atomic<bool> const* cancelled) const override
+    {
+        return internal::crypto::sha256_file(path, cancelled);
+    }
+};
+
+// Verifier for "B3SUMS" type of files, as generated by "b3sum".
+// Can be used in place of sha256sums. BLAKE3 is a tree hash,
+// so unlike SHA-256 a single large file is hashed on all available cores.
+class b3sums : public checksums
+{
+public:
+    b3sums(std::string const& b3sums_filename)
+        : checksums(b3sums_filename, "b3sums", "BLAKE3")
+    {
+    }
+
+protected:
+    std::vector<std::pair<std::string, std::string>> parse(
+        std::string const& data) const override
+    {
+        return internal::crypto::parse_b3sums(data);
+    }
+
+    std::string hash(std::filesystem::path const& path,
+        std::atomic<bool> const* cancelled) const override
+    {
+        return internal::crypto::blake3_file(path, cancelled);
+    }
+};
+
+// Verifier for files with a signed chunk manifest,
+// which lists a SHA-256 digest for each fixed-size chunk of the file
+// and the root of the Merkle tree over these digests.
+// The manifest format is documented with internal::chunk_manifest,
+// its signature is verified like with the message_digest verifier.
+// When used with the http_downloader, chunks are verified while
+// the file is being downloaded and only chunks that fail verification
+// are downloaded again, using HTTP range requests.
+class chunk_manifest : public internal::types::base_verifier,
+                       public types::chunked_verifier
+{
+public:
+    chunk_manifest(std::string const& manifest_filename,
+        std::string const& signature_filename, std::string const& key_format,
+        std::string const& key_type,
+        std::vector<std::string> const& encoded_public_keys)
+        : base_verifier({ manifest_filename, signature_filename }),
+          m_manifest_filename{ manifest_filename },
+          m_signature(manifest_filename, signature_filename, key_format,
+              key_type, encoded_public_keys)
+    {
+    }
+
+    chunk_manifest(std::string const& manifest_filename,
+        std::string const& signature_filename, std::string const& key_format,
+        std::string const& key_type, std::string const& encoded_public_key)
+        : chunk_manifest(manifest_filename, signature_filename, key_format,
+              key_type, std::vector<std::string>{ encoded_public_key })
+    {
+    }
+
+    types::chunk_layout chunks(
+        types::verification_payload const& payload) const override
+    {
+        m_signature(payload);
+        auto manifest = internal::chunk_manifest::parse(
+            payload.additional_files.at(m_manifest_filename).read());
+        auto const& layout = manifest.layout();
+        if (internal::crypto::merkle_root(layout.digests) != layout.root) {
+            throw verification_failed(
+                "chunk manifest root does not match its chunks");
+        }
+        if (manifest.file() !=
+            std::filesystem::path(payload.file).filename().string()) {
+            throw verification_failed(
+                "chunk manifest is for a different file: " + manifest.file());
+        }
+        return layout;
+    }
+
+    void operator()(types::verification_payload const& payload) const override
+    {
+        auto layout = chunks(payload);
+        auto found = payload.additional_files.find(payload.file);
+        if (found == payload.additional_files.end()) {
+            throw std::runtime_error(
+                "file to verify not available: " + payload.file);
+        }
+        auto size = std::filesystem::file_size(found->second.path());
+        if (size != layout.size) {
+            throw verification_failed("file size does not match for file " +
+                payload.file + ": expected " + std::to_string(layout.size) +
+                ", got " + std::to_string(size));
+        }
+        auto const& path = found->second.path();
+        auto algorithm = "SHA256-chunks-" + std::to_string(layout.chunk_size);
+        auto actual_root = payload.digest(path, algorithm, [&] {
+            return internal::crypto::merkle_root(
+                internal::hash_chunks(path, layout, payload.cancelled));
+        });
+        if (actual_root != layout.root) {
+            throw verification_failed(
+                "chunks do not match for file " + payload.file +
+                ": expected merkle root " + layout.root + ", got " +
+                actual_root);
         }
         logger()(log_level::info,
-            "file integrity OK, SHA256 hashes match for file " + payload.file +
-                ": expected " + expected_hash + ", got " + actual_hash);
+            "file integrity OK, all " +
+                std::to_string(layout.digests.size()) +
+                " chunks match for file " + payload.file);
     }
 
-private:
-    inline bool verify_hash(
-        std::string const& hash, downloaded_file const& file) const
+    std::string id() const override
     {
-        return hash == internal::crypto::sha256_file(file.path());
+        return "chunk_manifest:" + m_manifest_filename + ":" + m_signature.id();
     }
 
-    std::string m_sums_filename;
+private:
+    std::string m_manifest_filename;
+    message_digest m_signature;
 };
 
 } // namespace ungive::update::verifiers
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include "ungive/update/internal/file_manifest.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace ungive::update::internal
+{
+
+// Reads little-endian integers, as they are used in ZIP headers.
+inline uint16_t read_le16(char const* data)
+{
+    auto p = reinterpret_cast<unsigned char const*>(data);
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+inline uint32_t read_le32(char const* data)
+{
+    return static_cast<uint32_t>(read_le16(data)) |
+        (static_cast<uint32_t>(read_le16(data + 2)) << 16);
+}
+
+inline uint64_t read_le64(char const* data)
+{
+    return static_cast<uint64_t>(read_le32(data)) |
+        (static_cast<uint64_t>(read_le32(data + 4)) << 32);
+}
+
+// Returns the location of an archive entry within the target directory.
+// Leading "./" components are ignored, which archives have that were
+// created from the current directory, e.g. "tar -C dist -czf x.tar.gz .",
+// and their root entry "." is the target directory itself.
+// Throws if the entry's name would place it outside of that directory.
+inline std::filesystem::path archive_entry_path(
+    std::filesystem::path const& target_directory, std::string name)
+{
+    while (!name.empty() && name.back() == '/') {
+        name.pop_back();
+    }
+    std::size_t start = 0;
+    while (name.compare(start, 2, "./") == 0) {
+        start = name.find_first_not_of('/', start + 2);
+        if (start == std::string::npos) {
+            start = name.size();
+        }
+    }
+    name.erase(0, start);
+    if (name == "." || (name.empty() && start > 0)) {
+        return target_directory;
+    }
+    if (!is_contained_path(name)) {
+        throw std::runtime_error("invalid path in archive: " + name);
+    }
+    return target_directory / std::filesystem::u8path(name);
+}
+
+// Creates an empty file and reserves disk space for the given size.
+// Returns false if that is not possible, in which case nothing is created.
+inline bool preallocate_file(std::filesystem::path const& path, uint64_t size)
+{
+#if defined(__linux__)
+    int fd =
+        ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    // Failing is fine, the file is then simply allocated while writing.
+    (void)::fallocate(fd, 0, 0, static_cast<off_t>(size));
+    ::close(fd);
+    return true;
+#elif defined(WIN32)
+    std::ofstream(path, std::ios::out | std::ios::binary).close();
+    std::error_code ec;
+    std::filesystem::resize_file(path, size, ec);
+    return !ec;
+#else
+    return false;
+#endif
+}
+
+// Opens a file for an archive entry, whose parent directory must exist.
+// If its size is known the file is preallocated with that size.
+inline std::ofstream open_archive_file(
+    std::filesystem::path const& path, uint64_t size = 0)
+{
+    auto mode = std::ios::out | std::ios::binary;
+    if (size > 0 && preallocate_file(path, size)) {
+        // Do not truncate, that would release the reserved space.
+        mode |= std::ios::in;
+    }
+    std::ofstream out(path, mode);
+    if (!out) {
+        throw std::runtime_error(
+            "failed to create extracted file: " + path.string());
+    }
+    return out;
+}
+
+// Creates a file for an archive entry, including its parent directories.
+inline std::ofstream create_archive_file(std::filesystem::path const& path)
+{
+    if (path.has_parent_path()) {
+        std::filesystem::create_directories(path.parent_path());
+    }
+    return open_archive_file(path);
+}
+
+} // namespace ungive::update::internal
@@ -0,0 +1,365 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "ungive/update/internal/archive.h"
+#include "ungive/update/internal/io_uring.h"
+#include "ungive/update/internal/thread_pool.h"
+
+#if defined(UPDATE_WITH_IO_URING) && defined(IORING_FEAT_LINKED_FILE)
+#define UPDATE_IO_URING_WRITER
+#include <fcntl.h>
+#endif
+
+namespace ungive::update::internal
+{
+
+// Writes many small files whose content is held in memory, e.g. while
+// extracting an archive, without a system call round trip for each
+// file on the extracting thread. Added files are written in batches
+// on a separate thread, while the next batch is being collected.
+// A batch is written concurrently on a thread pool or, if built with
+// UPDATE_WITH_IO_URING on Linux 5.18 or newer, with io_uring,
+// which opens, writes and closes a bounded number of files at once
+// with few system calls.
+class batch_writer
+{
+public:
+    enum class backend
+    {
+        // Uses io_uring if it was enabled and is available, otherwise
+        // the thread pool. With a single thread, files are written
+        // immediately when they are added, as nothing can run in parallel.
+        automatic,
+        thread_pool,
+        io_uring,
+    };
+
+    // Files up to this size should be added to a batch writer,
+    // larger files are written more efficiently in place.
+    static constexpr std::size_t max_file_size = 64 * 1024;
+
+    // Creates a writer with the given backend. Throws if io_uring
+    // is requested explicitly, but not available.
+    batch_writer(backend backend = backend::automatic,
+        internal::thread_pool& pool = thread_pool::shared())
+        : m_pool{ pool },
+          m_immediate{ backend == backend::automatic && pool.size() <= 1 }
+    {
+#ifdef UPDATE_IO_URING_WRITER
+        if (backend != backend::thread_pool) {
+            try {
+                m_ring = std::make_unique<io_uring_queue>(
+                    ring_entries, ring_files);
+                m_umask = process_umask();
+                m_immediate = false;
+            }
+            catch (...) {
+                if (backend == backend::io_uring) {
+                    throw;
+                }
+            }
+        }
+#else
+        if (backend == backend::io_uring) {
+            throw std::runtime_error("io_uring is not supported");
+        }
+#endif
+    }
+
+    // Waits for the batch that is being written. Errors are ignored,
+    // call finish() to write all files and to receive any errors.
+    ~batch_writer()
+    {
+        if (m_worker.joinable()) {
+            m_worker.join();
+        }
+    }
+
+    batch_writer(batch_writer const&) = delete;
+    batch_writer& operator=(batch_writer const&) = delete;
+
+    // Returns whether files are written with io_uring.
+    bool uses_io_uring() const
+    {
+#ifdef UPDATE_IO_URING_WRITER
+        return m_ring != nullptr;
+#else
+        return false;
+#endif
+    }
+
+    // Returns whether a file with this path was added since the last
+    // call to finish() and may therefore not have been written yet.
+    bool contains(std::filesystem::path const& path) const
+    {
+        return m_paths.find(path.native()) != m_paths.end();
+    }
+
+    // Adds a file, which replaces any existing file.
+    // Its parent directories are created immediately.
+    // Permissions are only applied on platforms other than Windows,
+    // if they are not zero. Files are written in the order they are added,
+    // but adding a path again waits for all added files to be written.
+    // May throw the error of writing an earlier batch.
+    void add(std::filesystem::path const& path, std::string content,
+        uint32_t permissions = 0)
+    {
+        if (contains(path)) {
+            finish();
+        }
+        auto parent = path.parent_path();
+        if (parent != m_last_parent) {
+            std::filesystem::create_directories(parent);
+            m_last_parent = parent;
+        }
+        if (m_immediate) {
+            write_one(file{ path, std::move(content), permissions });
+            return;
+        }
+        m_pending_size += content.size();
+        m_paths.insert(path.native());
+        m_pending.push_back(file{ path, std::move(content), permissions });
+        if (m_pending.size() >= max_batch_files ||
+            m_pending_size >= max_batch_size) {
+            start();
+        }
+    }
+
+    // Writes all added files and waits until they have been written.
+    // Throws the first error that occurred while writing.
+    void finish()
+    {
+        start();
+        join();
+        m_paths.clear();
+    }
+
+private:
+    struct file
+    {
+        std::filesystem::path path;
+        std::string content;
+        uint32_t permissions;
+    };
+
+    static constexpr std::size_t max_batch_files = 1024;
+    static constexpr std::size_t max_batch_size = 8 * 1024 * 1024;
+    static constexpr unsigned int ring_entries = 256;
+    // Each file takes three entries and one direct descriptor
+    // while it is being written.
+    static constexpr unsigned int ring_files = 64;
+
+    // Waits for the batch that is being written and starts the next one.
+    void start()
+    {
+        join();
+        if (m_pending.empty()) {
+            return;
+        }
+        m_worker = std::thread([this, batch = std::move(m_pending)] {
+            try {
+                write(batch);
+            }
+            catch (...) {
+                m_error = std::current_exception();
+            }
+        });
+        m_pending.clear();
+        m_pending_size = 0;
+    }
+
+    void join()
+    {
+        if (m_worker.joinable()) {
+            m_worker.join();
+        }
+        if (m_error) {
+            auto error = m_error;
+            m_error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    void write(std::vector<file> const& files)
+    {
+#ifdef UPDATE_IO_URING_WRITER
+        if (m_ring != nullptr) {
+            write_with_io_uring(files);
+            return;
+        }
+#endif
+        task_group group(m_pool);
+        group.add_batches(files.size(), 16,
+            [&files](std::size_t begin, std::size_t end,
+                std::atomic<bool> const& cancelled) {
+                for (auto i = begin; i < end && !cancelled.load(); i++) {
+                    write_one(files[i]);
+                }
+            });
+        group.run();
+    }
+
+    static void write_one(file const& file)
+    {
+        auto out = open_archive_file(file.path);
+        out.write(file.content.data(), file.content.size());
+        out.close();
+        if (out.fail()) {
+            throw std::runtime_error(
+                "failed to write extracted file: " + file.path.string());
+        }
+        apply_permissions(file);
+    }
+
+    static void apply_permissions(file const& file)
+    {
+#ifndef WIN32
+        if (file.permissions != 0) {
+            std::filesystem::permissions(file.path,
+                static_cast<std::filesystem::perms>(file.permissions));
+        }
+#endif
+    }
+
+#ifdef UPDATE_IO_URING_WRITER
+    enum operation : uint64_t
+    {
+        open_operation,
+        write_operation,
+        close_operation,
+    };
+
+    // Opens, writes and closes each file with a chain of three requests,
+    // which refer to the file by a direct descriptor. The close request
+    // is hard-linked, so that it also runs when writing failed.
+    void write_with_io_uring(std::vector<file> const& files)
+    {
+        auto& ring = *m_ring;
+        std::vector<unsigned int> free_slots;
+        for (unsigned int i = ring_files; i > 0; i--) {
+            free_slots.push_back(i - 1);
+        }
+        std::vector<unsigned int> slots(files.size());
+        std::vector<char> failed(files.size(), 0);
+        std::string error;
+        std::size_t next = 0;
+        std::size_t active = 0;
+        while (next < files.size() || active > 0) {
+            while (next < files.size() && !free_slots.empty() &&
+                ring.space() >= 3) {
+                slots[next] = free_slots.back();
+                free_slots.pop_back();
+                queue(ring, files[next], next, slots[next]);
+                next++;
+                active++;
+            }
+            ring.submit(1);
+            ring.complete([&](io_uring_cqe const& cqe) {
+                auto index = static_cast<std::size_t>(cqe.user_data >> 2);
+                auto operation = cqe.user_data & 3;
+                auto result = cqe.res;
+                if (operation == write_operation && result >= 0 &&
+                    static_cast<std::size_t>(result) !=
+                        files[index].content.size()) {
+                    result = -EIO;
+                }
+                if (result < 0 && !failed[index] && result != -ECANCELED) {
+                    failed[index] = 1;
+                    if (error.empty()) {
+                        error = "failed to write extracted file: " +
+                            files[index].path.string() + ": " +
+                            std::strerror(-result);
+                    }
+                }
+                if (operation == close_operation) {
+                    free_slots.push_back(slots[index]);
+                    active--;
+                }
+            });
+        }
+        if (!error.empty()) {
+            throw std::runtime_error(error);
+        }
+        // Files were created with their permissions,
+        // but only those which the umask removed need to be fixed.
+        for (auto const& file : files) {
+            if ((file.permissions & m_umask) != 0) {
+                apply_permissions(file);
+            }
+        }
+    }
+
+    static void queue(io_uring_queue& ring, file const& file,
+        std::size_t index, unsigned int slot)
+    {
+        auto* open = ring.next();
+        open->opcode = IORING_OP_OPENAT;
+        open->fd = AT_FDCWD;
+        open->addr = reinterpret_cast<uint64_t>(file.path.c_str());
+        // Direct descriptors are never inherited, O_CLOEXEC is invalid.
+        open->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+        open->len = file.permissions != 0 ? file.permissions : 0666;
+        open->file_index = slot + 1;
+        open->flags = IOSQE_IO_LINK;
+        open->user_data = (index << 2) | open_operation;
+        auto* write = ring.next();
+        write->opcode = IORING_OP_WRITE;
+        write->fd = static_cast<int>(slot);
+        write->addr = reinterpret_cast<uint64_t>(file.content.data());
+        write->len = static_cast<uint32_t>(file.content.size());
+        write->off = 0;
+        write->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+        write->user_data = (index << 2) | write_operation;
+        auto* close = ring.next();
+        close->opcode = IORING_OP_CLOSE;
+        close->file_index = slot + 1;
+        close->user_data = (index << 2) | close_operation;
+    }
+
+    // Returns the file mode creation mask of this process,
+    // without changing it, as umask() would, or all bits if unknown.
+    static uint32_t process_umask()
+    {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.rfind("Umask:", 0) == 0) {
+                return static_cast<uint32_t>(
+                    std::stoul(line.substr(6), nullptr, 8));
+            }
+        }
+        return 0777;
+    }
+
+    std::unique_ptr<io_uring_queue> m_ring{};
+#endif
+
+    internal::thread_pool& m_pool;
+    bool m_immediate;
+    uint32_t m_umask{ 0777 };
+    std::vector<file> m_pending{};
+    std::size_t m_pending_size{ 0 };
+    std::unordered_set<std::filesystem::path::string_type> m_paths{};
+    std::filesystem::path m_last_parent{};
+    std::thread m_worker{};
+    std::exception_ptr m_error{};
+};
+
+} // namespace ungive::update::internal
+
+#undef UPDATE_IO_URING_WRITER
@@ -0,0 +1,455 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ungive/update/internal/thread_pool.h"
+
+// Portable BLAKE3 implementation, following the reference implementation
+// in https://github.com/BLAKE3-team/BLAKE3/tree/master/reference_impl.
+// Full chunks are compressed several at a time with generic vector types,
+// which the compiler lowers to the SIMD instructions of the target,
+// and files are split into subtrees which are hashed on a thread pool.
+
+#if defined(__GNUC__) || defined(__clang__)
+#define UNGIVE_UPDATE_BLAKE3_VECTORS
+#endif
+
+namespace ungive::update::internal::blake3
+{
+
+constexpr std::size_t out_len = 32;
+constexpr std::size_t block_len = 64;
+constexpr std::size_t chunk_len = 1024;
+
+// The number of chunks in a subtree that is hashed by a single task.
+// Must be a power of two, the resulting subtree size is 1 MiB.
+constexpr std::size_t subtree_chunks = 1024;
+constexpr std::size_t subtree_len = subtree_chunks * chunk_len;
+
+// The number of chunks that are compressed simultaneously.
+constexpr std::size_t simd_degree = 8;
+
+enum flags : uint32_t
+{
+    chunk_start = 1 << 0,
+    chunk_end = 1 << 1,
+    parent = 1 << 2,
+    root = 1 << 3,
+};
+
+using chaining_value = std::array<uint32_t, 8>;
+using block_words = std::array<uint32_t, 16>;
+
+inline constexpr chaining_value iv = { 0x6A09E667, 0xBB67AE85, 0x3C6EF372,
+    0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
+
+inline constexpr std::size_t message_schedule[7][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+    { 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+    { 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+    { 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+    { 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+    { 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+inline uint32_t load_le32(unsigned char const* p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+        (static_cast<uint32_t>(p[2]) << 16) |
+        (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline block_words load_block(unsigned char const* block)
+{
+    block_words words;
+    for (std::size_t i = 0; i < 16; i++) {
+        words[i] = load_le32(block + i * 4);
+    }
+    return words;
+}
+
+// Applies all seven rounds to the given state words,
+// which may be scalars or vectors of words.
+template <typename W>
+inline void rounds(W (&v)[16], W const (&m)[16])
+{
+    // Operands are passed by reference, since passing vectors by value
+    // depends on the instruction set the translation unit is compiled for.
+    auto rotr = [](W& x, int n) {
+        x = (x >> n) | (x << (32 - n));
+    };
+    auto g = [&](int a, int b, int c, int d, W const& x, W const& y) {
+        v[a] = v[a] + v[b] + x;
+        v[d] ^= v[a];
+        rotr(v[d], 16);
+        v[c] = v[c] + v[d];
+        v[b] ^= v[c];
+        rotr(v[b], 12);
+        v[a] = v[a] + v[b] + y;
+        v[d] ^= v[a];
+        rotr(v[d], 8);
+        v[c] = v[c] + v[d];
+        v[b] ^= v[c];
+        rotr(v[b], 7);
+    };
+    for (auto const& s : message_schedule) {
+        g(0, 4, 8, 12, m[s[0]], m[s[1]]);
+        g(1, 5, 9, 13, m[s[2]], m[s[3]]);
+        g(2, 6, 10, 14, m[s[4]], m[s[5]]);
+        g(3, 7, 11, 15, m[s[6]], m[s[7]]);
+        g(0, 5, 10, 15, m[s[8]], m[s[9]]);
+        g(1, 6, 11, 12, m[s[10]], m[s[11]]);
+        g(2, 7, 8, 13, m[s[12]], m[s[13]]);
+        g(3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+}
+
+inline std::array<uint32_t, 16> compress(chaining_value const& cv,
+    block_words const& block, uint64_t counter, uint32_t length,
+    uint32_t block_flags)
+{
+    uint32_t v[16] = { cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        iv[0], iv[1], iv[2], iv[3], static_cast<uint32_t>(counter),
+        static_cast<uint32_t>(counter >> 32), length, block_flags };
+    uint32_t m[16];
+    std::copy(block.begin(), block.end(), m);
+    rounds(v, m);
+    std::array<uint32_t, 16> out;
+    for (std::size_t i = 0; i < 8; i++) {
+        out[i] = v[i] ^ v[i + 8];
+        out[i + 8] = v[i + 8] ^ cv[i];
+    }
+    return out;
+}
+
+// The inputs of a compression that has not been performed yet,
+// such that it can be finalized either as a chaining value or as the root.
+struct output
+{
+    chaining_value input_cv;
+    block_words block;
+    uint64_t counter;
+    uint32_t length;
+    uint32_t flags;
+
+    chaining_value cv() const
+    {
+        auto out = compress(input_cv, block, counter, length, flags);
+        chaining_value result;
+        std::copy(out.begin(), out.begin() + 8, result.begin());
+        return result;
+    }
+
+    std::array<unsigned char, out_len> root_bytes() const
+    {
+        auto out = compress(input_cv, block, 0, length, flags | root);
+        std::array<unsigned char, out_len> result;
+        for (std::size_t i = 0; i < out_len / 4; i++) {
+            for (std::size_t j = 0; j < 4; j++) {
+                result[i * 4 + j] =
+                    static_cast<unsigned char>(out[i] >> (8 * j));
+            }
+        }
+        return result;
+    }
+};
+
+inline output parent_output(
+    chaining_value const& left, chaining_value const& right)
+{
+    block_words block;
+    std::copy(left.begin(), left.end(), block.begin());
+    std::copy(right.begin(), right.end(), block.begin() + 8);
+    return output{ iv, block, 0, block_len, parent };
+}
+
+inline chaining_value parent_cv(
+    chaining_value const& left, chaining_value const& right)
+{
+    return parent_output(left, right).cv();
+}
+
+// Computes the chaining values of consecutive full chunks,
+// simd_degree chunks at a time where vector types are available.
+inline void hash_chunks(unsigned char const* input, std::size_t chunks,
+    uint64_t chunk_counter, chaining_value* out)
+{
+    std::size_t i = 0;
+#ifdef UNGIVE_UPDATE_BLAKE3_VECTORS
+    using lanes = uint32_t
+        __attribute__((vector_size(sizeof(uint32_t) * simd_degree)));
+    for (; i + simd_degree <= chunks; i += simd_degree) {
+        lanes h[8];
+        for (std::size_t w = 0; w < 8; w++) {
+            h[w] = lanes{} + iv[w];
+        }
+        lanes counter_low, counter_high;
+        for (std::size_t lane = 0; lane < simd_degree; lane++) {
+            auto counter = chunk_counter + i + lane;
+            counter_low[lane] = static_cast<uint32_t>(counter);
+            counter_high[lane] = static_cast<uint32_t>(counter >> 32);
+        }
+        for (std::size_t b = 0; b < chunk_len / block_len; b++) {
+            uint32_t block_flags = (b == 0 ? uint32_t(chunk_start) : 0) |
+                (b == chunk_len / block_len - 1 ? uint32_t(chunk_end) : 0);
+            lanes m[16];
+            for (std::size_t lane = 0; lane < simd_degree; lane++) {
+                auto block = input + (i + lane) * chunk_len + b * block_len;
+                for (std::size_t w = 0; w < 16; w++) {
+                    m[w][lane] = load_le32(block + w * 4);
+                }
+            }
+            lanes v[16] = { h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+                lanes{} + iv[0], lanes{} + iv[1], lanes{} + iv[2],
+                lanes{} + iv[3], counter_low, counter_high,
+                lanes{} + static_cast<uint32_t>(block_len),
+                lanes{} + block_flags };
+            rounds(v, m);
+            for (std::size_t w = 0; w < 8; w++) {
+                h[w] = v[w] ^ v[w + 8];
+            }
+        }
+        for (std::size_t lane = 0; lane < simd_degree; lane++) {
+            for (std::size_t w = 0; w < 8; w++) {
+                out[i + lane][w] = h[w][lane];
+            }
+        }
+    }
+#endif
+    for (; i < chunks; i++) {
+        chaining_value cv = iv;
+        for (std::size_t b = 0; b < chunk_len / block_len; b++) {
+            uint32_t block_flags = (b == 0 ? uint32_t(chunk_start) : 0) |
+                (b == chunk_len / block_len - 1 ? uint32_t(chunk_end) : 0);
+            auto block = load_block(input + i * chunk_len + b * block_len);
+            auto result = compress(
+                cv, block, chunk_counter + i, block_len, block_flags);
+            std::copy(result.begin(), result.begin() + 8, cv.begin());
+        }
+        out[i] = cv;
+    }
+}
+
+// Computes the chaining value of a complete, non-root subtree
+// that consists of a power of two number of full chunks.
+inline chaining_value hash_subtree(
+    unsigned char const* input, std::size_t chunks, uint64_t chunk_counter)
+{
+    std::vector<chaining_value> cvs(chunks);
+    hash_chunks(input, chunks, chunk_counter, cvs.data());
+    while (chunks > 1) {
+        for (std::size_t i = 0; i < chunks / 2; i++) {
+            cvs[i] = parent_cv(cvs[2 * i], cvs[2 * i + 1]);
+        }
+        chunks /= 2;
+    }
+    return cvs[0];
+}
+
+// State of the chunk that is currently being hashed.
+class chunk_state
+{
+public:
+    chunk_state(uint64_t chunk_counter = 0) : m_chunk_counter{ chunk_counter }
+    {
+    }
+
+    inline std::size_t size() const
+    {
+        return block_len * m_blocks_compressed + m_block_len;
+    }
+
+    inline uint64_t counter() const { return m_chunk_counter; }
+
+    void update(unsigned char const* input, std::size_t length)
+    {
+        while (length > 0) {
+            if (m_block_len == block_len) {
+                auto result = compress(m_cv, load_block(m_block), m_chunk_counter,
+                    block_len, start_flag());
+                std::copy(result.begin(), result.begin() + 8, m_cv.begin());
+                m_blocks_compressed++;
+                std::fill(std::begin(m_block), std::end(m_block), 0);
+                m_block_len = 0;
+            }
+            auto take = std::min(block_len - m_block_len, length);
+            std::memcpy(m_block + m_block_len, input, take);
+            m_block_len += take;
+            input += take;
+            length -= take;
+        }
+    }
+
+    output finish() const
+    {
+        return output{ m_cv, load_block(m_block), m_chunk_counter,
+            static_cast<uint32_t>(m_block_len), start_flag() | chunk_end };
+    }
+
+private:
+    inline uint32_t start_flag() const
+    {
+        return m_blocks_compressed == 0 ? uint32_t(chunk_start) : 0;
+    }
+
+    chaining_value m_cv{ iv };
+    uint64_t m_chunk_counter;
+    unsigned char m_block[block_len] = {};
+    std::size_t m_block_len{ 0 };
+    std::size_t m_blocks_compressed{ 0 };
+};
+
+// An incremental BLAKE3 hasher with the default (unkeyed) mode.
+class hasher
+{
+public:
+    hasher() = default;
+
+    void update(void const* data, std::size_t length)
+    {
+        auto input = static_cast<unsigned char const*>(data);
+        while (length > 0) {
+            if (m_chunk.size() == chunk_len) {
+                auto total_chunks = m_chunk.counter() + 1;
+                push_cv(m_chunk.finish().cv(), total_chunks);
+                m_chunk = chunk_state(total_chunks);
+            }
+            // Hash whole chunks in bulk when at a chunk boundary
+            // and when there is more input after them.
+            if (m_chunk.size() == 0 && length > chunk_len) {
+                auto chunks = std::min((length - 1) / chunk_len,
+                    static_cast<std::size_t>(simd_degree));
+                chaining_value cvs[simd_degree];
+                hash_chunks(input, chunks, m_chunk.counter(), cvs);
+                for (std::size_t i = 0; i < chunks; i++) {
+                    push_cv(cvs[i], m_chunk.counter() + i + 1);
+                }
+                m_chunk = chunk_state(m_chunk.counter() + chunks);
+                input += chunks * chunk_len;
+                length -= chunks * chunk_len;
+                continue;
+            }
+            auto take = std::min(chunk_len - m_chunk.size(), length);
+            m_chunk.update(input, take);
+            input += take;
+            length -= take;
+        }
+    }
+
+    // Adds the chaining value of a complete subtree of the given number
+    // of chunks, which must be a power of two. Only valid at a boundary
+    // that is a multiple of the subtree size, before any other input.
+    void push_subtree(chaining_value const& cv, std::size_t chunks)
+    {
+        auto total_chunks = m_chunk.counter() + chunks;
+        push_cv(cv, total_chunks / chunks);
+        m_chunk = chunk_state(total_chunks);
+    }
+
+    std::array<unsigned char, out_len> finalize() const
+    {
+        auto out = m_chunk.finish();
+        for (auto it = m_stack.rbegin(); it != m_stack.rend(); ++it) {
+            out = parent_output(*it, out.cv());
+        }
+        return out.root_bytes();
+    }
+
+    std::string hexdigest() const
+    {
+        std::ostringstream oss;
+        for (auto c : finalize()) {
+            oss << std::hex << std::setw(2) << std::setfill('0')
+                << static_cast<int>(c);
+        }
+        return oss.str();
+    }
+
+private:
+    // Merges the new chaining value with completed subtrees of the same size.
+    // The unit of total is the size of the subtree that is pushed.
+    void push_cv(chaining_value cv, uint64_t total)
+    {
+        while ((total & 1) == 0) {
+            cv = parent_cv(m_stack.back(), cv);
+            m_stack.pop_back();
+            total >>= 1;
+        }
+        m_stack.push_back(cv);
+    }
+
+    chunk_state m_chunk{};
+    std::vector<chaining_value> m_stack{};
+};
+
+// Computes the BLAKE3 hash of a file.
+// Files that are larger than a single subtree are split into subtrees,
+// which are read and hashed concurrently on the given thread pool.
+// Throws an exception if the cancelled flag is set while hashing.
+inline std::string hash_file(std::filesystem::path const& path,
+    std::atomic<bool> const* cancelled = nullptr,
+    thread_pool& pool = thread_pool::shared())
+{
+    if (!std::filesystem::exists(path)) {
+        throw std::runtime_error(
+            "file to hash does not exist: " + path.string());
+    }
+    auto check_cancelled = [&](std::atomic<bool> const* flag) {
+        if (flag != nullptr && flag->load()) {
+            throw std::runtime_error("hashing cancelled: " + path.string());
+        }
+    };
+    auto read_at = [&](std::ifstream& ifs, uint64_t offset,
+                       std::vector<char>& buffer) {
+        ifs.seekg(static_cast<std::streamoff>(offset));
+        ifs.read(buffer.data(), buffer.size());
+        if (static_cast<std::size_t>(ifs.gcount()) != buffer.size()) {
+            throw std::runtime_error("failed to read file: " + path.string());
+        }
+    };
+    auto size = std::filesystem::file_size(path);
+    // Every subtree but the last one is complete. The last one contains
+    // the final chunk, which must be hashed as part of the root computation.
+    uint64_t subtrees = size > 0 ? (size - 1) / subtree_len : 0;
+    std::vector<chaining_value> cvs(subtrees);
+    task_group group(pool);
+    for (uint64_t i = 0; i < subtrees; i++) {
+        group.add([&, i](std::atomic<bool> const& group_cancelled) {
+            check_cancelled(cancelled);
+            check_cancelled(&group_cancelled);
+            std::ifstream ifs(path, std::ios::binary);
+            std::vector<char> buffer(subtree_len);
+            read_at(ifs, i * subtree_len, buffer);
+            cvs[i] = hash_subtree(
+                reinterpret_cast<unsigned char const*>(buffer.data()),
+                subtree_chunks, i * subtree_chunks);
+        });
+    }
+    group.run();
+    hasher hasher;
+    for (auto const& cv : cvs) {
+        hasher.push_subtree(cv, subtree_chunks);
+    }
+    std::ifstream ifs(path, std::ios::binary);
+    std::vector<char> buffer(size - subtrees * subtree_len);
+    read_at(ifs, subtrees * subtree_len, buffer);
+    hasher.update(buffer.data(), buffer.size());
+    return hasher.hexdigest();
+}
+
+} // namespace ungive::update::internal::blake3
+
+#undef UNGIVE_UPDATE_BLAKE3_VECTORS
@@ -0,0 +1,336 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ungive/update/detail/types.h"
+#include "ungive/update/internal/crypto.h"
+#include "ungive/update/internal/thread_pool.h"
+
+namespace ungive::update::internal
+{
+
+// Upper bound for the chunk size of a chunk manifest,
+// since chunks are buffered in memory while they are hashed.
+constexpr uint64_t max_chunk_size = 64 * 1024 * 1024;
+
+// A manifest which lists the SHA-256 digest of each fixed-size chunk
+// of a file and the root of the Merkle tree over these digests
+// (see crypto::merkle_root()). The manifest is a text file
+// with one "key=value" pair per line, the chunks are listed in order:
+//
+//  file=release-1.2.3.zip
+//  size=10485760
+//  chunk_size=4194304
+//  root=<hex-encoded merkle root>
+//  chunk=<hex-encoded digest of the first chunk>
+//  chunk=<hex-encoded digest of the second chunk>
+//  chunk=<hex-encoded digest of the third chunk>
+//
+class chunk_manifest
+{
+public:
+    // Parses a manifest. Throws an exception if a field is missing
+    // or if the number of chunks does not match the file size.
+    // Does not check whether the root matches the chunk digests.
+    static chunk_manifest parse(std::string const& content)
+    {
+        chunk_manifest result;
+        std::optional<uint64_t> size;
+        std::optional<uint64_t> chunk_size;
+        std::istringstream iss(content);
+        for (std::string line; std::getline(iss, line);) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            auto index = line.find_first_of('=');
+            if (index == std::string::npos) {
+                continue;
+            }
+            auto key = line.substr(0, index);
+            auto value = line.substr(index + 1);
+            if (key == "file") {
+                result.m_file = value;
+            } else if (key == "size") {
+                size = std::stoull(value);
+            } else if (key == "chunk_size") {
+                chunk_size = std::stoull(value);
+            } else if (key == "root") {
+                result.m_layout.root = value;
+            } else if (key == "chunk") {
+                if (value.size() != 2 * SHA256_DIGEST_LENGTH) {
+                    throw std::runtime_error("invalid chunk digest length");
+                }
+                result.m_layout.digests.push_back(value);
+            }
+        }
+        if (result.m_file.empty() || !size.has_value() ||
+            !chunk_size.has_value() || result.m_layout.root.empty()) {
+            throw std::runtime_error("chunk manifest is missing fields");
+        }
+        if (size.value() == 0) {
+            throw std::runtime_error("chunk manifest describes an empty file");
+        }
+        if (chunk_size.value() == 0 || chunk_size.value() > max_chunk_size) {
+            throw std::runtime_error(
+                "chunk manifest has an invalid chunk size");
+        }
+        auto expected_chunks =
+            (size.value() + chunk_size.value() - 1) / chunk_size.value();
+        if (result.m_layout.digests.size() != expected_chunks) {
+            throw std::runtime_error(
+                "chunk manifest has an unexpected number of chunks");
+        }
+        result.m_layout.size = size.value();
+        result.m_layout.chunk_size = chunk_size.value();
+        return result;
+    }
+
+    // Creates the manifest for a file, e.g. to publish it with a release.
+    static chunk_manifest create(std::filesystem::path const& path,
+        uint64_t chunk_size, thread_pool& pool = thread_pool::shared());
+
+    // Encodes the manifest in the format that is read by parse().
+    std::string encode() const
+    {
+        std::ostringstream oss;
+        oss << "file=" << m_file << "\n";
+        oss << "size=" << m_layout.size << "\n";
+        oss << "chunk_size=" << m_layout.chunk_size << "\n";
+        oss << "root=" << m_layout.root << "\n";
+        for (auto const& digest : m_layout.digests) {
+            oss << "chunk=" << digest << "\n";
+        }
+        return oss.str();
+    }
+
+    // The filename of the file this manifest was created for.
+    inline std::string const& file() const { return m_file; }
+
+    // The expected chunks of the file.
+    inline update::types::chunk_layout const& layout() const
+    {
+        return m_layout;
+    }
+
+private:
+    std::string m_file{};
+    update::types::chunk_layout m_layout{};
+};
+
+// Returns the length of the chunk with the given index.
+inline uint64_t chunk_length(
+    update::types::chunk_layout const& layout, size_t index)
+{
+    auto offset = index * layout.chunk_size;
+    return std::min(layout.chunk_size, layout.size - offset);
+}
+
+// Hashes all chunks of a file concurrently on the given thread pool.
+// The file must have the size that is specified in the layout.
+inline std::vector<std::string> hash_chunks(std::filesystem::path const& path,
+    update::types::chunk_layout const& layout,
+    std::atomic<bool> const* cancelled = nullptr,
+    thread_pool& pool = thread_pool::shared())
+{
+    std::vector<std::string> result(
+        (layout.size + layout.chunk_size - 1) / layout.chunk_size);
+    task_group group(pool);
+    for (size_t i = 0; i < result.size(); i++) {
+        group.add([&, i](std::atomic<bool> const& group_cancelled) {
+            if (group_cancelled.load() ||
+                (cancelled != nullptr && cancelled->load())) {
+                throw std::runtime_error("hashing cancelled: " + path.string());
+            }
+            std::vector<char> buffer(chunk_length(layout, i));
+            std::ifstream ifs(path, std::ios::binary);
+            ifs.seekg(static_cast<std::streamoff>(i * layout.chunk_size));
+            ifs.read(buffer.data(), buffer.size());
+            if (static_cast<size_t>(ifs.gcount()) != buffer.size()) {
+                throw std::runtime_error(
+                    "failed to read chunk of file: " + path.string());
+            }
+            result[i] = crypto::sha256(buffer.data(), buffer.size());
+        });
+    }
+    group.run();
+    return result;
+}
+
+inline chunk_manifest chunk_manifest::create(
+    std::filesystem::path const& path, uint64_t chunk_size, thread_pool& pool)
+{
+    if (chunk_size == 0 || chunk_size > max_chunk_size) {
+        throw std::invalid_argument("invalid chunk size");
+    }
+    chunk_manifest result;
+    result.m_file = path.filename().string();
+    result.m_layout.size = std::filesystem::file_size(path);
+    result.m_layout.chunk_size = chunk_size;
+    if (result.m_layout.size == 0) {
+        throw std::runtime_error("cannot create a manifest for an empty file");
+    }
+    result.m_layout.digests =
+        hash_chunks(path, result.m_layout, nullptr, pool);
+    result.m_layout.root = crypto::merkle_root(result.m_layout.digests);
+    return result;
+}
+
+// Hashes the chunks of a file while it is being received
+// and compares them with the expected chunk digests.
+// Complete chunks are hashed concurrently on a thread pool.
+// If all workers are busy, the chunk is hashed by the thread
+// that calls update(), which bounds the number of buffered chunks.
+class chunk_hasher
+{
+public:
+    chunk_hasher(update::types::chunk_layout const& layout,
+        thread_pool& pool = thread_pool::shared())
+        : m_pool{ pool }, m_state{ std::make_shared<state>() }
+    {
+        m_state->layout = layout;
+        m_state->actual.resize(layout.digests.size());
+    }
+
+    ~chunk_hasher() { wait(); }
+
+    chunk_hasher(chunk_hasher const&) = delete;
+    chunk_hasher& operator=(chunk_hasher const&) = delete;
+
+    // Adds received data. Data beyond the expected size is not hashed,
+    // but it is recorded and reported by finish().
+    void update(char const* data, size_t size)
+    {
+        auto const& layout = m_state->layout;
+        while (size > 0 && m_index < layout.digests.size()) {
+            auto expected = chunk_length(layout, m_index);
+            auto take = std::min<uint64_t>(expected - m_buffer.size(), size);
+            m_buffer.insert(m_buffer.end(), data, data + take);
+            data += take;
+            size -= take;
+            if (m_buffer.size() == expected) {
+                submit();
+            }
+        }
+        m_overflow += size;
+    }
+
+    // Waits until all received chunks have been hashed and returns
+    // the indices of all chunks which do not match their expected digest,
+    // including chunks that have not been received. If more data was
+    // received than expected, the last chunk is reported as well,
+    // since the file does not end where it should.
+    std::vector<size_t> finish()
+    {
+        wait();
+        std::vector<size_t> result;
+        auto const& expected = m_state->layout.digests;
+        for (size_t i = 0; i < expected.size(); i++) {
+            if (m_state->actual[i] != expected[i] ||
+                (m_overflow > 0 && i + 1 == expected.size())) {
+                result.push_back(i);
+            }
+        }
+        return result;
+    }
+
+    // Returns the number of bytes received beyond the expected size.
+    inline uint64_t overflow() const { return m_overflow; }
+
+    // Hashes a chunk that was received again
+    // and returns whether it matches its expected digest.
+    bool replace(size_t index, std::string const& data)
+    {
+        wait();
+        auto digest = crypto::sha256(data.data(), data.size());
+        m_state->actual.at(index) = digest;
+        return digest == m_state->layout.digests.at(index);
+    }
+
+    // Returns the digests of the chunks that have been hashed.
+    // Only call this after finish() has been called.
+    inline std::vector<std::string> const& digests() const
+    {
+        return m_state->actual;
+    }
+
+private:
+    struct state
+    {
+        update::types::chunk_layout layout{};
+        std::vector<std::string> actual{};
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t pending{ 0 };
+
+        void hash(size_t index, std::vector<char> const& buffer)
+        {
+            std::string digest;
+            try {
+                digest = crypto::sha256(buffer.data(), buffer.size());
+            }
+            catch (...) {
+                // The chunk is considered not to match.
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            actual[index] = digest;
+        }
+    };
+
+    void submit()
+    {
+        auto index = m_index++;
+        auto buffer = std::make_shared<std::vector<char>>(std::move(m_buffer));
+        m_buffer = {};
+        {
+            std::lock_guard<std::mutex> lock(m_state->mutex);
+            if (m_state->pending >= m_pool.size()) {
+                // Hash it on this thread, which slows down the producer.
+                m_state->pending++;
+            } else {
+                m_state->pending++;
+                m_pool.post([state = m_state, index, buffer] {
+                    state->hash(index, *buffer);
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->pending--;
+                    state->done.notify_all();
+                });
+                return;
+            }
+        }
+        m_state->hash(index, *buffer);
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        m_state->pending--;
+    }
+
+    void wait()
+    {
+        if (m_index < m_state->layout.digests.size() && !m_buffer.empty()) {
+            // Hash the incomplete last chunk, it won't match.
+            submit();
+        }
+        std::unique_lock<std::mutex> lock(m_state->mutex);
+        m_state->done.wait(lock, [this] {
+            return m_state->pending == 0;
+        });
+    }
+
+    thread_pool& m_pool;
+    std::shared_ptr<state> m_state;
+    std::vector<char> m_buffer{};
+    size_t m_index{ 0 };
+    uint64_t m_overflow{ 0 };
+};
+
+} // namespace ungive::update::internal
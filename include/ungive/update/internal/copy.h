@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ungive/update/internal/thread_pool.h"
+
+namespace ungive::update::internal
+{
+
+#ifdef __linux__
+// Closes a file descriptor once it goes out of scope.
+struct scoped_fd
+{
+    int fd;
+
+    ~scoped_fd()
+    {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+};
+
+// Copies the content of one file to another within the kernel.
+// Returns false if that is not supported for these files,
+// in which case nothing has been copied yet.
+inline bool copy_file_range_all(int in, int out, uint64_t size)
+{
+    uint64_t copied = 0;
+    while (copied < size) {
+        auto n = ::copy_file_range(in, nullptr, out, nullptr,
+            static_cast<size_t>(std::min<uint64_t>(size - copied, 1 << 30)),
+            0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (copied == 0 &&
+                (errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+                    errno == EOPNOTSUPP)) {
+                return false;
+            }
+            throw std::runtime_error("copy_file_range failed");
+        }
+        if (n == 0) {
+            break;
+        }
+        copied += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+#endif
+
+// Copies a file including its permissions, overwriting the target.
+// On Linux the target shares the data blocks of the source if the
+// file system supports reflinks (FICLONE), otherwise the data is copied
+// within the kernel with copy_file_range(). Elsewhere, or if neither
+// is supported, the file is copied with std::filesystem::copy_file().
+inline void copy_file_fast(
+    std::filesystem::path const& source, std::filesystem::path const& target)
+{
+#ifdef __linux__
+    scoped_fd in{ ::open(source.c_str(), O_RDONLY | O_CLOEXEC) };
+    struct stat st;
+    if (in.fd < 0 || ::fstat(in.fd, &st) != 0) {
+        throw std::runtime_error("failed to open " + source.string());
+    }
+    scoped_fd out{ ::open(target.c_str(),
+        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777) };
+    if (out.fd < 0) {
+        throw std::runtime_error("failed to create " + target.string());
+    }
+    // The mode passed to open() is subject to the umask.
+    ::fchmod(out.fd, st.st_mode & 07777);
+    if (::ioctl(out.fd, FICLONE, in.fd) == 0) {
+        return;
+    }
+    if (copy_file_range_all(
+            in.fd, out.fd, static_cast<uint64_t>(st.st_size))) {
+        return;
+    }
+#endif
+    std::filesystem::copy_file(source, target,
+        std::filesystem::copy_options::overwrite_existing);
+}
+
+// Copies a directory tree to a target directory, which is created.
+// Directories and symbolic links are created first, files are then
+// copied concurrently with copy_file_fast() on the given thread pool.
+// Throws the first error once all started copies have stopped.
+inline void copy_tree(std::filesystem::path const& source,
+    std::filesystem::path const& target,
+    thread_pool& pool = thread_pool::shared())
+{
+    namespace fs = std::filesystem;
+    fs::create_directories(target);
+    std::vector<std::pair<fs::path, fs::path>> files;
+    for (auto it = fs::recursive_directory_iterator(source);
+         it != fs::recursive_directory_iterator(); ++it) {
+        auto destination = target / it->path().lexically_relative(source);
+        if (it->is_symlink()) {
+            fs::copy_symlink(it->path(), destination);
+        } else if (it->is_directory()) {
+            fs::create_directory(destination, it->path());
+        } else {
+            files.emplace_back(it->path(), std::move(destination));
+        }
+    }
+    task_group group(pool);
+    group.add_batches(files.size(), 16,
+        [&files](size_t begin, size_t end, std::atomic<bool> const& cancelled) {
+            for (auto i = begin; i < end && !cancelled.load(); i++) {
+                copy_file_fast(files[i].first, files[i].second);
+            }
+        });
+    group.run();
+}
+
+} // namespace ungive::update::internal
@@ -1,11 +1,20 @@
 #pragma once
 
+#include <atomic>
+#include <filesystem>
+#include <fstream>
 #include <functional>
+#include <iomanip>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include <openssl/decoder.h>
 #include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include "ungive/update/internal/blake3.h"
+#include "ungive/update/internal/thread_pool.h"
 
 namespace ungive::update::internal::crypto
 {
@@ -66,8 +75,114 @@ inline bool verify_signature(
     return result == 1;
 }
 
+// Encodes binary data as lowercase hexadecimal characters.
+inline std::string hex_encode(unsigned char const* data, std::size_t size)
+{
+    std::ostringstream oss;
+    for (std::size_t i = 0; i < size; i++) {
+        oss << std::hex << std::setw(2) << std::setfill('0')
+            << static_cast<int>(data[i]);
+    }
+    return oss.str();
+}
+
+// Decodes hexadecimal characters into binary data.
+inline std::string hex_decode(std::string const& hex)
+{
+    auto value = [](char c) {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        throw std::runtime_error("invalid hexadecimal character");
+    };
+    if (hex.size() % 2 != 0) {
+        throw std::runtime_error("hexadecimal string has an odd length");
+    }
+    std::string result(hex.size() / 2, '\0');
+    for (std::size_t i = 0; i < result.size(); i++) {
+        result[i] = static_cast<char>(
+            (value(hex[2 * i]) << 4) | value(hex[2 * i + 1]));
+    }
+    return result;
+}
+
+// Computes a SHA-256 hash of a buffer in memory.
+inline std::string sha256(void const* data, std::size_t size)
+{
+    unsigned char hash[SHA256_DIGEST_LENGTH] = {};
+    unsigned int length = 0;
+    if (1 != EVP_Digest(data, size, hash, &length, EVP_sha256(), NULL))
+        throw std::runtime_error("openssl: failed to compute digest");
+    return hex_encode(hash, SHA256_DIGEST_LENGTH);
+}
+
+// Computes a SHA-256 hash incrementally, e.g. of data that is streamed.
+class sha256_hasher
+{
+public:
+    sha256_hasher() : m_context{ create_digest_context() }
+    {
+        if (1 != EVP_DigestInit_ex(m_context.get(), EVP_sha256(), NULL))
+            throw std::runtime_error("openssl: failed to init digest");
+    }
+
+    void update(void const* data, std::size_t size)
+    {
+        if (1 != EVP_DigestUpdate(m_context.get(), data, size))
+            throw std::runtime_error("openssl: failed to update digest");
+    }
+
+    // Finalizes the hash, the hasher must not be used afterwards.
+    std::string hexdigest()
+    {
+        unsigned char hash[SHA256_DIGEST_LENGTH] = {};
+        if (1 != EVP_DigestFinal_ex(m_context.get(), hash, 0))
+            throw std::runtime_error("openssl: failed to finalize digest");
+        return hex_encode(hash, SHA256_DIGEST_LENGTH);
+    }
+
+private:
+    digest_context m_context;
+};
+
+// Computes the root of a binary Merkle tree over SHA-256 digests.
+// Each parent node is the SHA-256 hash of the concatenated binary digests
+// of its two children. A node without a sibling at the end of a level
+// is promoted to the next level unchanged. Digests are hex-encoded.
+inline std::string merkle_root(std::vector<std::string> const& digests)
+{
+    if (digests.empty()) {
+        throw std::runtime_error("merkle tree has no leaves");
+    }
+    std::vector<std::string> level;
+    level.reserve(digests.size());
+    for (auto const& digest : digests) {
+        level.push_back(hex_decode(digest));
+    }
+    while (level.size() > 1) {
+        std::vector<std::string> next;
+        next.reserve((level.size() + 1) / 2);
+        for (std::size_t i = 0; i + 1 < level.size(); i += 2) {
+            auto pair = level[i] + level[i + 1];
+            next.push_back(hex_decode(sha256(pair.data(), pair.size())));
+        }
+        if (level.size() % 2 != 0) {
+            next.push_back(level.back());
+        }
+        level = std::move(next);
+    }
+    auto const& root = level.front();
+    return hex_encode(
+        reinterpret_cast<unsigned char const*>(root.data()), root.size());
+}
+
 // Computes a SHA-256 hash of a file.
-inline std::string sha256_file(std::filesystem::path const& path)
+// Throws an exception if the cancelled flag is set while hashing.
+inline std::string sha256_file(std::filesystem::path const& path,
+    std::atomic<bool> const* cancelled = nullptr)
 {
     unsigned char hash[SHA256_DIGEST_LENGTH] = {};
     auto mdctx = create_digest_context();
@@ -81,7 +196,14 @@ inline std::string sha256_file(std::filesystem::path const& path)
     std::ifstream ifs(path, std::ifstream::binary);
     std::vector<char> buffer(1024 * 1024, 0);
     while (!ifs.eof()) {
+        if (cancelled != nullptr && cancelled->load()) {
+            throw std::runtime_error("hashing cancelled: " + path.string());
+        }
         ifs.read(buffer.data(), buffer.size());
+        if (ifs.bad() || (ifs.fail() && !ifs.eof())) {
+            // E.g. the path is a directory, which never reaches its end.
+            throw std::runtime_error("failed to read file: " + path.string());
+        }
         std::streamsize n = ifs.gcount();
         if (n <= 0) {
             continue;
@@ -99,6 +221,32 @@ inline std::string sha256_file(std::filesystem::path const& path)
     return oss.str();
 }
 
+// Computes the SHA-256 hashes of multiple files concurrently.
+// The returned hashes are in the same order as the given paths.
+// If hashing any file fails, hashing of all other files is cancelled.
+inline std::vector<std::string> sha256_files(
+    std::vector<std::filesystem::path> const& paths,
+    thread_pool& pool = thread_pool::shared())
+{
+    std::vector<std::string> result(paths.size());
+    task_group group(pool);
+    for (std::size_t i = 0; i < paths.size(); i++) {
+        group.add([&, i](std::atomic<bool> const& cancelled) {
+            result[i] = sha256_file(paths[i], &cancelled);
+        });
+    }
+    group.run();
+    return result;
+}
+
+// Computes a BLAKE3 hash of a file, using multiple threads for large files.
+// Throws an exception if the cancelled flag is set while hashing.
+inline std::string blake3_file(std::filesystem::path const& path,
+    std::atomic<bool> const* cancelled = nullptr)
+{
+    return blake3::hash_file(path, cancelled);
+}
+
 // Parses SHA256 checksums from a sha256sum file.
 // Ideally this file should have been generated
 // with the "sha256sum" linux command.
@@ -149,4 +297,46 @@ inline std::vector<std::pair<std::string, std::string>> parse_sha256sums(
     return result;
 }
 
+// Parses BLAKE3 checksums from a b3sum file.
+// Lines have the form "<hash>  <path>", as written by the "b3sum" command.
+// Paths with backslashes or newlines are escaped by b3sum,
+// which is indicated by a leading backslash in front of the hash.
+inline std::vector<std::pair<std::string, std::string>> parse_b3sums(
+    std::string const& data)
+{
+    std::vector<std::pair<std::string, std::string>> result;
+    std::istringstream iss(data);
+    for (std::string line; std::getline(iss, line);) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        bool escaped = !line.empty() && line.front() == '\\';
+        if (escaped) {
+            line.erase(0, 1);
+        }
+        auto index = line.find(' ');
+        if (index == std::string::npos || index + 2 > line.size()) {
+            continue;
+        }
+        // The hash is followed by a space and a mode character,
+        // which is either a space for text mode or an asterisk.
+        auto hash = line.substr(0, index);
+        std::ostringstream oss_path;
+        for (size_t i = index + 2; i < line.size(); i++) {
+            char c = line.at(i);
+            if (escaped && c == '\\' && i + 1 < line.size()) {
+                char next = line.at(++i);
+                oss_path << (next == 'n' ? '\n' : next);
+            } else if (c == '/') {
+                oss_path << static_cast<char>(
+                    std::filesystem::path::preferred_separator);
+            } else {
+                oss_path << c;
+            }
+        }
+        result.push_back(std::make_pair(hash, oss_path.str()));
+    }
+    return result;
+}
+
 } // namespace ungive::update::internal::crypto
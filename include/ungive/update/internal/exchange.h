@@ -0,0 +1,40 @@
+#pragma once
+
+#include <filesystem>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <stdio.h>
+#endif
+
+namespace ungive::update::internal
+{
+
+// Swaps two existing files or directories in a single atomic operation,
+// such that each path refers to the other's previous content
+// and neither path is missing at any point in time.
+// Uses renameat2() with RENAME_EXCHANGE on Linux 3.15 or newer
+// and renamex_np() with RENAME_SWAP on macOS.
+// Returns false if the platform or file system does not support it,
+// in which case neither path was changed. Does not throw.
+inline bool exchange_paths(
+    std::filesystem::path const& a, std::filesystem::path const& b)
+{
+#if defined(__linux__) && defined(SYS_renameat2)
+    // Not exposed by older C libraries, so the system call is used.
+    constexpr unsigned int rename_exchange = 1 << 1;
+    return ::syscall(SYS_renameat2, AT_FDCWD, a.c_str(), AT_FDCWD, b.c_str(),
+               rename_exchange) == 0;
+#elif defined(__APPLE__) && defined(RENAME_SWAP)
+    return ::renamex_np(a.c_str(), b.c_str(), RENAME_SWAP) == 0;
+#else
+    (void)a;
+    (void)b;
+    return false;
+#endif
+}
+
+} // namespace ungive::update::internal
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "ungive/update/detail/common.h"
+#include "ungive/update/internal/inflate.h"
+#include "ungive/update/internal/resources.h"
+#include "ungive/update/internal/stream.h"
+#include "ungive/update/internal/tar.h"
+#include "ungive/update/internal/xz.h"
+#include "ungive/update/internal/zip_reader.h"
+#include "ungive/update/internal/zip_stream.h"
+#include "ungive/update/internal/zstd.h"
+
+namespace ungive::update::internal
+{
+
+// Extracts an archive of the given type from a stream of bytes.
+// Extracted entries and bytes are accounted for in the budget, if set.
+// Decoders are limited by the decoder limits of the given limits.
+inline void extract_stream(update::archive_type type, byte_reader reader,
+    std::filesystem::path const& target_directory,
+    extraction_budget* budget = nullptr,
+    update::resource_limits const& limits = {})
+{
+    stream_reader source(std::move(reader));
+    switch (type) {
+    case update::archive_type::zip:
+        zip_stream_extract(source, target_directory, budget);
+        break;
+    case update::archive_type::tar_gz: {
+        stream_reader tar(gzip_reader(source));
+        tar_extract(tar, target_directory, budget);
+        break;
+    }
+    case update::archive_type::tar_zst: {
+#ifdef UPDATE_WITH_ZSTD
+        stream_reader tar(zstd_reader(source, limits.max_zstd_window_log));
+        tar_extract(tar, target_directory, budget);
+        break;
+#else
+        throw std::runtime_error("built without zstd support");
+#endif
+    }
+    case update::archive_type::tar_xz: {
+#ifdef UPDATE_WITH_XZ
+        stream_reader tar(xz_reader(source, limits.max_xz_memory));
+        tar_extract(tar, target_directory, budget);
+        break;
+#else
+        throw std::runtime_error("built without xz support");
+#endif
+    }
+    default:
+        throw std::runtime_error("archive type cannot be extracted");
+    }
+}
+
+// Extracts an archive file of the given type.
+// ZIP files are read through their central directory,
+// other archives are read from start to end.
+// If strip_root is set, a single root directory that contains all entries
+// is omitted, when that can be determined before extracting anything,
+// which is only the case for ZIP files. Returns whether it was omitted.
+// Extracted entries and bytes are accounted for in the budget, if set.
+inline bool extract_file(update::archive_type type,
+    std::filesystem::path const& archive_path,
+    std::filesystem::path const& target_directory, bool strip_root = false,
+    extraction_budget* budget = nullptr,
+    update::resource_limits const& limits = {})
+{
+    if (type == update::archive_type::zip) {
+        return zip_file_extract(
+            archive_path, target_directory, strip_root, budget);
+    }
+    std::ifstream in(archive_path, std::ios::in | std::ios::binary);
+    if (!in) {
+        throw std::runtime_error(
+            "failed to open archive: " + archive_path.string());
+    }
+    extract_stream(
+        type,
+        [&in](char* data, std::size_t size) -> std::size_t {
+            in.read(data, static_cast<std::streamsize>(size));
+            if (in.bad()) {
+                throw std::runtime_error("failed to read archive");
+            }
+            return static_cast<std::size_t>(in.gcount());
+        },
+        target_directory, budget, limits);
+    return false;
+}
+
+// Returns the total size of the content of an archive file, if it can be
+// determined from an index of the archive without extracting it.
+inline std::optional<uint64_t> extracted_size(
+    update::archive_type type, std::filesystem::path const& archive_path)
+{
+    if (type == update::archive_type::zip) {
+        return zip_reader(archive_path).total_size();
+    }
+    return std::nullopt;
+}
+
+// Extracts an archive on a separate thread while its data is written,
+// e.g. while it is being downloaded. The data passes through a bounded
+// pipe, so a writer that is faster than extraction is slowed down.
+// Data that follows the archive is read and discarded, such that
+// the writer can still process the complete file, e.g. to hash it.
+class streaming_extractor
+{
+public:
+    static constexpr std::size_t default_capacity = 8 * 1024 * 1024;
+
+    // Extracted entries and bytes are accounted for in the budget, if set,
+    // which must outlive the extractor.
+    streaming_extractor(update::archive_type type,
+        std::filesystem::path const& target_directory,
+        std::size_t capacity = default_capacity,
+        extraction_budget* budget = nullptr,
+        update::resource_limits const& limits = {})
+        : m_pipe(capacity)
+    {
+        m_thread = std::thread([this, type, target_directory, budget,
+                                   limits] {
+            auto reader = [this](char* data, std::size_t size) {
+                return m_pipe.read(data, size);
+            };
+            try {
+                extract_stream(
+                    type, reader, target_directory, budget, limits);
+                std::vector<char> discard(64 * 1024);
+                while (m_pipe.read(discard.data(), discard.size()) > 0) {
+                }
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_aborted) {
+                    m_error = std::current_exception();
+                }
+                m_pipe.abort();
+            }
+        });
+    }
+
+    ~streaming_extractor() { abort(); }
+
+    streaming_extractor(streaming_extractor const&) = delete;
+    streaming_extractor& operator=(streaming_extractor const&) = delete;
+
+    // Passes archive data to the extractor, blocking while it is busy.
+    // Returns false if extraction failed.
+    bool write(char const* data, std::size_t size)
+    {
+        return m_pipe.write(data, size);
+    }
+
+    // Waits for extraction to complete after all data has been written.
+    // Rethrows the exception with which extraction failed, if any.
+    void finish()
+    {
+        m_pipe.close();
+        join();
+        rethrow();
+    }
+
+    // Stops extraction and waits for the extraction thread to terminate.
+    void abort()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_aborted = true;
+        }
+        m_pipe.abort();
+        join();
+    }
+
+    // Rethrows the exception with which extraction failed, if any.
+    // Does not throw if extraction only stopped because it was aborted.
+    void rethrow()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_error) {
+            std::rethrow_exception(m_error);
+        }
+    }
+
+private:
+    void join()
+    {
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+
+    byte_pipe m_pipe;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::exception_ptr m_error{};
+    bool m_aborted{ false };
+};
+
+} // namespace ungive::update::internal
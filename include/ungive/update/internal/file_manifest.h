@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ungive/update/internal/crypto.h"
+#include "ungive/update/internal/thread_pool.h"
+
+namespace ungive::update::internal
+{
+
+// A file that is listed in a file manifest.
+struct file_manifest_entry
+{
+    // The path relative to the manifest's directory, with forward slashes.
+    std::string path;
+    uint64_t size;
+    // The hex-encoded SHA-256 digest of the file.
+    std::string digest;
+};
+
+// Checks that a manifest path is relative and stays within its directory.
+inline bool is_contained_path(std::string const& path)
+{
+    auto p = std::filesystem::u8path(path);
+    if (path.empty() || p.is_absolute() || p.has_root_name() ||
+        p.has_root_directory()) {
+        return false;
+    }
+    for (auto const& part : p) {
+        if (part.empty() || part == "." || part == "..") {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Parses a manifest which lists all files of a directory tree,
+// with one file per line in the following format:
+//
+//  <hex-encoded SHA-256 digest> <size in bytes> <relative path>
+//
+// Paths use forward slashes and must not leave the directory.
+// Throws an exception if the manifest is malformed.
+inline std::vector<file_manifest_entry> parse_file_manifest(
+    std::string const& data)
+{
+    std::vector<file_manifest_entry> result;
+    std::istringstream iss(data);
+    for (std::string line; std::getline(iss, line);) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+        auto first = line.find(' ');
+        auto second =
+            first == std::string::npos ? first : line.find(' ', first + 1);
+        if (second == std::string::npos) {
+            throw std::runtime_error("malformed file manifest line: " + line);
+        }
+        file_manifest_entry entry;
+        entry.digest = line.substr(0, first);
+        entry.size = std::stoull(line.substr(first + 1, second - first - 1));
+        entry.path = line.substr(second + 1);
+        if (entry.digest.size() != 2 * SHA256_DIGEST_LENGTH) {
+            throw std::runtime_error(
+                "invalid digest in file manifest: " + entry.digest);
+        }
+        if (!is_contained_path(entry.path)) {
+            throw std::runtime_error(
+                "invalid path in file manifest: " + entry.path);
+        }
+        result.push_back(entry);
+    }
+    return result;
+}
+
+// Returns the paths of all files within a directory, relative to it
+// and with forward slashes, like they are listed in a file manifest.
+// Throws if the directory contains a symbolic link, since a manifest
+// cannot describe links and must not hash what they point to.
+inline std::vector<std::string> list_files(
+    std::filesystem::path const& directory)
+{
+    std::vector<std::string> result;
+    for (auto const& entry :
+        std::filesystem::recursive_directory_iterator(directory)) {
+        auto relative = std::filesystem::relative(entry.path(), directory);
+        if (entry.is_symlink()) {
+            throw std::runtime_error(
+                "file manifests cannot contain symbolic links: " +
+                relative.generic_u8string());
+        }
+        if (entry.is_directory()) {
+            continue;
+        }
+        result.push_back(relative.generic_u8string());
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+// Creates the manifest for all files in a directory,
+// e.g. to publish it with a release. Files are hashed concurrently.
+inline std::string create_file_manifest(std::filesystem::path const& directory,
+    thread_pool& pool = thread_pool::shared())
+{
+    auto files = list_files(directory);
+    std::vector<std::string> digests(files.size());
+    task_group group(pool);
+    for (size_t i = 0; i < files.size(); i++) {
+        group.add([&, i](std::atomic<bool> const& cancelled) {
+            digests[i] = crypto::sha256_file(
+                directory / std::filesystem::u8path(files[i]), &cancelled);
+        });
+    }
+    group.run();
+    std::ostringstream oss;
+    for (size_t i = 0; i < files.size(); i++) {
+        auto path = directory / std::filesystem::u8path(files[i]);
+        oss << digests[i] << " " << std::filesystem::file_size(path) << " "
+            << files[i] << "\n";
+    }
+    return oss.str();
+}
+
+} // namespace ungive::update::internal
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "ungive/update/internal/stream.h"
+
+namespace ungive::update::internal
+{
+
+// Decompresses DEFLATE data from a stream reader with zlib.
+// Only consumes as many bytes from the reader as belong to the stream,
+// so data that follows the compressed stream can be read afterwards.
+class inflater
+{
+public:
+    enum class format
+    {
+        // Raw DEFLATE data, e.g. within ZIP files.
+        raw,
+        // DEFLATE data with a gzip header and trailer.
+        gzip,
+    };
+
+    inflater(format type)
+    {
+        m_stream.zalloc = Z_NULL;
+        m_stream.zfree = Z_NULL;
+        m_stream.opaque = Z_NULL;
+        m_stream.next_in = Z_NULL;
+        m_stream.avail_in = 0;
+        int window_bits = type == format::raw ? -MAX_WBITS : MAX_WBITS + 16;
+        if (inflateInit2(&m_stream, window_bits) != Z_OK) {
+            throw std::runtime_error("zlib: failed to initialize inflate");
+        }
+    }
+
+    ~inflater() { inflateEnd(&m_stream); }
+
+    inflater(inflater const&) = delete;
+    inflater& operator=(inflater const&) = delete;
+
+    // Decompresses up to size bytes into data and returns how many
+    // were written. Returns 0 once the end of the stream has been reached.
+    std::size_t read(stream_reader& source, char* data, std::size_t size)
+    {
+        if (m_finished || size == 0) {
+            return 0;
+        }
+        m_stream.next_out = reinterpret_cast<Bytef*>(data);
+        m_stream.avail_out = static_cast<uInt>(size);
+        while (m_stream.avail_out == size) {
+            auto [buffered, available] = source.peek();
+            if (available == 0) {
+                throw std::runtime_error("unexpected end of compressed data");
+            }
+            m_stream.next_in =
+                reinterpret_cast<Bytef*>(const_cast<char*>(buffered));
+            m_stream.avail_in = static_cast<uInt>(available);
+            auto result = ::inflate(&m_stream, Z_NO_FLUSH);
+            source.consume(available - m_stream.avail_in);
+            if (result == Z_STREAM_END) {
+                m_finished = true;
+                break;
+            }
+            if (result != Z_OK) {
+                throw std::runtime_error("zlib: failed to decompress data");
+            }
+        }
+        return size - m_stream.avail_out;
+    }
+
+    // Whether the end of the compressed stream has been reached.
+    inline bool finished() const { return m_finished; }
+
+    // Resets the state to decompress another stream of the same format.
+    void reset()
+    {
+        if (inflateReset(&m_stream) != Z_OK) {
+            throw std::runtime_error("zlib: failed to reset inflate");
+        }
+        m_finished = false;
+    }
+
+private:
+    z_stream m_stream{};
+    bool m_finished{ false };
+};
+
+// Returns a byte reader which decompresses gzip data from the given source.
+// Multiple concatenated gzip members are decompressed as one stream.
+inline byte_reader gzip_reader(stream_reader& source)
+{
+    auto state = std::make_shared<inflater>(inflater::format::gzip);
+    return [&source, state](char* data, std::size_t size) -> std::size_t {
+        while (true) {
+            auto n = state->read(source, data, size);
+            if (n > 0 || !state->finished()) {
+                return n;
+            }
+            // Another member may follow, anything else is ignored.
+            auto [buffered, available] = source.peek();
+            if (available == 0 ||
+                static_cast<unsigned char>(*buffered) != 0x1f) {
+                return 0;
+            }
+            state->reset();
+        }
+    };
+}
+
+} // namespace ungive::update::internal
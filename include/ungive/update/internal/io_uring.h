@@ -0,0 +1,194 @@
+#pragma once
+
+#ifdef UPDATE_WITH_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+// Requires kernel headers of Linux 5.18 or newer, which added the ability
+// to use a direct descriptor that was opened earlier in the same chain.
+#if defined(UPDATE_WITH_IO_URING) && defined(IORING_FEAT_LINKED_FILE)
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace ungive::update::internal
+{
+
+// A minimal io_uring submission and completion queue,
+// which is used through system calls without depending on liburing.
+// Comes with a table of direct descriptors, which requests can open files
+// into and refer to with IOSQE_FIXED_FILE, without any file descriptors.
+// Not thread-safe, it must only be used by one thread at a time.
+class io_uring_queue
+{
+public:
+    // Creates a queue with the given number of submission entries
+    // and direct descriptor slots. Throws if io_uring is not available,
+    // e.g. because the kernel is too old or it is disabled.
+    io_uring_queue(unsigned int entries, unsigned int files)
+    {
+        io_uring_params params{};
+        m_fd = static_cast<int>(
+            ::syscall(__NR_io_uring_setup, entries, &params));
+        if (m_fd < 0) {
+            throw std::runtime_error("io_uring: setup failed");
+        }
+        try {
+            if (!(params.features & IORING_FEAT_LINKED_FILE) ||
+                !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+                throw std::runtime_error("io_uring: kernel is too old");
+            }
+            map(params);
+            std::vector<int> table(files, -1);
+            if (::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_FILES,
+                    table.data(), files) != 0) {
+                throw std::runtime_error("io_uring: failed to register files");
+            }
+        }
+        catch (...) {
+            unmap();
+            ::close(m_fd);
+            throw;
+        }
+    }
+
+    ~io_uring_queue()
+    {
+        unmap();
+        ::close(m_fd);
+    }
+
+    io_uring_queue(io_uring_queue const&) = delete;
+    io_uring_queue& operator=(io_uring_queue const&) = delete;
+
+    // Returns the number of entries that can be queued before submitting.
+    unsigned int space() const
+    {
+        auto head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+        return m_sq_entries - (m_sq_tail - head);
+    }
+
+    // Returns a cleared submission entry, which is submitted
+    // with the next call to submit(), or nullptr if the queue is full.
+    io_uring_sqe* next()
+    {
+        if (space() == 0) {
+            return nullptr;
+        }
+        auto index = m_sq_tail & *m_sq_mask;
+        auto* sqe = &m_sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        m_sq_array[index] = index;
+        m_sq_tail++;
+        return sqe;
+    }
+
+    // Submits all queued entries and waits until at least
+    // the given number of completions are available.
+    void submit(unsigned int wait = 0)
+    {
+        auto pending = m_sq_tail - *m_sq_kernel_tail;
+        __atomic_store_n(m_sq_kernel_tail, m_sq_tail, __ATOMIC_RELEASE);
+        while (true) {
+            auto result = ::syscall(__NR_io_uring_enter, m_fd, pending, wait,
+                wait > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (result >= 0) {
+                return;
+            }
+            if (errno != EINTR) {
+                throw std::runtime_error(std::string("io_uring: ") +
+                    std::strerror(errno));
+            }
+        }
+    }
+
+    // Calls the function with each available completion
+    // and removes them from the queue.
+    template <typename F>
+    void complete(F&& handle)
+    {
+        auto head = *m_cq_head;
+        auto tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            handle(m_cqes[head & *m_cq_mask]);
+        }
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+    }
+
+private:
+    void map(io_uring_params const& params)
+    {
+        auto sq_size = params.sq_off.array +
+            params.sq_entries * sizeof(unsigned int);
+        auto cq_size =
+            params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        m_ring_size = std::max<std::size_t>(sq_size, cq_size);
+        m_ring = ::mmap(nullptr, m_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        if (m_ring == MAP_FAILED) {
+            m_ring = nullptr;
+            throw std::runtime_error("io_uring: failed to map ring");
+        }
+        m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        auto sqes = ::mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            throw std::runtime_error("io_uring: failed to map entries");
+        }
+        m_sqes = static_cast<io_uring_sqe*>(sqes);
+        auto* ring = static_cast<char*>(m_ring);
+        m_sq_entries = params.sq_entries;
+        m_sq_head = reinterpret_cast<unsigned int*>(ring + params.sq_off.head);
+        m_sq_kernel_tail =
+            reinterpret_cast<unsigned int*>(ring + params.sq_off.tail);
+        m_sq_mask =
+            reinterpret_cast<unsigned int*>(ring + params.sq_off.ring_mask);
+        m_sq_array =
+            reinterpret_cast<unsigned int*>(ring + params.sq_off.array);
+        m_sq_tail = *m_sq_kernel_tail;
+        m_cq_head = reinterpret_cast<unsigned int*>(ring + params.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned int*>(ring + params.cq_off.tail);
+        m_cq_mask =
+            reinterpret_cast<unsigned int*>(ring + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+    }
+
+    void unmap()
+    {
+        if (m_sqes != nullptr) {
+            ::munmap(m_sqes, m_sqes_size);
+            m_sqes = nullptr;
+        }
+        if (m_ring != nullptr) {
+            ::munmap(m_ring, m_ring_size);
+            m_ring = nullptr;
+        }
+    }
+
+    int m_fd{ -1 };
+    void* m_ring{ nullptr };
+    std::size_t m_ring_size{ 0 };
+    io_uring_sqe* m_sqes{ nullptr };
+    std::size_t m_sqes_size{ 0 };
+    unsigned int m_sq_entries{ 0 };
+    unsigned int* m_sq_head{ nullptr };
+    unsigned int* m_sq_kernel_tail{ nullptr };
+    unsigned int* m_sq_mask{ nullptr };
+    unsigned int* m_sq_array{ nullptr };
+    unsigned int m_sq_tail{ 0 };
+    unsigned int* m_cq_head{ nullptr };
+    unsigned int* m_cq_tail{ nullptr };
+    unsigned int* m_cq_mask{ nullptr };
+    io_uring_cqe* m_cqes{ nullptr };
+};
+
+} // namespace ungive::update::internal
+
+#endif // UPDATE_WITH_IO_URING
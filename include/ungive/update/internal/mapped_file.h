@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ungive::update::internal
+{
+
+// Maps an entire file into memory for reading.
+class mapped_file
+{
+public:
+    mapped_file(std::filesystem::path const& path)
+    {
+#ifdef WIN32
+        m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (m_file == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("failed to open file: " + path.string());
+        }
+        LARGE_INTEGER size{};
+        if (!GetFileSizeEx(m_file, &size)) {
+            close();
+            throw std::runtime_error("failed to get file size");
+        }
+        m_size = static_cast<std::size_t>(size.QuadPart);
+        if (m_size > 0) {
+            m_mapping =
+                CreateFileMappingW(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (m_mapping != NULL) {
+                m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+            }
+            if (m_data == nullptr) {
+                close();
+                throw std::runtime_error(
+                    "failed to map file: " + path.string());
+            }
+        }
+#else
+        m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (m_fd < 0) {
+            throw std::runtime_error("failed to open file: " + path.string());
+        }
+        struct stat st;
+        if (::fstat(m_fd, &st) != 0) {
+            close();
+            throw std::runtime_error("failed to get file size");
+        }
+        m_size = static_cast<std::size_t>(st.st_size);
+        if (m_size > 0) {
+            m_data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+            if (m_data == MAP_FAILED) {
+                m_data = nullptr;
+                close();
+                throw std::runtime_error(
+                    "failed to map file: " + path.string());
+            }
+            // Entries are read concurrently at scattered offsets.
+            ::madvise(m_data, m_size, MADV_RANDOM);
+        }
+#endif
+    }
+
+    ~mapped_file() { close(); }
+
+    mapped_file(mapped_file const&) = delete;
+    mapped_file& operator=(mapped_file const&) = delete;
+
+    inline char const* data() const
+    {
+        return static_cast<char const*>(m_data);
+    }
+
+    inline std::size_t size() const { return m_size; }
+
+private:
+    void close()
+    {
+#ifdef WIN32
+        if (m_data != nullptr) {
+            UnmapViewOfFile(m_data);
+        }
+        if (m_mapping != NULL) {
+            CloseHandle(m_mapping);
+        }
+        if (m_file != INVALID_HANDLE_VALUE) {
+            CloseHandle(m_file);
+        }
+        m_mapping = NULL;
+        m_file = INVALID_HANDLE_VALUE;
+#else
+        if (m_data != nullptr) {
+            ::munmap(m_data, m_size);
+        }
+        if (m_fd >= 0) {
+            ::close(m_fd);
+        }
+        m_fd = -1;
+#endif
+        m_data = nullptr;
+    }
+
+#ifdef WIN32
+    HANDLE m_file{ INVALID_HANDLE_VALUE };
+    HANDLE m_mapping{ NULL };
+#else
+    int m_fd{ -1 };
+#endif
+    void* m_data{ nullptr };
+    std::size_t m_size{ 0 };
+};
+
+} // namespace ungive::update::internal
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ungive/update/internal/blake3.h"
+#include "ungive/update/internal/staging.h"
+#include "ungive/update/internal/thread_pool.h"
+
+namespace ungive::update::internal
+{
+
+// Stores installed files by their content, so that files which are
+// identical across versions occupy disk space only once.
+// Files in a version directory are replaced with hard links to objects
+// in the store. The hard link count of an object serves as its
+// reference count: once no version directory links to it anymore,
+// it is only referenced by the store and removed by collect().
+// The store must be on the same volume as the version directories.
+// Linked files must not be modified in place, as that changes
+// the file in every version which shares it. Since that cannot be
+// prevented, objects are hashed again before new files are linked to them.
+class object_store
+{
+public:
+    explicit object_store(std::filesystem::path root)
+        : m_root{ std::move(root) }
+    {
+    }
+
+    // Returns the directory in which objects are stored.
+    std::filesystem::path const& root() const { return m_root; }
+
+    // Replaces each regular file in the directory with a hard link
+    // to the object with the same content, adding objects for content
+    // that is not in the store yet. Files and the existing objects
+    // they would be linked to are hashed concurrently. An object whose
+    // content was modified through one of its links is replaced.
+    // Files that cannot be linked, e.g. because the file system
+    // does not support hard links, are left as they are.
+    // Returns the number of files that now share an existing object.
+    std::size_t link_files(std::filesystem::path const& directory,
+        thread_pool& pool = thread_pool::shared()) const
+    {
+        namespace fs = std::filesystem;
+        std::vector<fs::path> files;
+        for (auto const& entry : fs::recursive_directory_iterator(directory)) {
+            if (entry.is_regular_file() && !entry.is_symlink()) {
+                files.push_back(entry.path());
+            }
+        }
+        std::vector<std::string> keys(files.size());
+        task_group group(pool);
+        for (std::size_t i = 0; i < files.size(); i++) {
+            group.add([&, i](std::atomic<bool> const& cancelled) {
+                keys[i] = object_key(files[i], &cancelled);
+            });
+        }
+        group.run();
+        // Each existing object is hashed once, however many files match it.
+        std::unordered_map<std::string, bool> intact;
+        for (auto const& key : keys) {
+            std::error_code ec;
+            if (fs::exists(object_path(key), ec)) {
+                intact.emplace(key, false);
+            }
+        }
+        task_group objects(pool);
+        for (auto& [key, valid] : intact) {
+            objects.add([&, key = key](std::atomic<bool> const& cancelled) {
+                valid = object_key(object_path(key), &cancelled) == key;
+            });
+        }
+        objects.run();
+        // Linking is cheap compared to hashing and done on this thread,
+        // so that identical files within the directory share one object.
+        std::size_t shared = 0;
+        for (std::size_t i = 0; i < files.size(); i++) {
+            auto object = object_path(keys[i]);
+            auto it = intact.find(keys[i]);
+            if (it != intact.end() && it->second) {
+                if (replace_with_link(object, files[i])) {
+                    shared++;
+                }
+                continue;
+            }
+            // The object is missing or was modified, this file replaces it.
+            std::error_code ec;
+            fs::create_directories(object.parent_path());
+            auto temp = object.parent_path() / ("." + unique_name());
+            fs::create_hard_link(files[i], temp, ec);
+            if (ec) {
+                continue;
+            }
+            fs::rename(temp, object, ec);
+            if (ec) {
+                fs::remove(temp, ec);
+                continue;
+            }
+            intact[keys[i]] = true;
+        }
+        return shared;
+    }
+
+    // Removes all objects which are not linked to from any version
+    // directory anymore. Errors are ignored, e.g. when an object
+    // is still in use, as it is then collected the next time.
+    // Returns the number of objects that were removed.
+    std::size_t collect() const noexcept
+    {
+        namespace fs = std::filesystem;
+        std::size_t removed = 0;
+        std::error_code ec;
+        auto it = fs::recursive_directory_iterator(m_root, ec);
+        std::vector<fs::path> garbage;
+        for (; !ec && it != fs::recursive_directory_iterator();
+             it.increment(ec)) {
+            std::error_code entry_ec;
+            if (!it->is_regular_file(entry_ec)) {
+                continue;
+            }
+            // Temporary links of an interrupted link_files() are garbage too.
+            auto count = fs::hard_link_count(it->path(), entry_ec);
+            if (!entry_ec && count <= 1) {
+                garbage.push_back(it->path());
+            }
+        }
+        for (auto const& path : garbage) {
+            std::error_code remove_ec;
+            if (fs::remove(path, remove_ec)) {
+                removed++;
+            }
+        }
+        return removed;
+    }
+
+private:
+    // Returns the key of a file, which is its hash and,
+    // where files have permissions, its permissions,
+    // since those are shared by all links to a file.
+    static std::string object_key(
+        std::filesystem::path const& path, std::atomic<bool> const* cancelled)
+    {
+        auto key = blake3::hash_file(path, cancelled);
+#ifndef WIN32
+        auto perms = std::filesystem::status(path).permissions() &
+            std::filesystem::perms::mask;
+        key += "-" + std::to_string(static_cast<unsigned int>(perms));
+#endif
+        return key;
+    }
+
+    std::filesystem::path object_path(std::string const& key) const
+    {
+        return m_root / key.substr(0, 2) / key.substr(2);
+    }
+
+    // Replaces the file with a hard link to the object in one rename,
+    // so the file never disappears. Returns whether it was replaced.
+    static bool replace_with_link(std::filesystem::path const& object,
+        std::filesystem::path const& file)
+    {
+        std::error_code ec;
+        auto temp = file.parent_path() / ("." + unique_name());
+        std::filesystem::create_hard_link(object, temp, ec);
+        if (ec) {
+            return false;
+        }
+        std::filesystem::rename(temp, file, ec);
+        if (ec) {
+            std::filesystem::remove(temp, ec);
+            return false;
+        }
+        return true;
+    }
+
+    std::filesystem::path m_root;
+};
+
+} // namespace ungive::update::internal
@@ -0,0 +1,46 @@
+#pragma once
+
+// Selects the platform layer with which the manager locks its working
+// directory, finds its own executable and starts and stops processes.
+// Each implementation provides, in its own namespace:
+// - a lock_file class, which holds an exclusive lock on a file
+//   for as long as it exists and throws if the file is already locked,
+// - current_process_executable(), which returns the executable's path,
+// - start_process_detached(executable, arguments), which starts a process
+//   that is independent of this one, with arguments of the native
+//   string type of paths, and throws if that failed,
+// - replace_process(executable, arguments), which executes the executable
+//   in place of the current process and only returns by throwing,
+//   which it always does where that is not supported,
+// - get_running_pids(paths_or_directories), which lists the processes
+//   whose executable is each path or lies in each directory,
+//   walking the list of running processes only once,
+// - kill_processes(paths_or_directories), which stops all other processes
+//   whose executable is one of the paths or lies in one of the directories,
+//   according to a shutdown_policy, waits until they have exited
+//   and returns how many there were. Both also accept a single path.
+//   Processes which listen for exit requests in the exit directory
+//   are asked to prepare to exit first, where supported, and
+// - an exit_listener class, which serves such requests for this process
+//   until it is destructed and throws where they are not supported.
+
+#ifdef WIN32
+#include "ungive/update/internal/win/exit_channel.h"
+#include "ungive/update/internal/win/lock.h"
+#include "ungive/update/internal/win/process.h"
+#else
+#include "ungive/update/internal/posix/exit_channel.h"
+#include "ungive/update/internal/posix/lock.h"
+#include "ungive/update/internal/posix/process.h"
+#endif
+
+namespace ungive::update::internal
+{
+
+#ifdef WIN32
+namespace platform = win;
+#else
+namespace platform = posix;
+#endif
+
+} // namespace ungive::update::internal
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define EXIT_REQUEST "prepare-exit\n"
+#define EXIT_ACKNOWLEDGEMENT "ready\n"
+#define EXIT_REQUEST_READ_TIMEOUT_MILLIS 1000
+
+namespace ungive::update::internal::posix
+{
+
+// Returns the address of a Unix domain socket at the given path
+// or nothing, if the path is too long for a socket address.
+inline std::optional<sockaddr_un> socket_address(
+    std::filesystem::path const& path)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.native().size() >= sizeof(address.sun_path)) {
+        return std::nullopt;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.native().size());
+    return address;
+}
+
+// Opens a Unix domain stream socket, which is not inherited
+// by child processes and does not raise SIGPIPE where supported.
+inline int open_socket(bool non_blocking)
+{
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (non_blocking) {
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+#ifdef SO_NOSIGPIPE
+    int enabled = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &enabled, sizeof(enabled));
+#endif
+    return fd;
+}
+
+inline bool send_message(int fd, std::string const& message)
+{
+#ifdef MSG_NOSIGNAL
+    int flags = MSG_NOSIGNAL;
+#else
+    int flags = 0;
+#endif
+    std::size_t sent = 0;
+    while (sent < message.size()) {
+        auto n = ::send(
+            fd, message.data() + sent, message.size() - sent, flags);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+// Serves requests to prepare to exit on a Unix domain socket,
+// which is named after the pid of this process and placed
+// in the given directory, so that other processes can find it.
+// Each request calls the callback on a background thread
+// and is acknowledged once the callback has returned.
+// Requests are served until the listener is destructed.
+class exit_listener
+{
+public:
+    exit_listener(std::filesystem::path const& directory,
+        std::function<void()> prepare_to_exit)
+        : m_path{ directory / std::to_string(::getpid()) },
+          m_prepare_to_exit{ std::move(prepare_to_exit) }
+    {
+        auto address = socket_address(m_path);
+        if (!address.has_value()) {
+            throw std::runtime_error("failed to listen for exit requests: "
+                                     "the socket path is too long");
+        }
+        std::filesystem::create_directories(directory);
+        // A crashed process with the same pid might have left it behind.
+        std::error_code ec;
+        std::filesystem::remove(m_path, ec);
+        m_fd = open_socket(true);
+        if (m_fd < 0 ||
+            ::bind(m_fd, reinterpret_cast<sockaddr const*>(&*address),
+                sizeof(*address)) != 0 ||
+            ::listen(m_fd, 16) != 0 || ::pipe(m_stop) != 0) {
+            auto err = errno;
+            close();
+            throw std::runtime_error(
+                std::string("failed to listen for exit requests: ") +
+                std::strerror(err));
+        }
+        ::fcntl(m_stop[0], F_SETFD, FD_CLOEXEC);
+        ::fcntl(m_stop[1], F_SETFD, FD_CLOEXEC);
+        m_thread = std::thread([this] { serve(); });
+    }
+
+    ~exit_listener()
+    {
+        char stop = 0;
+        while (::write(m_stop[1], &stop, 1) < 0 && errno == EINTR) {
+        }
+        m_thread.join();
+        close();
+    }
+
+    exit_listener(exit_listener const&) = delete;
+    exit_listener& operator=(exit_listener const&) = delete;
+
+private:
+    void serve()
+    {
+        while (true) {
+            pollfd fds[2] = { { m_fd, POLLIN, 0 }, { m_stop[0], POLLIN, 0 } };
+            if (::poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            if (fds[1].revents != 0) {
+                return;
+            }
+            int client = ::accept(m_fd, nullptr, nullptr);
+            if (client < 0) {
+                continue;
+            }
+            respond(client);
+            ::close(client);
+        }
+    }
+
+    void respond(int client)
+    {
+        const std::string request = EXIT_REQUEST;
+        std::string received;
+        while (received.size() < request.size()) {
+            pollfd fd{ client, POLLIN, 0 };
+            if (::poll(&fd, 1, EXIT_REQUEST_READ_TIMEOUT_MILLIS) <= 0) {
+                return;
+            }
+            char buffer[32];
+            auto n = ::recv(client, buffer,
+                std::min(sizeof(buffer), request.size() - received.size()),
+                0);
+            if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            if (n <= 0) {
+                return;
+            }
+            received.append(buffer, static_cast<std::size_t>(n));
+        }
+        if (received != request) {
+            return;
+        }
+        try {
+            m_prepare_to_exit();
+        }
+        catch (...) {
+            // The request is not acknowledged.
+            return;
+        }
+        send_message(client, EXIT_ACKNOWLEDGEMENT);
+    }
+
+    void close()
+    {
+        for (int fd : { m_fd, m_stop[0], m_stop[1] }) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+        std::error_code ec;
+        std::filesystem::remove(m_path, ec);
+    }
+
+    std::filesystem::path m_path;
+    std::function<void()> m_prepare_to_exit;
+    int m_fd{ -1 };
+    int m_stop[2]{ -1, -1 };
+    std::thread m_thread;
+};
+
+// Asks the processes with the given pids, which listen in the directory,
+// to prepare to exit and waits until all of them have acknowledged it
+// or the deadline has passed. Processes without a listener are skipped
+// and sockets that were left behind by crashed processes are removed.
+// Returns the pids of the processes which acknowledged the request.
+inline std::vector<pid_t> request_exit(std::filesystem::path const& directory,
+    std::vector<pid_t> const& pids,
+    std::chrono::steady_clock::time_point deadline)
+{
+    struct request
+    {
+        pid_t pid;
+        int fd;
+        std::string response;
+    };
+    std::vector<request> requests;
+    for (auto pid : pids) {
+        auto path = directory / std::to_string(pid);
+        auto address = socket_address(path);
+        std::error_code ec;
+        if (!address.has_value() || !std::filesystem::exists(path, ec)) {
+            continue;
+        }
+        // Connecting does not block, in case the listener is busy.
+        int fd = open_socket(true);
+        if (fd < 0) {
+            continue;
+        }
+        if (::connect(fd, reinterpret_cast<sockaddr const*>(&*address),
+                sizeof(*address)) != 0) {
+            if (errno == ECONNREFUSED) {
+                std::filesystem::remove(path, ec);
+            }
+            ::close(fd);
+            continue;
+        }
+        if (!send_message(fd, EXIT_REQUEST)) {
+            ::close(fd);
+            continue;
+        }
+        requests.push_back({ pid, fd, {} });
+    }
+    // Wait for the responses of all processes together.
+    const std::string acknowledgement = EXIT_ACKNOWLEDGEMENT;
+    std::vector<pid_t> acknowledged;
+    std::vector<pollfd> fds;
+    while (!requests.empty()) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            break;
+        }
+        fds.clear();
+        for (auto const& request : requests) {
+            fds.push_back({ request.fd, POLLIN, 0 });
+        }
+        auto timeout =
+            std::chrono::ceil<std::chrono::milliseconds>(deadline - now);
+        if (::poll(fds.data(), static_cast<nfds_t>(fds.size()),
+                static_cast<int>(timeout.count())) <= 0) {
+            continue;
+        }
+        std::vector<request> pending;
+        for (std::size_t i = 0; i < requests.size(); i++) {
+            auto& request = requests[i];
+            bool done = false;
+            if (fds[i].revents != 0) {
+                char buffer[32];
+                auto n = ::recv(request.fd, buffer, sizeof(buffer), 0);
+                if (n > 0) {
+                    request.response.append(
+                        buffer, static_cast<std::size_t>(n));
+                    done = request.response.size() >= acknowledgement.size();
+                    if (request.response == acknowledgement) {
+                        acknowledged.push_back(request.pid);
+                    }
+                } else {
+                    done = n == 0 || (errno != EINTR && errno != EAGAIN);
+                }
+            }
+            if (done) {
+                ::close(request.fd);
+            } else {
+                pending.push_back(std::move(request));
+            }
+        }
+        requests = std::move(pending);
+    }
+    for (auto const& request : requests) {
+        ::close(request.fd);
+    }
+    return acknowledged;
+}
+
+} // namespace ungive::update::internal::posix
+
+#undef EXIT_REQUEST
+#undef EXIT_ACKNOWLEDGEMENT
+#undef EXIT_REQUEST_READ_TIMEOUT_MILLIS
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+namespace ungive::update::internal::posix
+{
+
+// An exclusive lock on a file, which is held until it is destructed
+// or the process exits. Uses an open file description lock on Linux,
+// which belongs to this object rather than to the process,
+// and flock() elsewhere. Unlike on Windows the file is not deleted
+// when the lock is released, as another process might be about to lock
+// the same file, which would then be a different one than the file
+// a third process creates and locks.
+class lock_file
+{
+public:
+    lock_file(std::filesystem::path const& filename)
+    {
+        if (std::filesystem::is_directory(filename) ||
+            !filename.has_parent_path()) {
+            throw std::runtime_error("file must not be a directory");
+        }
+        std::filesystem::create_directories(filename.parent_path());
+        do {
+            m_fd = ::open(
+                filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        } while (m_fd < 0 && errno == EINTR);
+        if (m_fd < 0) {
+            throw std::runtime_error(std::string("failed to open lock file: ") +
+                std::strerror(errno));
+        }
+        if (!lock()) {
+            auto err = errno;
+            ::close(m_fd);
+            if (err == EWOULDBLOCK || err == EAGAIN || err == EACCES) {
+                throw std::runtime_error("failed to open lock file: "
+                                         "it is locked by another process");
+            }
+            throw std::runtime_error(
+                std::string("failed to lock file: ") + std::strerror(err));
+        }
+    }
+
+    ~lock_file()
+    {
+        // Closing the file releases the lock.
+        ::close(m_fd);
+    }
+
+    lock_file(lock_file const&) = delete;
+    lock_file& operator=(lock_file const&) = delete;
+
+private:
+    bool lock()
+    {
+#ifdef F_OFD_SETLK
+        struct flock lock
+        {
+        };
+        lock.l_type = F_WRLCK;
+        lock.l_whence = SEEK_SET;
+        if (::fcntl(m_fd, F_OFD_SETLK, &lock) == 0) {
+            return true;
+        }
+        if (errno != EINVAL) {
+            return false;
+        }
+        // Kernels older than Linux 3.15 do not have these locks.
+#endif
+        return ::flock(m_fd, LOCK_EX | LOCK_NB) == 0;
+    }
+
+    int m_fd{ -1 };
+};
+
+} // namespace ungive::update::internal::posix
@@ -0,0 +1,503 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <libproc.h>
+#include <mach-o/dyld.h>
+#endif
+
+#include "ungive/update/detail/common.h"
+#include "ungive/update/internal/posix/exit_channel.h"
+#include "ungive/update/internal/process_match.h"
+#include "ungive/update/internal/util.h"
+
+extern char** environ;
+
+namespace ungive::update::internal::posix
+{
+
+inline std::filesystem::path current_process_executable()
+{
+#if defined(__linux__)
+    return std::filesystem::read_symlink("/proc/self/exe");
+#elif defined(__APPLE__)
+    uint32_t size = 0;
+    _NSGetExecutablePath(nullptr, &size);
+    std::string buffer(size, '\0');
+    if (_NSGetExecutablePath(buffer.data(), &size) != 0) {
+        throw std::runtime_error("failed to get the executable path");
+    }
+    return std::filesystem::canonical(buffer.c_str());
+#else
+    throw std::runtime_error(
+        "the executable path is not available on this platform");
+#endif
+}
+
+// Starts a process detached in a new session, without a controlling
+// terminal, with its standard streams redirected to /dev/null and,
+// where supported, the executable's directory as working directory.
+// The process remains a child of this process, which is expected
+// to exit soon after, like the launcher does.
+// May throw an exception if an error occured
+inline void start_process_detached(std::filesystem::path const& executable,
+    std::vector<std::string> const& arguments = {})
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attributes;
+    if (posix_spawn_file_actions_init(&actions) != 0) {
+        throw std::runtime_error("failed to start process");
+    }
+    if (posix_spawnattr_init(&attributes) != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        throw std::runtime_error("failed to start process");
+    }
+    for (int fd = 0; fd <= 2; fd++) {
+        posix_spawn_file_actions_addopen(&actions, fd, "/dev/null",
+            fd == STDIN_FILENO ? O_RDONLY : O_WRONLY, 0);
+    }
+#if defined(__GLIBC__) &&                                                      \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+    auto parent_path = executable.parent_path();
+    if (!parent_path.empty()) {
+        posix_spawn_file_actions_addchdir_np(&actions, parent_path.c_str());
+    }
+#endif
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+#ifdef POSIX_SPAWN_SETSID
+    flags |= POSIX_SPAWN_SETSID;
+#else
+    flags |= POSIX_SPAWN_SETPGROUP;
+    posix_spawnattr_setpgroup(&attributes, 0);
+#endif
+    posix_spawnattr_setflags(&attributes, flags);
+    // Do not pass on the signal mask or ignored signals of this process.
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attributes, &signals);
+    sigaddset(&signals, SIGPIPE);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    posix_spawnattr_setsigdefault(&attributes, &signals);
+
+    std::string path = executable.string();
+    std::vector<char*> argv;
+    argv.push_back(path.data());
+    std::vector<std::string> args(arguments);
+    for (auto& argument : args) {
+        argv.push_back(argument.data());
+    }
+    argv.push_back(nullptr);
+    pid_t pid;
+    int result = posix_spawn(
+        &pid, path.c_str(), &actions, &attributes, argv.data(), environ);
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&actions);
+    if (result != 0) {
+        throw std::runtime_error(
+            std::string("failed to start process: ") + std::strerror(result));
+    }
+}
+
+// Replaces the current process with the executable, keeping its pid,
+// its standard streams and any file descriptors that are inherited.
+// The executable's directory becomes the working directory,
+// like with start_process_detached(), and the signal mask and
+// ignored signals are reset. Destructors do not run and other threads
+// end immediately, so anything that must be saved should be saved first.
+// Only returns by throwing an exception, if the executable could not be
+// executed, in which case the process is left as it was.
+[[noreturn]] inline void replace_process(
+    std::filesystem::path const& executable,
+    std::vector<std::string> const& arguments = {})
+{
+    std::string path = executable.string();
+    std::vector<char*> argv;
+    argv.push_back(path.data());
+    std::vector<std::string> args(arguments);
+    for (auto& argument : args) {
+        argv.push_back(argument.data());
+    }
+    argv.push_back(nullptr);
+
+    std::error_code ec;
+    auto working_directory = std::filesystem::current_path(ec);
+    auto parent_path = executable.parent_path();
+    if (!parent_path.empty() && ::chdir(parent_path.c_str()) != 0) {
+        throw std::runtime_error(
+            std::string("failed to replace process: ") + std::strerror(errno));
+    }
+    sigset_t signals, previous_mask;
+    sigemptyset(&signals);
+    pthread_sigmask(SIG_SETMASK, &signals, &previous_mask);
+    int const reset[] = { SIGPIPE, SIGINT, SIGTERM, SIGHUP };
+    struct sigaction previous[std::size(reset)];
+    struct sigaction default_action
+    {
+    };
+    default_action.sa_handler = SIG_DFL;
+    for (std::size_t i = 0; i < std::size(reset); i++) {
+        ::sigaction(reset[i], &default_action, &previous[i]);
+    }
+    // Buffered output would otherwise be lost.
+    std::fflush(nullptr);
+    ::execve(path.c_str(), argv.data(), environ);
+
+    auto err = errno;
+    for (std::size_t i = 0; i < std::size(reset); i++) {
+        ::sigaction(reset[i], &previous[i], nullptr);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous_mask, nullptr);
+    if (!working_directory.empty()) {
+        std::filesystem::current_path(working_directory, ec);
+    }
+    throw std::runtime_error(
+        std::string("failed to replace process: ") + std::strerror(err));
+}
+
+// Returns the PIDs of all processes for each of the given paths,
+// in the same order as the paths. A process is listed for a path if:
+// - its executable is in the given directory, if the path is a directory,
+// - or its executable matches the path, if the path is not a directory.
+// The process table is walked once, regardless of the number of paths.
+// If exclude_current_process is set the current process will be excluded.
+// Processes whose executable cannot be determined, e.g. because they
+// belong to another user, are skipped.
+inline std::vector<std::vector<pid_t>> get_running_pids(
+    std::vector<std::filesystem::path> const& paths_or_directories,
+    bool exclude_current_process = true)
+{
+    std::vector<std::vector<pid_t>> pids(paths_or_directories.size());
+    pid_t current_pid = ::getpid();
+    executable_matcher matcher(paths_or_directories);
+    auto matches = [&](pid_t pid, std::filesystem::path const& executable) {
+        if (exclude_current_process && pid == current_pid) {
+            return;
+        }
+        matcher.match(executable, [&](std::size_t i) {
+            pids[i].push_back(pid);
+        });
+    };
+#if defined(__linux__)
+    std::error_code ec;
+    for (auto const& entry :
+        std::filesystem::directory_iterator("/proc", ec)) {
+        auto name = entry.path().filename().string();
+        if (name.empty() ||
+            name.find_first_not_of("0123456789") != std::string::npos) {
+            continue;
+        }
+        auto executable = std::filesystem::read_symlink(
+            entry.path() / "exe", ec);
+        if (ec) {
+            continue;
+        }
+        // The executable of a process might have been deleted or replaced.
+        auto executable_name = executable.string();
+        const std::string deleted = " (deleted)";
+        if (executable_name.size() > deleted.size() &&
+            executable_name.compare(executable_name.size() - deleted.size(),
+                deleted.size(), deleted) == 0) {
+            executable = executable_name.substr(
+                0, executable_name.size() - deleted.size());
+        }
+        matches(static_cast<pid_t>(std::stol(name)), executable);
+    }
+#elif defined(__APPLE__)
+    int count = proc_listallpids(nullptr, 0);
+    std::vector<pid_t> all(static_cast<std::size_t>(std::max(count, 0)) + 64);
+    count = proc_listallpids(
+        all.data(), static_cast<int>(all.size() * sizeof(pid_t)));
+    for (int i = 0; i < count; i++) {
+        char executable[PROC_PIDPATHINFO_MAXSIZE];
+        if (all[i] > 0 &&
+            proc_pidpath(all[i], executable, sizeof(executable)) > 0) {
+            matches(all[i], executable);
+        }
+    }
+#else
+    throw std::runtime_error("processes cannot be listed on this platform");
+#endif
+    return pids;
+}
+
+// Returns the PIDs of all process that either:
+// - have their executable in the given directory, if the path is a directory,
+// - or whose executable matches the path, if the path is not a directory.
+// If exclude_current_process is set the current process will be excluded.
+inline std::vector<pid_t> get_running_pids(
+    std::filesystem::path const& path_or_directory,
+    bool exclude_current_process = true)
+{
+    auto pids = get_running_pids(
+        std::vector<std::filesystem::path>{ path_or_directory },
+        exclude_current_process);
+    return std::move(pids.front());
+}
+
+// Returns whether a process has exited. Reaps it, if it is a child.
+inline bool has_exited(pid_t pid)
+{
+    if (::waitpid(pid, nullptr, WNOHANG) == pid) {
+        return true;
+    }
+    if (::kill(pid, 0) != 0) {
+        return errno == ESRCH;
+    }
+#ifdef __linux__
+    // A process that has exited exists until its parent reaps it.
+    std::string stat;
+    std::ifstream file("/proc/" + std::to_string(pid) + "/stat");
+    std::getline(file, stat);
+    auto state = stat.rfind(") ");
+    return state != std::string::npos && state + 2 < stat.size() &&
+        stat[state + 2] == 'Z';
+#else
+    return false;
+#endif
+}
+
+// A process that is being stopped. Refers to the process with a pidfd
+// where supported (Linux 5.3), which, unlike its pid, cannot be reused
+// for another process and which becomes readable once it has exited.
+class stopping_process
+{
+public:
+    explicit stopping_process(pid_t pid) : m_pid{ pid }
+    {
+#ifdef SYS_pidfd_open
+        m_pidfd = static_cast<int>(::syscall(SYS_pidfd_open, pid, 0));
+        if (m_pidfd < 0 && errno == ESRCH) {
+            m_exited = true;
+        }
+#endif
+    }
+
+    stopping_process(stopping_process&& other) noexcept
+        : m_pid{ other.m_pid },
+          m_pidfd{ std::exchange(other.m_pidfd, -1) },
+          m_exited{ other.m_exited }
+    {
+    }
+
+    stopping_process& operator=(stopping_process&& other) noexcept
+    {
+        std::swap(m_pid, other.m_pid);
+        std::swap(m_pidfd, other.m_pidfd);
+        std::swap(m_exited, other.m_exited);
+        return *this;
+    }
+
+    stopping_process(stopping_process const&) = delete;
+    stopping_process& operator=(stopping_process const&) = delete;
+
+    ~stopping_process()
+    {
+        if (m_pidfd >= 0) {
+            ::close(m_pidfd);
+        }
+    }
+
+    // Returns the pidfd or -1, if the process has none.
+    int pidfd() const { return m_pidfd; }
+
+    void signal(int signal) const
+    {
+        if (m_exited) {
+            return;
+        }
+#ifdef SYS_pidfd_send_signal
+        // Fall back to the pid only if the system call is not available.
+        if (m_pidfd >= 0 &&
+            (::syscall(SYS_pidfd_send_signal, m_pidfd, signal, nullptr, 0) ==
+                    0 ||
+                errno != ENOSYS)) {
+            return;
+        }
+#endif
+        ::kill(m_pid, signal);
+    }
+
+    // Returns whether the process has exited. Reaps it, if it is a child.
+    bool exited()
+    {
+        if (m_exited) {
+            return true;
+        }
+        if (m_pidfd < 0) {
+            return m_exited = has_exited(m_pid);
+        }
+        pollfd fd{ m_pidfd, POLLIN, 0 };
+        if (::poll(&fd, 1, 0) == 1) {
+            ::waitpid(m_pid, nullptr, WNOHANG);
+            m_exited = true;
+        }
+        return m_exited;
+    }
+
+private:
+    pid_t m_pid;
+    int m_pidfd{ -1 };
+    bool m_exited{ false };
+};
+
+// Waits until all processes have exited or the deadline has passed
+// and returns whether they have exited. Processes with a pidfd
+// are awaited with poll(), all others are checked periodically.
+inline bool wait_for_exit(std::vector<stopping_process>& processes,
+    std::chrono::steady_clock::time_point deadline)
+{
+    std::vector<pollfd> fds;
+    while (true) {
+        processes.erase(std::remove_if(processes.begin(), processes.end(),
+                            [](stopping_process& process) {
+                                return process.exited();
+                            }),
+            processes.end());
+        if (processes.empty()) {
+            return true;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            return false;
+        }
+        auto timeout = std::chrono::ceil<std::chrono::milliseconds>(
+            deadline - now);
+        fds.clear();
+        for (auto const& process : processes) {
+            if (process.pidfd() >= 0) {
+                fds.push_back({ process.pidfd(), POLLIN, 0 });
+            }
+        }
+        if (fds.size() < processes.size()) {
+            timeout = std::min(timeout, std::chrono::milliseconds(5));
+        }
+        if (fds.empty()) {
+            std::this_thread::sleep_for(timeout);
+        } else {
+            ::poll(fds.data(), static_cast<nfds_t>(fds.size()),
+                static_cast<int>(timeout.count()));
+        }
+    }
+}
+
+// Stops the processes according to the shutdown policy:
+// each step signals all remaining processes at once and waits
+// for all of them against a single deadline, so that the time this
+// takes does not grow with the number of processes.
+// Returns whether all processes have exited.
+inline bool stop_pids_and_wait_for_exit(
+    std::vector<pid_t> const& pids, shutdown_policy const& policy)
+{
+    std::vector<stopping_process> processes;
+    processes.reserve(pids.size());
+    for (auto pid : pids) {
+        processes.emplace_back(pid);
+    }
+    std::pair<int, std::chrono::milliseconds> const steps[] = {
+        { SIGINT, policy.polite },
+        { SIGTERM, policy.terminate },
+        { SIGKILL, policy.kill },
+    };
+    for (auto const& [signal, budget] : steps) {
+        if (budget <= std::chrono::milliseconds::zero()) {
+            continue;
+        }
+        for (auto const& process : processes) {
+            process.signal(signal);
+        }
+        if (wait_for_exit(
+                processes, std::chrono::steady_clock::now() + budget)) {
+            return true;
+        }
+    }
+    return wait_for_exit(processes, std::chrono::steady_clock::now());
+}
+
+// Kills any processes whose executables are located in one of the
+// given directories or whose executable path matches one of the paths.
+// Paths that do not exist are ignored. The process table is walked once
+// and all processes are stopped together, according to the policy.
+// If an exit directory is given, processes that listen for exit requests
+// in it are asked to prepare to exit first, which takes its time
+// from the polite step of the policy.
+// Waits until all processes have exited.
+// Returns the number of processes that have been killed
+// or throws an exception if an error occured.
+inline size_t kill_processes(
+    std::vector<std::filesystem::path> const& paths_or_directories,
+    shutdown_policy policy = {},
+    std::filesystem::path const& exit_directory = {})
+{
+    std::vector<std::filesystem::path> existing;
+    for (auto const& path : paths_or_directories) {
+        if (std::filesystem::exists(path)) {
+            existing.push_back(path);
+        }
+    }
+    if (existing.empty()) {
+        return 0;
+    }
+    // A process may be listed for more than one path.
+    std::vector<pid_t> pids;
+    for (auto const& matched : get_running_pids(existing)) {
+        pids.insert(pids.end(), matched.begin(), matched.end());
+    }
+    std::sort(pids.begin(), pids.end());
+    pids.erase(std::unique(pids.begin(), pids.end()), pids.end());
+    if (!exit_directory.empty() && !pids.empty()) {
+        auto start = std::chrono::steady_clock::now();
+        request_exit(exit_directory, pids, start + policy.polite);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        policy.polite -=
+            std::chrono::duration_cast<std::chrono::milliseconds>(elapsed);
+    }
+    if (!stop_pids_and_wait_for_exit(pids, policy)) {
+        throw std::runtime_error(
+            "failed to close processes: operation timed out");
+    }
+    return pids.size();
+}
+
+// Kills any processes whose executables are located in the given directory,
+// if the given path is a directory or whose executable path
+// matches the given path exactly.
+// Waits until all processes have exited.
+// Returns the number of processes that have been killed
+// or throws an exception if an error occured.
+inline size_t kill_processes(std::filesystem::path const& path_or_directory,
+    shutdown_policy const& policy = {},
+    std::filesystem::path const& exit_directory = {})
+{
+    return kill_processes(
+        std::vector<std::filesystem::path>{ path_or_directory }, policy,
+        exit_directory);
+}
+
+} // namespace ungive::update::internal::posix
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <system_error>
+#include <vector>
+
+#include "ungive/update/internal/util.h"
+
+namespace ungive::update::internal
+{
+
+// Matches the executables of running processes against a set of paths,
+// each of which is either a directory, which matches any executable
+// that lies in it, or the path of an executable, which matches exactly.
+// Paths are resolved and checked for being a directory once up front,
+// so that the process table is walked once for any number of paths.
+// Symbolic links in the paths are resolved, since the executables
+// of processes are reported with their canonical paths.
+class executable_matcher
+{
+public:
+    explicit executable_matcher(
+        std::vector<std::filesystem::path> const& paths_or_directories)
+    {
+        m_targets.reserve(paths_or_directories.size());
+        for (auto const& path : paths_or_directories) {
+            std::error_code ec;
+            auto resolved = std::filesystem::weakly_canonical(path, ec);
+            m_targets.push_back({ normalize(ec ? path : resolved),
+                std::filesystem::is_directory(path, ec) });
+        }
+    }
+
+    // Returns the number of paths.
+    std::size_t size() const { return m_targets.size(); }
+
+    // Calls the function with the index of each path
+    // that matches the executable of a process.
+    template <typename F>
+    void match(std::filesystem::path const& executable, F&& matched) const
+    {
+        auto normalized = normalize(executable);
+        for (std::size_t i = 0; i < m_targets.size(); i++) {
+            auto const& target = m_targets[i];
+            if (target.is_directory ? is_subpath(normalized, target.path)
+                                    : normalized == target.path) {
+                matched(i);
+            }
+        }
+    }
+
+private:
+    struct target
+    {
+        std::filesystem::path path;
+        bool is_directory;
+    };
+
+    // Removes redundant elements and any trailing separator,
+    // which would otherwise be an empty last element of a directory.
+    static std::filesystem::path normalize(std::filesystem::path const& path)
+    {
+        auto normalized = path.lexically_normal();
+        if (!normalized.has_filename() && normalized.has_relative_path()) {
+            normalized = normalized.parent_path();
+        }
+        return normalized;
+    }
+
+    std::vector<target> m_targets;
+};
+
+} // namespace ungive::update::internal
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef WIN32
+#include <sys/stat.h>
+#endif
+
+namespace ungive::update::internal
+{
+
+// Returns the path itself or its closest ancestor that exists.
+inline std::filesystem::path existing_ancestor(std::filesystem::path path)
+{
+    path = std::filesystem::absolute(path);
+    while (!std::filesystem::exists(path) && path.has_relative_path()) {
+        path = path.parent_path();
+    }
+    return path;
+}
+
+// Returns an identifier of the volume on which the given path is located.
+// The path must exist.
+inline std::string volume_of(std::filesystem::path const& path)
+{
+#ifdef WIN32
+    return std::filesystem::absolute(path).root_name().string();
+#else
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        throw std::runtime_error("failed to stat " + path.string());
+    }
+    return std::to_string(static_cast<uint64_t>(st.st_dev));
+#endif
+}
+
+// Throws if the volume of an existing directory has less than
+// the given number of bytes available.
+inline void check_available_space(
+    std::filesystem::path const& directory, uint64_t bytes)
+{
+    auto available = std::filesystem::space(directory).available;
+    if (available < bytes) {
+        throw std::runtime_error("not enough disk space in " +
+            directory.string() + ": " + std::to_string(bytes) +
+            " bytes required, " + std::to_string(available) +
+            " bytes available");
+    }
+}
+
+// Checks that the volume of each directory has at least the given number
+// of bytes available and throws if that is not the case.
+// Directories on the same volume are only checked once, since content
+// that is moved between them within a volume is not copied.
+// Directories that do not exist yet are checked by their closest ancestor.
+inline void require_free_space(
+    std::vector<std::filesystem::path> const& directories, uint64_t bytes)
+{
+    std::vector<std::string> checked;
+    for (auto const& target : directories) {
+        auto directory = existing_ancestor(target);
+        auto volume = volume_of(directory);
+        if (std::find(checked.begin(), checked.end(), volume) !=
+            checked.end()) {
+            continue;
+        }
+        checked.push_back(volume);
+        check_available_space(directory, bytes);
+    }
+}
+
+// Checks that the volume of each directory has space for all bytes
+// that are written to directories on that volume, which are added up,
+// e.g. for a downloaded archive and the files extracted from it.
+// Directories that do not exist yet are checked by their closest ancestor.
+inline void require_free_space(
+    std::vector<std::pair<std::filesystem::path, uint64_t>> const& writes)
+{
+    std::vector<std::pair<std::string, std::filesystem::path>> volumes;
+    std::vector<uint64_t> totals;
+    for (auto const& [target, bytes] : writes) {
+        auto directory = existing_ancestor(target);
+        auto volume = volume_of(directory);
+        auto it = std::find_if(volumes.begin(), volumes.end(),
+            [&](auto const& entry) {
+                return entry.first == volume;
+            });
+        auto i = static_cast<std::size_t>(it - volumes.begin());
+        if (it == volumes.end()) {
+            volumes.emplace_back(volume, directory);
+            totals.push_back(0);
+        }
+        auto max = std::numeric_limits<uint64_t>::max();
+        totals[i] = bytes > max - totals[i] ? max : totals[i] + bytes;
+    }
+    for (std::size_t i = 0; i < volumes.size(); i++) {
+        check_available_space(volumes[i].second, totals[i]);
+    }
+}
+
+// Tracks the entries and bytes that an archive extraction produces
+// and throws once either exceeds its limit, which guards against
+// archives that expand to an unreasonable size or number of files.
+// May be used from multiple threads at once.
+class extraction_budget
+{
+public:
+    extraction_budget(uint64_t max_size, uint64_t max_entries)
+        : m_max_size{ max_size }, m_max_entries{ max_entries }
+    {
+    }
+
+    extraction_budget(extraction_budget const&) = delete;
+    extraction_budget& operator=(extraction_budget const&) = delete;
+
+    // Accounts for the given number of entries and bytes at once,
+    // e.g. when they are known from an archive index before extracting.
+    void reserve(uint64_t entries, uint64_t bytes)
+    {
+        add(m_entries, entries, m_max_entries, "entries");
+        add(m_size, bytes, m_max_size, "bytes");
+    }
+
+    // Accounts for a single extracted entry.
+    inline void add_entry() { add(m_entries, 1, m_max_entries, "entries"); }
+
+    // Accounts for extracted bytes.
+    inline void add_bytes(uint64_t bytes)
+    {
+        add(m_size, bytes, m_max_size, "bytes");
+    }
+
+private:
+    static void add(std::atomic<uint64_t>& counter, uint64_t amount,
+        uint64_t limit, char const* unit)
+    {
+        auto total = counter.fetch_add(amount) + amount;
+        if (total > limit || total < amount) {
+            throw std::runtime_error("archive exceeds the limit of " +
+                std::to_string(limit) + " extracted " + unit);
+        }
+    }
+
+    uint64_t const m_max_size;
+    uint64_t const m_max_entries;
+    std::atomic<uint64_t> m_size{ 0 };
+    std::atomic<uint64_t> m_entries{ 0 };
+};
+
+} // namespace ungive::update::internal
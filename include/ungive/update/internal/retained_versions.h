@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "ungive/update/detail/common.h"
+#include "ungive/update/internal/sentinel.h"
+
+namespace ungive::update::internal
+{
+
+// Versions which were replaced in the latest directory and are kept,
+// each in a directory named after its version, so that they can be
+// restored without downloading them again. The modification time
+// of each directory is the time it was last replaced, which determines
+// which versions were least recently used.
+class retained_versions
+{
+public:
+    struct entry
+    {
+        version_number version;
+        std::filesystem::path path;
+        std::filesystem::file_time_type replaced;
+    };
+
+    explicit retained_versions(std::filesystem::path root)
+        : m_root{ std::move(root) }
+    {
+    }
+
+    // Returns the directory in which versions are kept.
+    std::filesystem::path const& root() const { return m_root; }
+
+    // Returns the directory in which the version is kept, if it is.
+    std::filesystem::path path(version_number const& version) const
+    {
+        return m_root / version.string();
+    }
+
+    // Moves the directory of a replaced version to the retained versions.
+    // The directory of the same version must not exist anymore.
+    // Returns the new path of the directory.
+    std::filesystem::path add(std::filesystem::path const& directory,
+        version_number const& version) const
+    {
+        auto target = path(version);
+        std::filesystem::create_directories(m_root);
+        std::filesystem::rename(directory, target);
+        std::error_code ec;
+        std::filesystem::last_write_time(
+            target, std::filesystem::file_time_type::clock::now(), ec);
+        return target;
+    }
+
+    // Returns all retained versions with a valid sentinel,
+    // the most recently replaced version first.
+    std::vector<entry> list() const
+    {
+        std::vector<entry> result;
+        std::error_code ec;
+        for (auto const& item :
+            std::filesystem::directory_iterator(m_root, ec)) {
+            if (auto version = read(item.path())) {
+                result.push_back({ *version, item.path(),
+                    std::filesystem::last_write_time(item.path(), ec) });
+            }
+        }
+        std::sort(result.begin(), result.end(),
+            [](entry const& lhs, entry const& rhs) {
+                return lhs.replaced > rhs.replaced;
+            });
+        return result;
+    }
+
+    // Returns the given version or, if none is given, the newest
+    // retained version that is older than the given one, if any.
+    std::optional<entry> find(std::optional<version_number> const& version,
+        std::optional<version_number> const& older_than) const
+    {
+        std::optional<entry> result;
+        for (auto const& entry : list()) {
+            if (version.has_value()) {
+                if (entry.version == *version) {
+                    return entry;
+                }
+                continue;
+            }
+            if (older_than.has_value() && entry.version >= *older_than) {
+                continue;
+            }
+            if (!result.has_value() || entry.version > result->version) {
+                result = entry;
+            }
+        }
+        return result;
+    }
+
+    // Returns the directories that must be removed to satisfy the policy,
+    // which includes any directory that is not a valid retained version.
+    // Sizes are only computed if the policy has a disk budget.
+    std::vector<std::filesystem::path> evict(
+        retention_policy const& policy) const
+    {
+        std::vector<std::filesystem::path> result;
+        std::error_code ec;
+        for (auto const& item :
+            std::filesystem::directory_iterator(m_root, ec)) {
+            if (!read(item.path()).has_value()) {
+                result.push_back(item.path());
+            }
+        }
+        std::size_t kept = 0;
+        uint64_t total_size = 0;
+        for (auto const& entry : list()) {
+            bool keep = kept < policy.versions;
+            if (keep && policy.disk_budget.has_value()) {
+                total_size += tree_size(entry.path);
+                keep = total_size <= *policy.disk_budget;
+            }
+            if (keep) {
+                kept++;
+            } else {
+                result.push_back(entry.path);
+            }
+        }
+        return result;
+    }
+
+private:
+    // Returns the version of a retained directory,
+    // if its sentinel is valid and matches its name.
+    static std::optional<version_number> read(
+        std::filesystem::path const& directory)
+    {
+        std::error_code ec;
+        if (!std::filesystem::is_directory(directory, ec)) {
+            return std::nullopt;
+        }
+        internal::sentinel sentinel(directory);
+        if (!sentinel.read() ||
+            sentinel.version().string() != directory.filename().string()) {
+            return std::nullopt;
+        }
+        return sentinel.version();
+    }
+
+    // Returns the size of the files that only this directory uses.
+    // A deduplicated file has one link in the object store
+    // and one in each version directory that contains it,
+    // so a file with more links is shared with another version.
+    static uint64_t tree_size(std::filesystem::path const& directory)
+    {
+        constexpr uintmax_t unshared_links = 2;
+        uint64_t size = 0;
+        std::error_code ec;
+        for (auto const& entry :
+            std::filesystem::recursive_directory_iterator(directory, ec)) {
+            if (!entry.is_regular_file(ec) || entry.is_symlink(ec)) {
+                continue;
+            }
+            std::error_code entry_ec;
+            auto links = entry.hard_link_count(entry_ec);
+            if (entry_ec || links > unshared_links) {
+                continue;
+            }
+            auto file_size = entry.file_size(entry_ec);
+            size += entry_ec ? 0 : file_size;
+        }
+        return size;
+    }
+
+    std::filesystem::path m_root;
+};
+
+} // namespace ungive::update::internal
@@ -6,7 +6,9 @@
 #include <string>
 
 #include "ungive/update/detail/common.h"
+#include "ungive/update/internal/sync.h"
 #include "ungive/update/internal/util.h"
+#include "ungive/update/internal/verification_record.h"
 
 #define SENTINEL_FILENAME ".sentinel"
 
@@ -40,6 +42,19 @@ public:
         return m_version.value();
     }
 
+    // Sets how the archive of this version was verified.
+    inline void verification(verification_info const& info)
+    {
+        m_verification = info;
+    }
+
+    // Returns how the archive of this version was verified, if known.
+    // Allows checking that a version was verified without hashing anything.
+    inline std::optional<verification_info> const& verification() const
+    {
+        return m_verification;
+    }
+
     // Attempts to read the sentinel's contents.
     // Can be used to check if a version's directory is valid.
     // Returns if the operation was successful, does not throw.
@@ -58,8 +73,10 @@ public:
     }
 
     // Writes the contents for the sentinel file.
+    // The file is replaced atomically and, unless the durability is none,
+    // flushed to disk together with its directory entry.
     // May throw an exception if information is missing or writing failed.
-    void write()
+    void write(durability mode = durability::none)
     {
         if (!m_version.has_value()) {
             throw std::runtime_error("missing version information");
@@ -69,15 +86,25 @@ public:
             throw std::runtime_error("internal location has no parent path");
         }
         std::filesystem::create_directories(m_location.parent_path());
-        internal::write_file(m_location, "version=" + m_version->string());
+        internal::write_file_atomically(m_location, encode(), mode);
     }
 
 private:
     // Encodes all fields.
     std::string encode()
     {
-        // Just one line at the moment.
-        return "version=" + m_version->string();
+        std::ostringstream oss;
+        oss << "version=" << m_version->string();
+        if (m_verification.has_value()) {
+            oss << "\nverified_size=" << m_verification->size;
+            for (auto const& [algorithm, digest] : m_verification->digests) {
+                oss << "\nverified_digest=" << algorithm << ":" << digest;
+            }
+            for (auto const& verifier : m_verification->verifiers) {
+                oss << "\nverified_by=" << verifier;
+            }
+        }
+        return oss.str();
     }
 
     // Decodes encoded fields, may throw an exception.
@@ -85,6 +112,7 @@ private:
     {
         // Fields
         std::optional<version_number> version{};
+        std::optional<verification_info> verification{};
 
         std::istringstream iss(content);
         for (std::string line; std::getline(iss, line);) {
@@ -92,10 +120,24 @@ private:
             if (index == std::string::npos) {
                 continue;
             }
-            if (line.substr(0, index) == "version") {
-                auto x =
-                    line.substr(index + 1, line.find_first_of('\n', index + 1));
-                version = version_number::from_string(x);
+            auto key = line.substr(0, index);
+            auto value = line.substr(index + 1);
+            if (key == "version") {
+                version = version_number::from_string(value);
+            } else if (key == "verified_size") {
+                verification = verification.value_or(verification_info{});
+                verification->size = std::stoull(value);
+            } else if (key == "verified_digest") {
+                auto separator = value.find_first_of(':');
+                if (separator == std::string::npos) {
+                    throw std::runtime_error("digest without algorithm");
+                }
+                verification = verification.value_or(verification_info{});
+                verification->digests[value.substr(0, separator)] =
+                    value.substr(separator + 1);
+            } else if (key == "verified_by") {
+                verification = verification.value_or(verification_info{});
+                verification->verifiers.push_back(value);
             }
         }
         if (!version.has_value()) {
@@ -104,11 +146,13 @@ private:
 
         // All decoded correctly, update fields.
         m_version = version.value();
+        m_verification = verification;
     }
 
     std::filesystem::path m_location;
 
     std::optional<version_number> m_version{};
+    std::optional<verification_info> m_verification{};
 };
 
 } // namespace ungive::update::internal
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include "ungive/update/internal/util.h"
+
+namespace ungive::update::internal
+{
+
+// Returns a name that is never returned twice within this process.
+// It consists of a random prefix, which is chosen once per process
+// and tells apart names of different processes, and a counter.
+inline std::string unique_name()
+{
+    static const std::string prefix = random_string(12);
+    static std::atomic<uint64_t> counter{ 0 };
+    return prefix + "-" + std::to_string(counter.fetch_add(1));
+}
+
+// A directory in a staging area, which is removed with its content
+// once it goes out of scope, unless it has been committed.
+class staging_directory
+{
+public:
+    explicit staging_directory(std::filesystem::path path)
+        : m_path{ std::move(path) }
+    {
+    }
+
+    ~staging_directory() { discard(); }
+
+    staging_directory(staging_directory const&) = delete;
+    staging_directory& operator=(staging_directory const&) = delete;
+
+    staging_directory(staging_directory&& other) noexcept
+        : m_path{ std::move(other.m_path) }
+    {
+        other.m_path.clear();
+    }
+
+    staging_directory& operator=(staging_directory&& other) noexcept
+    {
+        if (this != &other) {
+            discard();
+            m_path = std::move(other.m_path);
+            other.m_path.clear();
+        }
+        return *this;
+    }
+
+    // Returns the path of the directory or an empty path
+    // if it has been committed or discarded.
+    std::filesystem::path const& path() const { return m_path; }
+
+    // Moves the directory to the given target with a single rename,
+    // after which it is not removed by this handle anymore.
+    void commit(std::filesystem::path const& target)
+    {
+        std::filesystem::rename(m_path, target);
+        m_path.clear();
+    }
+
+    // Removes the directory and its content. Errors are ignored.
+    void discard() noexcept
+    {
+        if (m_path.empty()) {
+            return;
+        }
+        std::error_code ec;
+        std::filesystem::remove_all(m_path, ec);
+        m_path.clear();
+    }
+
+private:
+    std::filesystem::path m_path;
+};
+
+// A directory in which updates are prepared before they are moved
+// to their final location. It must be located on the same volume
+// as that location, so that a prepared update appears there
+// with a single rename, e.g. by placing it in the same parent directory.
+class staging_area
+{
+public:
+    explicit staging_area(std::filesystem::path root)
+        : m_root{ std::move(root) }
+    {
+    }
+
+    // Returns the directory in which staging directories are created.
+    std::filesystem::path const& root() const { return m_root; }
+
+    // Creates a new, empty staging directory.
+    staging_directory create(unsigned int max_tries = 16) const
+    {
+        std::filesystem::create_directories(m_root);
+        for (unsigned int i = 0; i < max_tries; i++) {
+            auto path = m_root / unique_name();
+            if (std::filesystem::create_directory(path)) {
+                return staging_directory(path);
+            }
+        }
+        throw std::runtime_error(
+            "unable to create staging directory in " + m_root.string());
+    }
+
+    // Removes all staging directories, e.g. ones that were left behind
+    // by a process that exited before it could remove them.
+    // Only call this while no other process can use the staging area.
+    // Directories that cannot be removed are skipped.
+    // Returns the number of directories that were removed.
+    std::size_t clear() const noexcept
+    {
+        std::size_t removed = 0;
+        std::error_code ec;
+        auto it = std::filesystem::directory_iterator(m_root, ec);
+        for (; !ec && it != std::filesystem::directory_iterator();
+             it.increment(ec)) {
+            std::error_code remove_ec;
+            std::filesystem::remove_all(it->path(), remove_ec);
+            if (!remove_ec) {
+                removed++;
+            }
+        }
+        return removed;
+    }
+
+private:
+    std::filesystem::path m_root;
+};
+
+} // namespace ungive::update::internal
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace ungive::update::internal
+{
+
+// Reads up to size bytes into data and returns the number of bytes read.
+// Returns 0 once the end of the data has been reached.
+using byte_reader = std::function<std::size_t(char* data, std::size_t size)>;
+
+// A bounded buffer of bytes between a producing and a consuming thread.
+// The producer blocks while the buffer is full, which slows down
+// e.g. a download to the speed at which its data is consumed,
+// such that memory usage stays bounded.
+class byte_pipe
+{
+public:
+    byte_pipe(std::size_t capacity = 8 * 1024 * 1024)
+        : m_buffer(std::max<std::size_t>(capacity, 1))
+    {
+    }
+
+    byte_pipe(byte_pipe const&) = delete;
+    byte_pipe& operator=(byte_pipe const&) = delete;
+
+    // Writes data, blocking while the pipe is full.
+    // Returns false if the consumer stopped reading.
+    bool write(char const* data, std::size_t size)
+    {
+        while (size > 0) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] {
+                return m_aborted || m_size < m_buffer.size();
+            });
+            if (m_aborted) {
+                return false;
+            }
+            auto end = (m_begin + m_size) % m_buffer.size();
+            auto n = std::min(size, m_buffer.size() - m_size);
+            n = std::min(n, m_buffer.size() - end);
+            std::memcpy(m_buffer.data() + end, data, n);
+            m_size += n;
+            data += n;
+            size -= n;
+            m_condition.notify_all();
+        }
+        return true;
+    }
+
+    // Signals that no more data will be written. If an error is passed,
+    // it is rethrown to the consumer once it has read all data.
+    void close(std::exception_ptr error = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_error = error;
+        m_condition.notify_all();
+    }
+
+    // Reads up to size bytes, blocking until data is available.
+    // Returns 0 once the pipe is closed and all data has been read.
+    std::size_t read(char* data, std::size_t size)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this] {
+            return m_aborted || m_closed || m_size > 0;
+        });
+        if (m_aborted) {
+            throw std::runtime_error("reading from pipe aborted");
+        }
+        if (m_size == 0) {
+            if (m_error) {
+                std::rethrow_exception(m_error);
+            }
+            return 0;
+        }
+        auto n = std::min(size, m_size);
+        n = std::min(n, m_buffer.size() - m_begin);
+        std::memcpy(data, m_buffer.data() + m_begin, n);
+        m_begin = (m_begin + n) % m_buffer.size();
+        m_size -= n;
+        m_condition.notify_all();
+        return n;
+    }
+
+    // Stops the transfer. Pending and future writes return false
+    // and pending and future reads throw an exception.
+    void abort()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_aborted = true;
+        m_condition.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::vector<char> m_buffer;
+    std::size_t m_begin{ 0 };
+    std::size_t m_size{ 0 };
+    bool m_closed{ false };
+    bool m_aborted{ false };
+    std::exception_ptr m_error{};
+};
+
+// Buffers the data of a byte reader, to allow reading exact amounts
+// and to let decoders consume only as many bytes as they need.
+class stream_reader
+{
+public:
+    stream_reader(byte_reader reader, std::size_t buffer_size = 256 * 1024)
+        : m_reader{ std::move(reader) }, m_buffer(buffer_size)
+    {
+    }
+
+    // Returns the buffered bytes, reading more if the buffer is empty.
+    // Returns an empty range once the end of the data has been reached.
+    std::pair<char const*, std::size_t> peek()
+    {
+        if (m_begin == m_end) {
+            m_begin = 0;
+            m_end = m_reader(m_buffer.data(), m_buffer.size());
+        }
+        return { m_buffer.data() + m_begin, m_end - m_begin };
+    }
+
+    // Marks the given number of peeked bytes as read.
+    void consume(std::size_t size)
+    {
+        m_begin += std::min(size, m_end - m_begin);
+        m_position += size;
+    }
+
+    // Reads up to size bytes, returns 0 at the end of the data.
+    std::size_t read(char* data, std::size_t size)
+    {
+        auto [buffered, available] = peek();
+        auto n = std::min(size, available);
+        std::memcpy(data, buffered, n);
+        consume(n);
+        return n;
+    }
+
+    // Reads exactly size bytes, throws if the data ends before that.
+    void read_exact(char* data, std::size_t size)
+    {
+        while (size > 0) {
+            auto n = read(data, size);
+            if (n == 0) {
+                throw std::runtime_error("unexpected end of data");
+            }
+            data += n;
+            size -= n;
+        }
+    }
+
+    // Skips exactly size bytes, throws if the data ends before that.
+    void skip(uint64_t size)
+    {
+        while (size > 0) {
+            auto [buffered, available] = peek();
+            if (available == 0) {
+                throw std::runtime_error("unexpected end of data");
+            }
+            auto n = static_cast<std::size_t>(
+                std::min<uint64_t>(size, available));
+            consume(n);
+            size -= n;
+        }
+    }
+
+    // The number of bytes that have been read.
+    inline uint64_t position() const { return m_position; }
+
+private:
+    byte_reader m_reader;
+    std::vector<char> m_buffer;
+    std::size_t m_begin{ 0 };
+    std::size_t m_end{ 0 };
+    uint64_t m_position{ 0 };
+};
+
+} // namespace ungive::update::internal
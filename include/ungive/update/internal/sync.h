@@ -0,0 +1,183 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "ungive/update/detail/common.h"
+#include "ungive/update/internal/staging.h"
+#include "ungive/update/internal/thread_pool.h"
+#include "ungive/update/internal/util.h"
+
+namespace ungive::update::internal
+{
+
+#ifndef WIN32
+// Opens a file or directory for reading and returns its descriptor.
+inline int open_for_sync(std::filesystem::path const& path, int flags = 0)
+{
+    int fd;
+    do {
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | flags);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0) {
+        throw std::runtime_error("failed to open " + path.string());
+    }
+    return fd;
+}
+
+// Flushes the data of an open file to the storage device.
+inline void sync_descriptor(int fd, std::filesystem::path const& path)
+{
+#if defined(__APPLE__)
+    // fsync() on macOS does not flush the drive's cache.
+    int result = ::fcntl(fd, F_FULLFSYNC);
+    if (result != 0) {
+        result = ::fsync(fd);
+    }
+#elif defined(__linux__)
+    int result = ::fdatasync(fd);
+#else
+    int result = ::fsync(fd);
+#endif
+    ::close(fd);
+    if (result != 0) {
+        throw std::runtime_error("failed to flush " + path.string());
+    }
+}
+#endif
+
+// Flushes the content of a file to the storage device.
+inline void sync_file(std::filesystem::path const& path)
+{
+#ifdef WIN32
+    HANDLE handle = CreateFileW(path.wstring().c_str(), GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("failed to open " + path.string());
+    }
+    BOOL flushed = FlushFileBuffers(handle);
+    CloseHandle(handle);
+    if (!flushed) {
+        throw std::runtime_error("failed to flush " + path.string());
+    }
+#else
+    sync_descriptor(open_for_sync(path), path);
+#endif
+}
+
+// Flushes the entries of a directory, e.g. after files
+// were created in it or renamed into it.
+// Does nothing on Windows, where directories cannot be flushed
+// and NTFS journals changes to directory entries.
+inline void sync_directory(std::filesystem::path const& path)
+{
+#ifndef WIN32
+    sync_descriptor(open_for_sync(path, O_DIRECTORY), path);
+#endif
+}
+
+// Flushes all data of the file system on which the path is located.
+// Returns false if that is not supported on this platform.
+inline bool sync_filesystem(std::filesystem::path const& path)
+{
+#ifdef __linux__
+    int fd = open_for_sync(path);
+    int result = ::syncfs(fd);
+    ::close(fd);
+    if (result != 0) {
+        throw std::runtime_error("failed to flush file system of " +
+            path.string());
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Flushes all files and directories within a directory and the directory
+// itself, so that its content is intact after a crash.
+// Files are flushed concurrently on the given thread pool,
+// unless the whole file system is flushed at once.
+// Does nothing if the durability is none.
+inline void sync_tree(std::filesystem::path const& directory,
+    durability mode, thread_pool& pool = thread_pool::shared())
+{
+    namespace fs = std::filesystem;
+    if (mode == durability::none) {
+        return;
+    }
+    if (mode == durability::sync_filesystem && sync_filesystem(directory)) {
+        return;
+    }
+    std::vector<fs::path> files;
+    std::vector<fs::path> directories{ directory };
+    for (auto const& entry : fs::recursive_directory_iterator(directory)) {
+        if (entry.is_symlink()) {
+            continue;
+        }
+        if (entry.is_directory()) {
+            directories.push_back(entry.path());
+        } else if (entry.is_regular_file()) {
+            files.push_back(entry.path());
+        }
+    }
+    auto flush_all = [&pool](std::vector<fs::path> const& paths,
+                         void (*flush)(fs::path const&)) {
+        task_group group(pool);
+        group.add_batches(paths.size(), 16,
+            [&paths, flush](size_t begin, size_t end,
+                std::atomic<bool> const& cancelled) {
+                for (auto i = begin; i < end && !cancelled.load(); i++) {
+                    flush(paths[i]);
+                }
+            });
+        group.run();
+    };
+    // Directories are flushed after their files, so that a flushed entry
+    // never refers to a file whose content was not flushed yet.
+    flush_all(files, sync_file);
+    flush_all(directories, sync_directory);
+}
+
+// Writes a file such that it either has its previous or the new content
+// after a crash, by writing to a temporary file which replaces it.
+// With a durability other than none, the file and its directory
+// are flushed, so the new content is on disk once this returns.
+inline void write_file_atomically(std::filesystem::path const& path,
+    std::string const& content, durability mode)
+{
+    auto temp = path.parent_path() / ("." + unique_name());
+    try {
+        write_file(temp, content);
+        if (mode != durability::none) {
+            sync_file(temp);
+        }
+        std::filesystem::rename(temp, path);
+    }
+    catch (...) {
+        std::error_code ec;
+        std::filesystem::remove(temp, ec);
+        throw;
+    }
+    if (mode != durability::none) {
+        sync_directory(path.parent_path());
+    }
+}
+
+} // namespace ungive::update::internal
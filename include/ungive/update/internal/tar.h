@@ -0,0 +1,277 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ungive/update/internal/archive.h"
+#include "ungive/update/internal/batch_writer.h"
+#include "ungive/update/internal/resources.h"
+#include "ungive/update/internal/stream.h"
+
+namespace ungive::update::internal
+{
+
+constexpr std::size_t tar_block_size = 512;
+
+// Parses a numeric field of a tar header, which is either octal
+// or, for large values, big-endian binary with the high bit set.
+inline uint64_t parse_tar_number(char const* field, std::size_t size)
+{
+    auto bytes = reinterpret_cast<unsigned char const*>(field);
+    if (size > 0 && (bytes[0] & 0x80)) {
+        uint64_t result = bytes[0] & 0x7f;
+        for (std::size_t i = 1; i < size; i++) {
+            result = (result << 8) | bytes[i];
+        }
+        return result;
+    }
+    uint64_t result = 0;
+    for (std::size_t i = 0; i < size; i++) {
+        if (field[i] == ' ' && result == 0) {
+            continue;
+        }
+        if (field[i] < '0' || field[i] > '7') {
+            break;
+        }
+        result = (result << 3) | static_cast<uint64_t>(field[i] - '0');
+    }
+    return result;
+}
+
+// Reads a null-terminated string from a fixed-size tar header field.
+inline std::string parse_tar_string(char const* field, std::size_t size)
+{
+    return std::string(field, strnlen(field, size));
+}
+
+// Reads the value of a record from a pax extended header.
+inline std::optional<std::string> parse_pax_record(
+    std::string const& records, std::string const& key)
+{
+    std::optional<std::string> result;
+    std::size_t i = 0;
+    while (i < records.size()) {
+        auto space = records.find(' ', i);
+        if (space == std::string::npos) {
+            break;
+        }
+        auto length = std::stoull(records.substr(i, space - i));
+        if (length == 0 || i + length > records.size()) {
+            break;
+        }
+        auto record = records.substr(space + 1, i + length - space - 2);
+        if (record.rfind(key + "=", 0) == 0) {
+            result = record.substr(key.size() + 1);
+        }
+        i += length;
+    }
+    return result;
+}
+
+// Reads the path from the records of a pax extended header.
+inline std::optional<std::string> parse_pax_path(std::string const& records)
+{
+    return parse_pax_record(records, "path");
+}
+
+// Returns the location a symbolic link archive entry points to,
+// relative to the root of the archive. Throws if that is outside of it.
+inline std::filesystem::path tar_link_location(
+    std::string const& name, std::string const& target)
+{
+    auto link = std::filesystem::u8path(target);
+    auto location = (std::filesystem::u8path(name).parent_path() / link)
+                        .lexically_normal();
+    if (link.is_absolute() || link.has_root_name() ||
+        !is_contained_path(location.u8string())) {
+        throw std::runtime_error("invalid link in archive: " + name);
+    }
+    return location;
+}
+
+// Creates symbolic links once all other entries have been extracted,
+// so that no entry can be written through a link to outside the directory.
+// Links whose parent path already contains a link are rejected as well.
+inline void tar_create_links(std::filesystem::path const& target_directory,
+    std::vector<std::pair<std::string, std::string>> const& links)
+{
+#ifndef WIN32
+    namespace fs = std::filesystem;
+    for (auto const& [name, target] : links) {
+        auto path = archive_entry_path(target_directory, name);
+        auto parent = target_directory;
+        for (auto const& part : fs::u8path(name).parent_path()) {
+            parent /= part;
+            if (fs::is_symlink(parent)) {
+                throw std::runtime_error("invalid link in archive: " + name);
+            }
+        }
+        fs::create_directories(path.parent_path());
+        fs::create_symlink(fs::u8path(target), path);
+    }
+#else
+    // Creating links requires special privileges on Windows.
+    (void)target_directory;
+    (void)links;
+#endif
+}
+
+// Writes a file of the given size with data from the source.
+inline void tar_write_file(stream_reader& source,
+    std::filesystem::path const& path, uint64_t size, uint32_t mode,
+    std::vector<char>& buffer)
+{
+    auto out = create_archive_file(path);
+    auto remaining = size;
+    while (remaining > 0) {
+        auto n = static_cast<std::size_t>(
+            std::min<uint64_t>(remaining, buffer.size()));
+        source.read_exact(buffer.data(), n);
+        out.write(buffer.data(), n);
+        if (out.fail()) {
+            throw std::runtime_error(
+                "failed to write extracted file: " + path.string());
+        }
+        remaining -= n;
+    }
+    out.close();
+#ifndef WIN32
+    if (mode != 0) {
+        std::filesystem::permissions(
+            path, static_cast<std::filesystem::perms>(mode));
+    }
+#else
+    (void)mode;
+#endif
+}
+
+// Extracts a tar archive while it is being read.
+// Regular files, directories and symbolic links are extracted,
+// long names in GNU and pax format are supported. Other entries are skipped.
+// Unix permissions of files are preserved on platforms other than Windows.
+// Extracted entries and bytes are accounted for in the budget, if set.
+inline void tar_extract(stream_reader& source,
+    std::filesystem::path const& target_directory,
+    extraction_budget* budget = nullptr)
+{
+    std::vector<char> buffer(256 * 1024);
+    // Small files are written in batches while the archive is read.
+    batch_writer writer;
+    std::optional<std::string> long_name;
+    std::optional<std::string> long_link;
+    std::vector<std::pair<std::string, std::string>> links;
+    char header[tar_block_size];
+    while (true) {
+        if (source.read(header, 1) == 0) {
+            break;
+        }
+        source.read_exact(header + 1, tar_block_size - 1);
+        if (std::all_of(header, header + tar_block_size, [](char c) {
+                return c == 0;
+            })) {
+            // The archive ends with two zero blocks.
+            break;
+        }
+        uint64_t checksum = 0;
+        for (std::size_t i = 0; i < tar_block_size; i++) {
+            checksum += (i >= 148 && i < 156)
+                ? ' '
+                : static_cast<unsigned char>(header[i]);
+        }
+        if (checksum != parse_tar_number(header + 148, 8)) {
+            throw std::runtime_error("invalid tar header checksum");
+        }
+        auto size = parse_tar_number(header + 124, 12);
+        auto padding = (tar_block_size - size % tar_block_size) %
+            tar_block_size;
+        auto type = header[156];
+        auto name = parse_tar_string(header, 100);
+        if (std::memcmp(header + 257, "ustar", 5) == 0) {
+            auto prefix = parse_tar_string(header + 345, 155);
+            if (!prefix.empty()) {
+                name = prefix + "/" + name;
+            }
+        }
+        auto link = parse_tar_string(header + 157, 100);
+        if (type == 'L' || type == 'K' || type == 'x') {
+            // The name or extended header of the next entry.
+            if (size > buffer.size()) {
+                throw std::runtime_error("tar extended header is too large");
+            }
+            std::string data(size, '\0');
+            source.read_exact(data.data(), data.size());
+            source.skip(padding);
+            if (type == 'L') {
+                long_name = parse_tar_string(data.data(), data.size());
+            } else if (type == 'K') {
+                long_link = parse_tar_string(data.data(), data.size());
+            } else {
+                // Records that are missing keep an earlier long name.
+                if (auto path = parse_pax_path(data)) {
+                    long_name = path;
+                }
+                if (auto path = parse_pax_record(data, "linkpath")) {
+                    long_link = path;
+                }
+            }
+            continue;
+        }
+        // Extension headers may follow each other, e.g. a long link
+        // and a long name, and all of them apply to the next entry.
+        if (long_name.has_value()) {
+            name = long_name.value();
+            long_name.reset();
+        }
+        if (long_link.has_value()) {
+            link = long_link.value();
+            long_link.reset();
+        }
+        if (budget != nullptr &&
+            (type == '5' || type == '0' || type == '\0' || type == '7' ||
+                type == '2')) {
+            budget->add_entry();
+        }
+        if (type == '5') {
+            std::filesystem::create_directories(
+                archive_entry_path(target_directory, name));
+        } else if (type == '0' || type == '\0' || type == '7') {
+            auto path = archive_entry_path(target_directory, name);
+            if (budget != nullptr) {
+                budget->add_bytes(size);
+            }
+            uint32_t mode = 0;
+#ifndef WIN32
+            mode = static_cast<uint32_t>(parse_tar_number(header + 100, 8)) &
+                0777;
+#endif
+            if (size <= batch_writer::max_file_size) {
+                std::string content(static_cast<std::size_t>(size), '\0');
+                source.read_exact(content.data(), content.size());
+                writer.add(path, std::move(content), mode);
+            } else {
+                if (writer.contains(path)) {
+                    // An earlier entry with the same name must not
+                    // overwrite this one once its batch is written.
+                    writer.finish();
+                }
+                tar_write_file(source, path, size, mode, buffer);
+            }
+            size = 0;
+        } else if (type == '2') {
+            archive_entry_path(target_directory, name);
+            tar_link_location(name, link);
+            links.emplace_back(name, link);
+        }
+        source.skip(size + padding);
+    }
+    writer.finish();
+    tar_create_links(target_directory, links);
+}
+
+} // namespace ungive::update::internal
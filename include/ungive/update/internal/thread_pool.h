@@ -0,0 +1,241 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ungive::update::internal
+{
+
+// A fixed-size pool of worker threads which executes posted tasks.
+class thread_pool
+{
+public:
+    // Creates a pool with the given number of worker threads.
+    thread_pool(std::size_t threads = default_concurrency())
+    {
+        threads = std::max<std::size_t>(threads, 1);
+        m_workers.reserve(threads);
+        for (std::size_t i = 0; i < threads; i++) {
+            m_workers.emplace_back([this] {
+                run();
+            });
+        }
+    }
+
+    // Waits for all queued tasks to finish and joins all worker threads.
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopped = true;
+        }
+        m_condition.notify_all();
+        for (auto& worker : m_workers) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+    }
+
+    thread_pool(thread_pool const&) = delete;
+    thread_pool& operator=(thread_pool const&) = delete;
+
+    // Returns the pool that is shared by all update operations.
+    static thread_pool& shared()
+    {
+        static thread_pool pool;
+        return pool;
+    }
+
+    // Returns the number of threads that can run concurrently on this system.
+    static std::size_t default_concurrency()
+    {
+        auto n = std::thread::hardware_concurrency();
+        return n > 0 ? n : 4;
+    }
+
+    // Returns the number of worker threads.
+    inline std::size_t size() const { return m_workers.size(); }
+
+    // Queues a task for execution on one of the worker threads.
+    // The task must not throw, any exception is swallowed.
+    void post(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.push_back(std::move(task));
+        }
+        m_condition.notify_one();
+    }
+
+private:
+    void run()
+    {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condition.wait(lock, [this] {
+                    return m_stopped || !m_tasks.empty();
+                });
+                if (m_tasks.empty()) {
+                    return;
+                }
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            try {
+                task();
+            }
+            catch (...) {
+            }
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<std::function<void()>> m_tasks{};
+    std::vector<std::thread> m_workers{};
+    bool m_stopped{ false };
+};
+
+// Runs a batch of independent tasks concurrently on a thread pool.
+//
+// The calling thread takes part in executing the tasks,
+// so a task group may safely be used from within another pool task.
+// Each task receives a cancellation flag which it should check regularly
+// when it is long-running. The first task that throws an exception
+// sets that flag, tasks that have not started yet are skipped,
+// and the exception is rethrown by run() once all started tasks returned.
+class task_group
+{
+public:
+    using task = std::function<void(std::atomic<bool> const& cancelled)>;
+    using batch_task = std::function<void(std::size_t begin,
+        std::size_t end, std::atomic<bool> const& cancelled)>;
+
+    task_group(thread_pool& pool = thread_pool::shared())
+        : m_pool{ pool }, m_state{ std::make_shared<state>() }
+    {
+    }
+
+    // Adds a task to the group. Tasks are only started by run().
+    void add(task task) { m_state->tasks.push_back(std::move(task)); }
+
+    // Adds tasks which each handle a batch of consecutive items,
+    // those in [begin, end) of the given count, since batches keep
+    // per-task overhead low for many small items. A batch has at most
+    // max_items items and ends early once the weight of its items,
+    // if a weight function is given, reaches max_weight.
+    void add_batches(std::size_t count, std::size_t max_items,
+        batch_task batch,
+        std::function<uint64_t(std::size_t)> const& weight = nullptr,
+        uint64_t max_weight = 0)
+    {
+        max_items = std::max<std::size_t>(max_items, 1);
+        for (std::size_t begin = 0; begin < count;) {
+            auto end = begin;
+            uint64_t total = 0;
+            while (end < count && end - begin < max_items &&
+                (!weight || total < max_weight)) {
+                if (weight) {
+                    total += weight(end);
+                }
+                end++;
+            }
+            add([batch, begin, end](std::atomic<bool> const& cancelled) {
+                batch(begin, end, cancelled);
+            });
+            begin = end;
+        }
+    }
+
+    // Returns the number of tasks that were added.
+    inline std::size_t size() const { return m_state->tasks.size(); }
+
+    // Executes all added tasks and blocks until they have finished.
+    // Rethrows the exception of the first task that failed.
+    // The group is empty afterwards and may be reused.
+    void run()
+    {
+        auto current = std::move(m_state);
+        m_state = std::make_shared<state>();
+        auto n = current->tasks.size();
+        if (n == 0) {
+            return;
+        }
+        auto helpers = std::min(n - 1, m_pool.size());
+        for (std::size_t i = 0; i < helpers; i++) {
+            m_pool.post([current] {
+                current->work();
+            });
+        }
+        current->work();
+        current->wait();
+        if (current->error) {
+            std::rethrow_exception(current->error);
+        }
+    }
+
+private:
+    struct state
+    {
+        std::vector<task> tasks{};
+        std::atomic<std::size_t> next{ 0 };
+        std::atomic<bool> cancelled{ false };
+        std::mutex mutex;
+        std::condition_variable done;
+        std::size_t finished{ 0 };
+        std::exception_ptr error{};
+
+        void work()
+        {
+            while (true) {
+                auto i = next.fetch_add(1);
+                if (i >= tasks.size()) {
+                    return;
+                }
+                std::exception_ptr failure{};
+                if (!cancelled.load()) {
+                    try {
+                        tasks[i](cancelled);
+                    }
+                    catch (...) {
+                        failure = std::current_exception();
+                    }
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                if (failure && !error) {
+                    error = failure;
+                    cancelled.store(true);
+                }
+                if (++finished == tasks.size()) {
+                    done.notify_all();
+                }
+            }
+        }
+
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this] {
+                return finished == tasks.size();
+            });
+        }
+    };
+
+    thread_pool& m_pool;
+    std::shared_ptr<state> m_state;
+};
+
+} // namespace ungive::update::internal
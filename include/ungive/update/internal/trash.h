@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+#include "ungive/update/internal/staging.h"
+#include "ungive/update/internal/thread_pool.h"
+
+namespace ungive::update::internal
+{
+
+// Lowers the CPU and, where supported, the I/O priority
+// of the calling thread, so that it yields to other work.
+inline void lower_thread_priority() noexcept
+{
+    thread_local bool lowered = false;
+    if (lowered) {
+        return;
+    }
+    lowered = true;
+#if defined(WIN32)
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#elif defined(__linux__)
+    // Priorities are per thread on Linux.
+    auto tid = static_cast<id_t>(::syscall(SYS_gettid));
+    ::setpriority(PRIO_PROCESS, tid, 19);
+#ifdef SYS_ioprio_set
+    constexpr int ioprio_who_process = 1;
+    constexpr int ioprio_class_idle = 3;
+    ::syscall(SYS_ioprio_set, ioprio_who_process, tid, ioprio_class_idle << 13);
+#endif
+#elif defined(__APPLE__)
+    ::setpriority(PRIO_DARWIN_THREAD, 0, PRIO_DARWIN_BG);
+#endif
+}
+
+// A directory into which files and directories are moved to delete them
+// later, since a rename takes constant time, while deleting takes time
+// proportional to the size of a tree. The trash is emptied on a background
+// thread with low priority. Anything that is left when the process exits
+// is deleted the next time the trash is emptied.
+// The trash must be on the same volume as the paths that are moved into it.
+class trash
+{
+public:
+    explicit trash(std::filesystem::path root)
+        : m_root{ std::move(root) }, m_state{ std::make_shared<state>() }
+    {
+    }
+
+    // Stops emptying the trash in the background, without waiting
+    // for the remaining content to be deleted.
+    ~trash() { stop(); }
+
+    trash(trash const&) = delete;
+    trash& operator=(trash const&) = delete;
+
+    // Takes over the trash and any background worker of the other trash,
+    // which may only be destructed or assigned to afterwards.
+    trash(trash&& other) noexcept = default;
+
+    // Stops emptying this trash first, like the destructor.
+    trash& operator=(trash&& other)
+    {
+        if (this != &other) {
+            stop();
+            m_root = std::move(other.m_root);
+            m_state = std::move(other.m_state);
+            m_worker = std::move(other.m_worker);
+        }
+        return *this;
+    }
+
+    // Returns the directory in which trashed paths are kept.
+    std::filesystem::path const& root() const { return m_root; }
+
+    // Moves a file or directory into the trash and returns its new path.
+    // If it cannot be moved, e.g. because it is on another volume,
+    // it is deleted immediately and an empty path is returned.
+    // May throw an exception if it could neither be moved nor deleted.
+    std::filesystem::path move(std::filesystem::path const& path) const
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(m_root, ec);
+        auto target = m_root / unique_name();
+        std::filesystem::rename(path, target, ec);
+        if (!ec) {
+            return target;
+        }
+        std::filesystem::remove_all(path);
+        return {};
+    }
+
+    // Deletes the content of the trash, concurrently on the thread pool.
+    // Anything that cannot be deleted, e.g. because it is in use,
+    // is kept for a later attempt. Returns the number of trashed paths
+    // that were deleted. Does not throw.
+    std::size_t empty(thread_pool& pool = thread_pool::shared()) const noexcept
+    {
+        std::atomic<bool> stopped{ false };
+        return empty(m_root, pool, stopped, false);
+    }
+
+    // Empties the trash on a background thread with low priority,
+    // which deletes in parallel on a separate pool of threads.
+    // If anything was deleted and the trash is empty afterwards,
+    // the given function is called on that thread.
+    // If the trash is already being emptied, it is emptied once more.
+    void empty_in_background(std::function<void()> emptied = {})
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        m_state->emptied = std::move(emptied);
+        m_state->requested = true;
+        if (m_state->running) {
+            return;
+        }
+        if (m_worker.joinable()) {
+            m_worker.join();
+        }
+        m_state->running = true;
+        m_worker = std::thread([root = m_root, state = m_state] {
+            lower_thread_priority();
+            thread_pool pool(
+                std::min<std::size_t>(thread_pool::default_concurrency(), 4));
+            while (true) {
+                std::function<void()> emptied;
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    if (!state->requested || state->stopped.load()) {
+                        state->running = false;
+                        return;
+                    }
+                    state->requested = false;
+                    emptied = state->emptied;
+                }
+                std::error_code ec;
+                if (empty(root, pool, state->stopped, true) > 0 &&
+                    std::filesystem::is_empty(root, ec) && emptied &&
+                    !state->stopped.load()) {
+                    try {
+                        emptied();
+                    }
+                    catch (...) {
+                    }
+                }
+            }
+        });
+    }
+
+    // Waits until the trash was emptied in the background.
+    void wait()
+    {
+        if (m_worker.joinable()) {
+            m_worker.join();
+        }
+    }
+
+    // Stops emptying the trash in the background
+    // once the files that are currently being deleted are gone.
+    void stop()
+    {
+        if (!m_state) {
+            // Moved from.
+            return;
+        }
+        m_state->stopped.store(true);
+        wait();
+        m_state->stopped.store(false);
+    }
+
+private:
+    struct state
+    {
+        std::mutex mutex;
+        bool requested{ false };
+        bool running{ false };
+        std::atomic<bool> stopped{ false };
+        std::function<void()> emptied{};
+    };
+
+    // Threads that take part in deleting lower their priority,
+    // if it is low priority, which must only be used with a separate pool.
+    static std::size_t empty(std::filesystem::path const& root,
+        thread_pool& pool, std::atomic<bool> const& stopped,
+        bool low_priority) noexcept
+    {
+        std::atomic<std::size_t> removed{ 0 };
+        try {
+            task_group group(pool);
+            std::error_code ec;
+            for (auto const& entry :
+                std::filesystem::directory_iterator(root, ec)) {
+                group.add([&, path = entry.path()](std::atomic<bool> const&) {
+                    if (remove_tree(path, pool, stopped, low_priority)) {
+                        removed++;
+                    }
+                });
+            }
+            group.run();
+        }
+        catch (...) {
+        }
+        return removed.load();
+    }
+
+    // Removes a tree, whose subdirectories are removed concurrently.
+    // Returns whether it was removed entirely.
+    static bool remove_tree(std::filesystem::path const& path,
+        thread_pool& pool, std::atomic<bool> const& stopped, bool low_priority)
+    {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        if (stopped.load()) {
+            return false;
+        }
+        if (low_priority) {
+            lower_thread_priority();
+        }
+        auto status = fs::symlink_status(path, ec);
+        if (fs::is_directory(status)) {
+            std::vector<fs::path> files;
+            task_group group(pool);
+            for (auto const& entry : fs::directory_iterator(path, ec)) {
+                if (entry.is_directory(ec) && !entry.is_symlink(ec)) {
+                    group.add([&, path = entry.path()](
+                                  std::atomic<bool> const&) {
+                        remove_tree(path, pool, stopped, low_priority);
+                    });
+                } else {
+                    files.push_back(entry.path());
+                }
+            }
+            group.add_batches(files.size(), 64,
+                [&](std::size_t begin, std::size_t end,
+                    std::atomic<bool> const&) {
+                    if (low_priority) {
+                        lower_thread_priority();
+                    }
+                    for (auto i = begin; i < end && !stopped.load(); i++) {
+                        std::error_code ec;
+                        fs::remove(files[i], ec);
+                    }
+                });
+            group.run();
+        }
+        return fs::remove(path, ec) && !ec;
+    }
+
+    std::filesystem::path m_root;
+    std::shared_ptr<state> m_state;
+    std::thread m_worker{};
+};
+
+} // namespace ungive::update::internal
@@ -12,6 +12,14 @@
 namespace ungive::update::internal
 {
 
+// Returns a random number generator for the calling thread,
+// which is seeded once when it is first used.
+inline std::mt19937_64& random_generator()
+{
+    thread_local std::mt19937_64 generator{ std::random_device{}() };
+    return generator;
+}
+
 // Creates a uniquely-named, temporary directory.
 inline std::filesystem::path create_temporary_directory(
     unsigned long long max_tries = 256)
@@ -19,8 +27,7 @@ inline std::filesystem::path create_temporary_directory(
     // Source: https://stackoverflow.com/a/58454949/6748004
     auto tmp_dir = std::filesystem::temp_directory_path();
     unsigned long long i = 0;
-    std::random_device dev;
-    std::mt19937 prng(dev());
+    auto& prng = random_generator();
     std::uniform_int_distribution<uint64_t> rand(0);
     std::filesystem::path path;
     while (true) {
@@ -30,7 +37,7 @@ inline std::filesystem::path create_temporary_directory(
 #ifdef LIBUPDATE_TEST_BUILD
         // Test the implementation with characters
         // that are represented differently on Windows with UTF-16.
-        name += std::filesystem::path{ L"_\u00E9" };
+        name += std::filesystem::u8path(u8"_\u00E9");
 #endif
         path = tmp_dir / name;
         if (std::filesystem::create_directory(path)) {
@@ -87,8 +94,7 @@ inline std::string random_string(std::size_t length)
 {
     static const std::string alphabet =
         "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
-    std::random_device dev;
-    std::mt19937 generator(dev());
+    auto& generator = random_generator();
     std::uniform_int_distribution<> distribution(
         0, static_cast<int>(alphabet.size()) - 1);
     std::string str(length, ' ');
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "ungive/update/detail/types.h"
+#include "ungive/update/internal/util.h"
+
+#define VERIFICATION_RECORD_EXTENSION ".verified"
+
+namespace ungive::update::internal
+{
+
+// Identifies a file's contents without reading it.
+// If the stat of a file is unchanged, its contents are assumed unchanged.
+struct file_stat
+{
+    uint64_t size{ 0 };
+    int64_t mtime{ 0 };
+    uint64_t inode{ 0 };
+
+    inline bool operator==(file_stat const& other) const
+    {
+        return size == other.size && mtime == other.mtime &&
+            inode == other.inode;
+    }
+
+    inline bool operator!=(file_stat const& other) const
+    {
+        return !(*this == other);
+    }
+
+    // Returns the stat of a file or nothing if it could not be determined.
+    static std::optional<file_stat> of(std::filesystem::path const& path)
+    {
+        std::error_code ec;
+        file_stat result;
+        result.size = std::filesystem::file_size(path, ec);
+        if (ec) {
+            return std::nullopt;
+        }
+        auto mtime = std::filesystem::last_write_time(path, ec);
+        if (ec) {
+            return std::nullopt;
+        }
+        result.mtime = mtime.time_since_epoch().count();
+#ifdef WIN32
+        HANDLE handle = CreateFileW(path.wstring().c_str(), 0,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (handle == INVALID_HANDLE_VALUE) {
+            return std::nullopt;
+        }
+        BY_HANDLE_FILE_INFORMATION info;
+        auto ok = GetFileInformationByHandle(handle, &info);
+        CloseHandle(handle);
+        if (!ok) {
+            return std::nullopt;
+        }
+        result.inode = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) |
+            info.nFileIndexLow;
+#else
+        struct stat st;
+        if (::stat(path.c_str(), &st) != 0) {
+            return std::nullopt;
+        }
+        result.inode = static_cast<uint64_t>(st.st_ino);
+#endif
+        return result;
+    }
+};
+
+// The outcome of a successful verification of a file.
+struct verification_info
+{
+    // The size of the verified file.
+    uint64_t size{ 0 };
+    // Digests of the file by algorithm, as computed by the verifiers.
+    std::map<std::string, std::string> digests{};
+    // Identities of the verifiers which accepted the file.
+    std::vector<std::string> verifiers{};
+};
+
+// A record of the verification of a file, which is stored next to the file
+// with an additional ".verified" extension. Digests in the record are valid
+// for as long as the file's size, modification time and inode match.
+class verification_record
+{
+public:
+    verification_record(std::filesystem::path const& file)
+        : m_location{ location(file) }
+    {
+    }
+
+    // Returns the location of the record for a file.
+    static std::filesystem::path location(std::filesystem::path const& file)
+    {
+        auto result = file;
+        result += VERIFICATION_RECORD_EXTENSION;
+        return result;
+    }
+
+    // Attempts to read the record. Returns if successful, does not throw.
+    bool read()
+    {
+        if (!std::filesystem::exists(m_location)) {
+            return false;
+        }
+        try {
+            decode(internal::read_file(m_location));
+            return true;
+        }
+        catch (...) {
+            return false;
+        }
+    }
+
+    // Writes the record, may throw an exception.
+    void write() const
+    {
+        if (!m_stat.has_value()) {
+            throw std::runtime_error("missing file stat information");
+        }
+        internal::write_file(m_location, encode());
+    }
+
+    // Removes the record, does not throw.
+    void remove() const
+    {
+        std::error_code ec;
+        std::filesystem::remove(m_location, ec);
+    }
+
+    // Whether the record applies to a file with the given stat.
+    inline bool matches(std::optional<file_stat> const& stat) const
+    {
+        return m_stat.has_value() && stat.has_value() && *m_stat == *stat;
+    }
+
+    inline std::optional<file_stat> const& stat() const { return m_stat; }
+
+    inline void stat(file_stat const& stat)
+    {
+        m_stat = stat;
+        m_info.size = stat.size;
+    }
+
+    inline verification_info const& info() const { return m_info; }
+
+    inline void digest(std::string const& algorithm, std::string const& digest)
+    {
+        m_info.digests[algorithm] = digest;
+    }
+
+    inline void verifiers(std::vector<std::string> const& verifiers)
+    {
+        m_info.verifiers = verifiers;
+    }
+
+private:
+    std::string encode() const
+    {
+        std::ostringstream oss;
+        oss << "size=" << m_stat->size << "\n";
+        oss << "mtime=" << m_stat->mtime << "\n";
+        oss << "inode=" << m_stat->inode << "\n";
+        for (auto const& [algorithm, digest] : m_info.digests) {
+            oss << "digest=" << algorithm << ":" << digest << "\n";
+        }
+        for (auto const& verifier : m_info.verifiers) {
+            oss << "verifier=" << verifier << "\n";
+        }
+        return oss.str();
+    }
+
+    void decode(std::string const& content)
+    {
+        std::optional<uint64_t> size;
+        std::optional<int64_t> mtime;
+        std::optional<uint64_t> inode;
+        verification_info info;
+
+        std::istringstream iss(content);
+        for (std::string line; std::getline(iss, line);) {
+            auto index = line.find_first_of('=');
+            if (index == std::string::npos) {
+                continue;
+            }
+            auto key = line.substr(0, index);
+            auto value = line.substr(index + 1);
+            if (key == "size") {
+                size = std::stoull(value);
+            } else if (key == "mtime") {
+                mtime = std::stoll(value);
+            } else if (key == "inode") {
+                inode = std::stoull(value);
+            } else if (key == "digest") {
+                auto separator = value.find_first_of(':');
+                if (separator == std::string::npos) {
+                    throw std::runtime_error("digest without algorithm");
+                }
+                info.digests[value.substr(0, separator)] =
+                    value.substr(separator + 1);
+            } else if (key == "verifier") {
+                info.verifiers.push_back(value);
+            }
+        }
+        if (!size.has_value() || !mtime.has_value() || !inode.has_value()) {
+            throw std::runtime_error("missing fields in verification record");
+        }
+
+        // All decoded correctly, update fields.
+        m_stat = file_stat{ size.value(), mtime.value(), inode.value() };
+        info.size = size.value();
+        m_info = info;
+    }
+
+    std::filesystem::path m_location;
+
+    std::optional<file_stat> m_stat{};
+    verification_info m_info{};
+};
+
+// A digest cache which is backed by the verification records of files.
+// Digests are only taken from a record if the file's stat still matches.
+// This class is thread-safe, so it can be shared by concurrent verifiers.
+class record_digest_cache : public update::types::digest_cache
+{
+public:
+    // If reuse is false, digests are always computed again,
+    // but they are still recorded once commit() is called.
+    record_digest_cache(bool reuse = true) : m_reuse{ reuse } {}
+
+    std::string get(std::filesystem::path const& file,
+        std::string const& algorithm,
+        std::function<std::string()> const& compute) override
+    {
+        auto stat = file_stat::of(file);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto& entry = this->entry(file);
+            if (m_reuse && entry.matches(stat)) {
+                auto it = entry.info().digests.find(algorithm);
+                if (it != entry.info().digests.end()) {
+                    return it->second;
+                }
+            }
+        }
+        auto digest = compute();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& entry = this->entry(file);
+        if (!entry.matches(stat)) {
+            entry = verification_record(file);
+            if (stat.has_value()) {
+                entry.stat(stat.value());
+            }
+        }
+        entry.digest(algorithm, digest);
+        return digest;
+    }
+
+    // Records that a file passed the given verifiers, together with
+    // all digests that were computed for it, and returns the record.
+    // Must only be called once verification succeeded.
+    verification_record commit(std::filesystem::path const& file,
+        std::vector<std::string> const& verifiers)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto stat = file_stat::of(file);
+        auto& entry = this->entry(file);
+        if (!entry.matches(stat)) {
+            entry = verification_record(file);
+        }
+        if (!stat.has_value()) {
+            throw std::runtime_error(
+                "failed to determine stat of " + file.string());
+        }
+        entry.stat(stat.value());
+        entry.verifiers(verifiers);
+        entry.write();
+        return entry;
+    }
+
+private:
+    verification_record& entry(std::filesystem::path const& file)
+    {
+        auto key = file.string();
+        auto it = m_records.find(key);
+        if (it == m_records.end()) {
+            verification_record record(file);
+            record.read();
+            it = m_records.emplace(key, record).first;
+        }
+        return it->second;
+    }
+
+    bool m_reuse;
+    std::mutex m_mutex;
+    std::map<std::string, verification_record> m_records{};
+};
+
+// A digest cache for a file which was hashed while it was streamed
+// and which is not stored on disk, so its digests cannot be computed.
+// Digests of all other files are computed as usual.
+class stream_digest_cache : public update::types::digest_cache
+{
+public:
+    stream_digest_cache(
+        std::filesystem::path const& file, verification_info const& info)
+        : m_file{ file }, m_info{ info }
+    {
+    }
+
+    std::string get(std::filesystem::path const& file,
+        std::string const& algorithm,
+        std::function<std::string()> const& compute) override
+    {
+        if (file != m_file) {
+            return compute();
+        }
+        auto it = m_info.digests.find(algorithm);
+        if (it == m_info.digests.end()) {
+            throw std::runtime_error(
+                "no " + algorithm + " digest for streamed file");
+        }
+        return it->second;
+    }
+
+private:
+    std::filesystem::path m_file;
+    verification_info m_info;
+};
+
+} // namespace ungive::update::internal
+
+#undef VERIFICATION_RECORD_EXTENSION
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <algorithm>
+#include <filesystem>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ungive/update/detail/common.h"
+#include "ungive/update/internal/sentinel.h"
+#include "ungive/update/internal/sync.h"
+#include "ungive/update/internal/util.h"
+
+namespace ungive::update::internal
+{
+
+// A persisted list of the versions that are installed in a directory,
+// which spares scanning the directory and reading every sentinel
+// each time the installed versions are needed.
+// The index records the modification time of the directory it describes
+// and is only valid while that time is unchanged, as adding, removing
+// or renaming a version directory changes it. The index file must be
+// in a subdirectory, so that writing it does not invalidate it.
+// Must only be used while the update lock is held.
+class version_index
+{
+public:
+    struct entry
+    {
+        version_number version;
+        // The name of the version's directory.
+        std::string directory;
+    };
+
+    using entries = std::vector<entry>;
+
+    version_index(std::filesystem::path directory, std::filesystem::path file)
+        : m_directory{ std::move(directory) }, m_file{ std::move(file) }
+    {
+    }
+
+    // Returns the path of the index file.
+    std::filesystem::path const& file() const { return m_file; }
+
+    // Returns the recorded versions, if the index exists and the directory
+    // was not modified since it was written. Does not throw.
+    std::optional<entries> read() const
+    {
+        try {
+            std::istringstream content(internal::read_file(m_file));
+            std::string line;
+            if (!std::getline(content, line) ||
+                line != "modified=" + directory_stamp()) {
+                return std::nullopt;
+            }
+            entries result;
+            while (std::getline(content, line)) {
+                auto index = line.find_first_of('=');
+                if (index == std::string::npos ||
+                    line.substr(0, index) != "installed") {
+                    continue;
+                }
+                auto directory = line.substr(index + 1);
+                result.push_back(
+                    { version_number::from_string(directory), directory });
+            }
+            return result;
+        }
+        catch (...) {
+            return std::nullopt;
+        }
+    }
+
+    // Records the versions as the content of the directory.
+    // May throw an exception if the index could not be written.
+    void write(entries const& installed) const
+    {
+        // The directory is modified once when the index is first created,
+        // which must happen before its time is recorded.
+        std::filesystem::create_directories(m_file.parent_path());
+        std::ostringstream content;
+        content << "modified=" << directory_stamp() << "\n";
+        for (auto const& entry : installed) {
+            content << "installed=" << entry.directory << "\n";
+        }
+        internal::write_file_atomically(
+            m_file, content.str(), durability::none);
+    }
+
+    // Returns all directories whose name is a version number
+    // and which contain a sentinel for that version.
+    entries scan() const
+    {
+        entries result;
+        std::filesystem::create_directories(m_directory);
+        for (auto const& entry :
+            std::filesystem::directory_iterator(m_directory)) {
+            if (!entry.is_directory() || !entry.path().has_filename()) {
+                continue;
+            }
+            auto filename = entry.path().filename().string();
+            version_number directory_version;
+            try {
+                directory_version = version_number::from_string(filename);
+            }
+            catch (...) {
+                // The path does not contain a valid version number.
+                continue;
+            }
+            internal::sentinel sentinel(entry.path());
+            if (!sentinel.read()) {
+                // The sentinel does not exist or has an invalid format.
+                continue;
+            }
+            if (directory_version != sentinel.version()) {
+                // The sentinel file contains a different version.
+                continue;
+            }
+            result.push_back({ directory_version, filename });
+        }
+        return result;
+    }
+
+    // Returns the recorded versions or, if the index is missing
+    // or outdated, scans the directory and records what was found.
+    // May throw an exception if the directory could not be scanned.
+    entries load() const
+    {
+        if (auto installed = read()) {
+            return *installed;
+        }
+        auto installed = scan();
+        try_write(installed);
+        return installed;
+    }
+
+    // Records a change to the installed versions. The versions must
+    // have been read before the directory was modified. If they are empty,
+    // because the index was outdated before, the directory is scanned.
+    // Never throws, an index that could not be written is outdated
+    // and replaced the next time the versions are loaded.
+    template <typename F>
+    void update(std::optional<entries> installed, F&& change) const noexcept
+    {
+        try {
+            if (!installed.has_value()) {
+                try_write(scan());
+                return;
+            }
+            change(*installed);
+            try_write(*installed);
+        }
+        catch (...) {
+        }
+    }
+
+    // Removes the entry for the version directory with the given name.
+    static void remove(entries& installed, std::string const& directory)
+    {
+        installed.erase(std::remove_if(installed.begin(), installed.end(),
+                            [&](entry const& entry) {
+                                return entry.directory == directory;
+                            }),
+            installed.end());
+    }
+
+private:
+    void try_write(entries const& installed) const noexcept
+    {
+        try {
+            write(installed);
+        }
+        catch (...) {
+            std::error_code ec;
+            std::filesystem::remove(m_file, ec);
+        }
+    }
+
+    std::string directory_stamp() const
+    {
+        return std::to_string(std::filesystem::last_write_time(m_directory)
+                                  .time_since_epoch()
+                                  .count());
+    }
+
+    std::filesystem::path m_directory;
+    std::filesystem::path m_file;
+};
+
+} // namespace ungive::update::internal
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <stdexcept>
+
+namespace ungive::update::internal::win
+{
+
+// Requests to prepare to exit are not supported on Windows yet,
+// where processes are asked to exit with WM_CLOSE instead.
+class exit_listener
+{
+public:
+    exit_listener(std::filesystem::path const&, std::function<void()>)
+    {
+        throw std::runtime_error(
+            "exit requests are not supported on this platform");
+    }
+
+    exit_listener(exit_listener const&) = delete;
+    exit_listener& operator=(exit_listener const&) = delete;
+};
+
+} // namespace ungive::update::internal::win
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
 #include <optional>
 #include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
 #ifndef NOMINMAX
 #define NOMINMAX
@@ -17,12 +22,12 @@
 #include <Psapi.h>
 // #include <tchar.h>
 
+#include "ungive/update/detail/common.h"
+#include "ungive/update/internal/process_match.h"
 #include "ungive/update/internal/util.h"
 
 #pragma comment(lib, "psapi.lib")
 
-#define CLOSE_WAIT_TIMEOUT_MILLIS 30000
-
 namespace ungive::update::internal::win
 {
 
@@ -90,15 +95,13 @@ inline void start_process_detached(std::filesystem::path const& executable,
     }
 }
 
-inline DWORD WaitForProcessExit(
-    DWORD pid, DWORD timeoutMillis = CLOSE_WAIT_TIMEOUT_MILLIS)
+// Replacing the current process is not supported on Windows,
+// which has no equivalent of execve() that keeps the process.
+[[noreturn]] inline void replace_process(
+    std::filesystem::path const&, std::vector<std::wstring> const& = {})
 {
-    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
-    if (process == NULL)
-        throw_last_error();
-    DWORD ret = WaitForSingleObject(process, timeoutMillis);
-    CloseHandle(process);
-    return ret;
+    throw std::runtime_error(
+        "replacing the process is not supported on this platform");
 }
 
 inline BOOL CALLBACK CloseWindowsProc(HWND hwnd, LPARAM lParam)
@@ -113,38 +116,87 @@ inline BOOL CALLBACK CloseWindowsProc(HWND hwnd, LPARAM lParam)
     return TRUE;
 }
 
-inline DWORD close_pids_and_wait_for_exit(std::vector<DWORD> const& pids)
+// Waits until all processes have exited or the deadline has passed
+// and returns whether they have exited.
+inline bool wait_for_exit(std::vector<winrt::handle> const& processes,
+    std::chrono::steady_clock::time_point deadline)
 {
-    for (auto const& pid : pids) {
-        if (EnumWindows(&CloseWindowsProc, pid) == NULL) {
+    for (auto const& process : processes) {
+        auto remaining = std::max(std::chrono::milliseconds::zero(),
+            std::chrono::ceil<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()));
+        auto code = WaitForSingleObject(
+            process.get(), static_cast<DWORD>(remaining.count()));
+        if (code == WAIT_FAILED) {
             throw_last_error();
         }
+        if (code != WAIT_OBJECT_0) {
+            return false;
+        }
     }
+    return true;
+}
 
-    // Wait for all processes to have exited.
+// Stops the processes according to the shutdown policy:
+// each step asks all processes to exit at once and waits
+// for all of them against a single deadline, so that the time this
+// takes does not grow with the number of processes.
+// Returns whether all processes have exited.
+inline bool stop_pids_and_wait_for_exit(
+    std::vector<DWORD> const& pids, shutdown_policy const& policy)
+{
+    // Open the processes first, so that the handles keep referring
+    // to them, even after they have exited.
+    std::vector<winrt::handle> processes;
+    processes.reserve(pids.size());
     for (auto pid : pids) {
-        auto code = WaitForProcessExit(pid);
-        if (code != WAIT_OBJECT_0) {
-            if (code == WAIT_FAILED) {
+        winrt::handle process{ OpenProcess(
+            SYNCHRONIZE | PROCESS_TERMINATE, FALSE, pid) };
+        if (!process) {
+            // The process has already exited.
+            if (GetLastError() == ERROR_INVALID_PARAMETER) {
+                continue;
+            }
+            throw_last_error();
+        }
+        processes.push_back(std::move(process));
+    }
+    auto polite = policy.polite + policy.terminate;
+    if (polite > std::chrono::milliseconds::zero()) {
+        for (auto pid : pids) {
+            if (EnumWindows(&CloseWindowsProc, pid) == NULL) {
                 throw_last_error();
             }
-            return code;
+        }
+        if (wait_for_exit(
+                processes, std::chrono::steady_clock::now() + polite)) {
+            return true;
         }
     }
-
-    return 0;
+    if (policy.kill > std::chrono::milliseconds::zero()) {
+        for (auto const& process : processes) {
+            TerminateProcess(process.get(), 1);
+        }
+        if (wait_for_exit(
+                processes, std::chrono::steady_clock::now() + policy.kill)) {
+            return true;
+        }
+    }
+    return wait_for_exit(processes, std::chrono::steady_clock::now());
 }
 
-// Returns the PIDs of all process that either:
-// - have their executable in the given directory, if the path is a directory,
-// - or whose executable matches the path, if the path is not a directory.
+// Returns the PIDs of all processes for each of the given paths,
+// in the same order as the paths. A process is listed for a path if:
+// - its executable is in the given directory, if the path is a directory,
+// - or its executable matches the path, if the path is not a directory.
+// The process table is walked once, regardless of the number of paths.
 // If exclude_current_process is set the current process will be excluded.
-static std::vector<DWORD> get_running_pids(
-    std::filesystem::path const& path_or_directory,
+inline std::vector<std::vector<DWORD>> get_running_pids(
+    std::vector<std::filesystem::path> const& paths_or_directories,
     bool exclude_current_process = true)
 {
-    std::vector<DWORD> pids;
-    pids.reserve(16);
+    std::vector<std::vector<DWORD>> pids(paths_or_directories.size());
+    executable_matcher matcher(paths_or_directories);
 
     // Make sure we don't kill this process, just to be absolutely sure.
     DWORD current_pid = GetCurrentProcessId();
@@ -159,97 +211,101 @@ static std::vector<DWORD> get_running_pids(
 
     DWORD count = ps_size / sizeof(DWORD);
     for (size_t i = 0; i < count; i++) {
-        if (processes[i] == 0) {
-            continue;
-        }
-
         DWORD pid = processes[i];
-        HANDLE process_handle = OpenProcess(
-            PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, pid);
-        if (process_handle == NULL) {
+        if (pid == 0) {
             continue;
         }
 
-        HMODULE module_handle;
-        DWORD m_size;
-        if (!EnumProcessModules(process_handle, &module_handle,
-                sizeof(module_handle), &m_size)) {
-            CloseHandle(process_handle);
+        // Exclude the current process.
+        if (exclude_current_process && pid == current_pid) {
             continue;
         }
 
-        TCHAR process_name[MAX_PATH] = {};
-        DWORD pn_size = GetModuleBaseName(process_handle, module_handle,
-            process_name, sizeof(process_name) / sizeof(TCHAR));
-        if (pn_size == 0) {
-            CloseHandle(process_handle);
+        HANDLE process_handle = OpenProcess(
+            PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, pid);
+        if (process_handle == NULL) {
             continue;
         }
 
-        TCHAR filepath[MAX_PATH];
-        DWORD fn_size = GetModuleFileNameEx(
-            process_handle, NULL, filepath, sizeof(filepath) / sizeof(TCHAR));
+        WCHAR filepath[MAX_PATH];
+        DWORD fn_size = GetModuleFileNameExW(process_handle, NULL, filepath,
+            sizeof(filepath) / sizeof(WCHAR));
+        CloseHandle(process_handle);
         if (fn_size == 0) {
-            CloseHandle(process_handle);
-            continue;
-        }
-
-        // Exclude the current process.
-        if (exclude_current_process && pid == current_pid) {
-            CloseHandle(process_handle);
             continue;
         }
 
-        // The path is either a directory and the process's executable
-        // lies in this directory or the path is an executable path.
-        if (std::filesystem::is_directory(path_or_directory)) {
-            if (internal::is_subpath(filepath, path_or_directory)) {
-                pids.push_back(pid);
-            }
-        } else if (path_or_directory == filepath) {
-            pids.push_back(pid);
-        }
-
-        CloseHandle(process_handle);
+        matcher.match(std::filesystem::path(filepath, filepath + fn_size),
+            [&](std::size_t index) { pids[index].push_back(pid); });
     }
 
     return pids;
 }
 
-// Kills any processes whose executables are located in the given directory,
-// if the given path is a directory or whose executable path
-// matches the given path exactly.
+// Returns the PIDs of all process that either:
+// - have their executable in the given directory, if the path is a directory,
+// - or whose executable matches the path, if the path is not a directory.
+// If exclude_current_process is set the current process will be excluded.
+inline std::vector<DWORD> get_running_pids(
+    std::filesystem::path const& path_or_directory,
+    bool exclude_current_process = true)
+{
+    auto pids = get_running_pids(
+        std::vector<std::filesystem::path>{ path_or_directory },
+        exclude_current_process);
+    return std::move(pids.front());
+}
+
+// Kills any processes whose executables are located in one of the
+// given directories or whose executable path matches one of the paths.
+// Paths that do not exist are ignored. The process table is walked once
+// and all processes are stopped together, according to the policy.
+// Processes cannot listen for exit requests on Windows yet,
+// so the exit directory is not used.
 // Waits until all processes have exited.
 // Returns the number of processes that have been killed
 // or throws an exception if an error occured.
-inline size_t kill_processes(std::filesystem::path const& path_or_directory)
+inline size_t kill_processes(
+    std::vector<std::filesystem::path> const& paths_or_directories,
+    shutdown_policy const& policy = {},
+    std::filesystem::path const& exit_directory = {})
 {
-    if (!std::filesystem::exists(path_or_directory)) {
+    std::vector<std::filesystem::path> existing;
+    for (auto const& path : paths_or_directories) {
+        if (std::filesystem::exists(path)) {
+            existing.push_back(path);
+        }
+    }
+    if (existing.empty()) {
         return 0;
     }
+    // A process may be listed for more than one path.
     std::vector<DWORD> pids;
-    DWORD code;
-    try {
-        pids = get_running_pids(path_or_directory);
-        code = close_pids_and_wait_for_exit(pids);
+    for (auto const& matched : get_running_pids(existing)) {
+        pids.insert(pids.end(), matched.begin(), matched.end());
     }
-    catch (winrt::hresult_error const& err) {
-        throw std::runtime_error(winrt::to_string(err.message()) + " (" +
-            std::to_string(err.code()) + ")");
-    }
-    switch (code) {
-    case 0:
-        return pids.size();
-    case WAIT_TIMEOUT:
-        throw std::runtime_error(
-            "failed to close processes: operation timed out (" +
-            std::to_string(code) + ")");
-    default:
+    std::sort(pids.begin(), pids.end());
+    pids.erase(std::unique(pids.begin(), pids.end()), pids.end());
+    if (!stop_pids_and_wait_for_exit(pids, policy)) {
         throw std::runtime_error(
-            "failed to close processes: code " + std::to_string(code));
+            "failed to close processes: operation timed out");
     }
+    return pids.size();
 }
 
-#undef CLOSE_WAIT_TIMEOUT_MILLIS
+// Kills any processes whose executables are located in the given directory,
+// if the given path is a directory or whose executable path
+// matches the given path exactly.
+// Waits until all processes have exited.
+// Returns the number of processes that have been killed
+// or throws an exception if an error occured.
+inline size_t kill_processes(std::filesystem::path const& path_or_directory,
+    shutdown_policy const& policy = {},
+    std::filesystem::path const& exit_directory = {})
+{
+    return kill_processes(
+        std::vector<std::filesystem::path>{ path_or_directory }, policy,
+        exit_directory);
+}
 
 } // namespace ungive::update::internal::win
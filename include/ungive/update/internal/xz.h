@@ -0,0 +1,104 @@
+#pragma once
+
+#ifdef UPDATE_WITH_XZ
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+#include <lzma.h>
+
+#include "ungive/update/internal/stream.h"
+#include "ungive/update/internal/thread_pool.h"
+
+namespace ungive::update::internal
+{
+
+// Decompresses xz data from a stream reader with liblzma.
+// With liblzma 5.4 or newer, blocks are decompressed in parallel
+// on separate threads, if the archive was compressed with multiple
+// threads, e.g. with "xz -T0", which stores the size of each block.
+// Decoding fails if it would need more memory than the given limit.
+class xz_decompressor
+{
+public:
+    static constexpr uint64_t default_memlimit = 256 * 1024 * 1024;
+
+    xz_decompressor(uint64_t memlimit = default_memlimit)
+    {
+#if LZMA_VERSION >= 50040002
+        lzma_mt options{};
+        options.flags = LZMA_CONCATENATED;
+        options.threads = static_cast<uint32_t>(
+            std::min<std::size_t>(thread_pool::default_concurrency(), 16));
+        options.timeout = 0;
+        // Fall back to a single thread rather than using too much memory.
+        options.memlimit_threading =
+            std::min<uint64_t>(lzma_physmem() / 4, memlimit);
+        options.memlimit_stop = memlimit;
+        auto result = lzma_stream_decoder_mt(&m_stream, &options);
+#else
+        auto result =
+            lzma_stream_decoder(&m_stream, memlimit, LZMA_CONCATENATED);
+#endif
+        if (result != LZMA_OK) {
+            throw std::runtime_error("xz: failed to initialize decoder");
+        }
+    }
+
+    ~xz_decompressor() { lzma_end(&m_stream); }
+
+    xz_decompressor(xz_decompressor const&) = delete;
+    xz_decompressor& operator=(xz_decompressor const&) = delete;
+
+    // Decompresses up to size bytes into data and returns how many
+    // were written. Returns 0 once the end of the data has been reached.
+    // Multiple concatenated streams are decompressed as one stream.
+    std::size_t read(stream_reader& source, char* data, std::size_t size)
+    {
+        if (m_finished || size == 0) {
+            return 0;
+        }
+        m_stream.next_out = reinterpret_cast<uint8_t*>(data);
+        m_stream.avail_out = size;
+        while (m_stream.avail_out == size) {
+            auto [buffered, available] = source.peek();
+            m_stream.next_in = reinterpret_cast<uint8_t const*>(buffered);
+            m_stream.avail_in = available;
+            auto result =
+                lzma_code(&m_stream, available == 0 ? LZMA_FINISH : LZMA_RUN);
+            source.consume(available - m_stream.avail_in);
+            if (result == LZMA_STREAM_END) {
+                m_finished = true;
+                break;
+            }
+            if (result == LZMA_MEMLIMIT_ERROR) {
+                throw std::runtime_error("xz: decoder memory limit exceeded");
+            }
+            if (result != LZMA_OK) {
+                throw std::runtime_error("xz: failed to decompress data");
+            }
+        }
+        return size - m_stream.avail_out;
+    }
+
+private:
+    lzma_stream m_stream = LZMA_STREAM_INIT;
+    bool m_finished{ false };
+};
+
+// Returns a byte reader which decompresses xz data from the given source.
+inline byte_reader xz_reader(stream_reader& source,
+    uint64_t memlimit = xz_decompressor::default_memlimit)
+{
+    auto state = std::make_shared<xz_decompressor>(memlimit);
+    return [&source, state](char* data, std::size_t size) -> std::size_t {
+        return state->read(source, data, size);
+    };
+}
+
+} // namespace ungive::update::internal
+
+#endif // UPDATE_WITH_XZ
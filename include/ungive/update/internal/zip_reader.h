@@ -0,0 +1,436 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <filesystem>
+#include <atomic>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <zlib.h>
+
+#include "ungive/update/internal/archive.h"
+#include "ungive/update/internal/mapped_file.h"
+#include "ungive/update/internal/resources.h"
+#include "ungive/update/internal/thread_pool.h"
+#include "ungive/update/internal/zip_stream.h"
+
+namespace ungive::update::internal
+{
+
+constexpr uint32_t zip64_end_signature = 0x06064b50;
+constexpr uint32_t zip64_end_locator_signature = 0x07064b50;
+
+constexpr uint16_t zip_host_unix = 3;
+
+// An entry of the central directory of a ZIP file.
+struct zip_entry
+{
+    // Points into the mapped archive and is only valid during its lifetime.
+    std::string_view name;
+    uint64_t local_header_offset{ 0 };
+    uint64_t compressed_size{ 0 };
+    uint64_t uncompressed_size{ 0 };
+    uint32_t crc{ 0 };
+    uint16_t method{ 0 };
+    uint16_t flags{ 0 };
+    // The file mode if the archive was created on a Unix system, otherwise 0.
+    uint16_t mode{ 0 };
+
+    inline bool is_directory() const
+    {
+        return !name.empty() && name.back() == '/';
+    }
+};
+
+// Reads a ZIP file by mapping it into memory. The central directory
+// is parsed once into a table of entries, which are then decompressed
+// from the mapped file straight into their output files.
+// The mapping is read-only, so entries may be extracted concurrently.
+// Supports stored and deflated entries and ZIP64.
+class zip_reader
+{
+public:
+    zip_reader(std::filesystem::path const& path) : m_file{ path }
+    {
+        read_central_directory();
+    }
+
+    zip_reader(zip_reader const&) = delete;
+    zip_reader& operator=(zip_reader const&) = delete;
+
+    // The entries of the archive in the order of the central directory.
+    inline std::vector<zip_entry> const& entries() const { return m_entries; }
+
+    // The total uncompressed size of all entries, as stated in the index.
+    uint64_t total_size() const
+    {
+        uint64_t total = 0;
+        for (auto const& entry : m_entries) {
+            total += entry.uncompressed_size;
+        }
+        return total;
+    }
+
+    // Omits the directory in which all entries are located, if there is
+    // exactly one, such that its content is extracted into the target
+    // directory itself. This has the same result as extracting the archive
+    // and calling flatten_root_directory(), without moving any files.
+    // Returns whether the entries had such a root directory.
+    bool strip_root_directory()
+    {
+        if (m_entries.empty()) {
+            return false;
+        }
+        auto first = m_entries.front().name;
+        auto slash = first.find('/');
+        if (slash == 0 || slash == std::string_view::npos) {
+            return false;
+        }
+        auto prefix = first.substr(0, slash + 1);
+        for (auto const& entry : m_entries) {
+            if (entry.name.substr(0, prefix.size()) != prefix) {
+                return false;
+            }
+        }
+        m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(),
+                            [&](zip_entry const& entry) {
+                                return entry.name == prefix;
+                            }),
+            m_entries.end());
+        for (auto& entry : m_entries) {
+            entry.name.remove_prefix(prefix.size());
+        }
+        return true;
+    }
+
+    // Extracts a single entry to the target directory.
+    // The buffer is used for decompression and must not be empty.
+    void extract(zip_entry const& entry,
+        std::filesystem::path const& target_directory,
+        std::vector<char>& buffer) const
+    {
+        auto path =
+            archive_entry_path(target_directory, std::string(entry.name));
+        if (entry.is_directory()) {
+            std::filesystem::create_directories(path);
+            return;
+        }
+        if (path.has_parent_path()) {
+            std::filesystem::create_directories(path.parent_path());
+        }
+        write_file(entry, path, buffer);
+    }
+
+    // Extracts all entries to the target directory.
+    // All directories are created first, files are then extracted
+    // concurrently in batches of entries on the given thread pool.
+    // If several entries have the same name, only the last one is
+    // extracted, like when the entries are extracted one after another.
+    // Entries whose names only differ in case are written in order
+    // by the same task, since they are one file on case-insensitive
+    // file systems, where the last of them wins as well.
+    // Throws the first error once all started batches have stopped.
+    void extract_all(std::filesystem::path const& target_directory,
+        thread_pool& pool = thread_pool::shared()) const
+    {
+        using file = std::pair<zip_entry const*, std::filesystem::path>;
+        std::vector<std::filesystem::path> directories;
+        std::vector<std::vector<file>> files;
+        std::unordered_map<std::filesystem::path::string_type, size_t> index;
+        files.reserve(m_entries.size());
+        for (auto const& entry : m_entries) {
+            auto path =
+                archive_entry_path(target_directory, std::string(entry.name));
+            if (entry.is_directory()) {
+                directories.push_back(std::move(path));
+                continue;
+            }
+            if (path.has_parent_path()) {
+                directories.push_back(path.parent_path());
+            }
+            // Concurrent writes to the same file would interleave.
+            auto it = index.find(fold_case(path.native()));
+            if (it == index.end()) {
+                index.emplace(fold_case(path.native()), files.size());
+                files.push_back({ { &entry, std::move(path) } });
+                continue;
+            }
+            auto& group = files[it->second];
+            auto same = std::find_if(group.begin(), group.end(),
+                [&](file const& other) {
+                    return other.second == path;
+                });
+            if (same != group.end()) {
+                group.erase(same);
+            }
+            group.emplace_back(&entry, std::move(path));
+        }
+        std::sort(directories.begin(), directories.end());
+        directories.erase(std::unique(directories.begin(), directories.end()),
+            directories.end());
+        for (auto const& directory : directories) {
+            std::filesystem::create_directories(directory);
+        }
+        task_group group(pool);
+        // Batches are also limited in size, so large entries are spread.
+        group.add_batches(
+            files.size(), zip_batch_entries,
+            [this, &files](size_t begin, size_t end,
+                std::atomic<bool> const& cancelled) {
+                std::vector<char> buffer(256 * 1024);
+                for (auto i = begin; i < end && !cancelled.load(); i++) {
+                    for (auto const& [entry, path] : files[i]) {
+                        write_file(*entry, path, buffer);
+                    }
+                }
+            },
+            [&files](size_t i) {
+                uint64_t bytes = 0;
+                for (auto const& file : files[i]) {
+                    bytes += file.first->compressed_size;
+                }
+                return bytes;
+            },
+            zip_batch_bytes);
+        group.run();
+    }
+
+private:
+    static constexpr size_t zip_batch_entries = 32;
+    static constexpr uint64_t zip_batch_bytes = 4 * 1024 * 1024;
+
+    // Lowercases the ASCII letters of a path, to detect entries
+    // which are the same file on case-insensitive file systems.
+    static std::filesystem::path::string_type fold_case(
+        std::filesystem::path::string_type value)
+    {
+        for (auto& c : value) {
+            if (c >= 'A' && c <= 'Z') {
+                c = static_cast<std::filesystem::path::value_type>(
+                    c - 'A' + 'a');
+            }
+        }
+        return value;
+    }
+
+    // Writes a file entry to the given path, whose parent must exist.
+    void write_file(zip_entry const& entry, std::filesystem::path const& path,
+        std::vector<char>& buffer) const
+    {
+        std::string name(entry.name);
+        if (entry.flags & zip_flag_encrypted) {
+            throw std::runtime_error("encrypted zip entries are not supported");
+        }
+        auto header = at(entry.local_header_offset, 30);
+        if (read_le32(header) != zip_local_header_signature) {
+            throw std::runtime_error("invalid zip local file header: " + name);
+        }
+        auto data_offset = entry.local_header_offset + 30 +
+            read_le16(header + 26) + read_le16(header + 28);
+        auto compressed = at(data_offset, entry.compressed_size);
+        auto out = open_archive_file(path, entry.uncompressed_size);
+        uLong crc = crc32(0L, Z_NULL, 0);
+        uint64_t written = 0;
+        auto emit = [&](char const* data, size_t size) {
+            // Stop early if the entry is larger than the index claims.
+            if (size > entry.uncompressed_size - written) {
+                throw std::runtime_error("zip entry is corrupted: " + name);
+            }
+            crc = crc32_z(crc, reinterpret_cast<Bytef const*>(data), size);
+            out.write(data, size);
+            if (out.fail()) {
+                throw std::runtime_error(
+                    "failed to write extracted file: " + path.string());
+            }
+            written += size;
+        };
+        if (entry.method == zip_method_stored) {
+            emit(compressed, static_cast<size_t>(entry.compressed_size));
+        } else if (entry.method == zip_method_deflated) {
+            inflate_entry(compressed, entry.compressed_size, buffer, emit);
+        } else {
+            throw std::runtime_error("unsupported zip compression method " +
+                std::to_string(entry.method) + ": " + name);
+        }
+        out.close();
+        if (static_cast<uint32_t>(crc) != entry.crc ||
+            written != entry.uncompressed_size) {
+            throw std::runtime_error("zip entry is corrupted: " + name);
+        }
+#ifndef WIN32
+        // Keep executables executable, e.g. the application's binary.
+        auto exec = static_cast<std::filesystem::perms>(entry.mode & 0111);
+        if (exec != std::filesystem::perms::none) {
+            std::filesystem::permissions(
+                path, exec, std::filesystem::perm_options::add);
+        }
+#endif
+    }
+
+    // Returns a pointer to the given range of the file.
+    // Throws if the range is not entirely within the file.
+    char const* at(uint64_t offset, uint64_t size) const
+    {
+        if (offset > m_file.size() || size > m_file.size() - offset) {
+            throw std::runtime_error("zip file is truncated");
+        }
+        return m_file.data() + offset;
+    }
+
+    template <typename F>
+    static void inflate_entry(char const* data, uint64_t size,
+        std::vector<char>& buffer, F const& emit)
+    {
+        z_stream stream{};
+        if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+            throw std::runtime_error("zlib: failed to initialize inflate");
+        }
+        struct guard
+        {
+            z_stream& stream;
+            ~guard() { inflateEnd(&stream); }
+        } end{ stream };
+        auto input = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        auto remaining = size;
+        while (true) {
+            if (stream.avail_in == 0 && remaining > 0) {
+                // zlib takes at most 4 GiB of input at once.
+                auto n = std::min<uint64_t>(remaining, UINT_MAX);
+                stream.next_in = input;
+                stream.avail_in = static_cast<uInt>(n);
+                input += n;
+                remaining -= n;
+            }
+            stream.next_out = reinterpret_cast<Bytef*>(buffer.data());
+            stream.avail_out = static_cast<uInt>(buffer.size());
+            auto result = ::inflate(&stream, Z_NO_FLUSH);
+            if (result != Z_OK && result != Z_STREAM_END) {
+                throw std::runtime_error("zlib: failed to decompress data");
+            }
+            emit(buffer.data(), buffer.size() - stream.avail_out);
+            if (result == Z_STREAM_END) {
+                return;
+            }
+        }
+    }
+
+    void read_central_directory()
+    {
+        auto size = m_file.size();
+        if (size < 22) {
+            throw std::runtime_error("not a zip file");
+        }
+        // The end record is followed by a comment of up to 65535 bytes.
+        uint64_t lowest = size > 22 + 0xffff ? size - 22 - 0xffff : 0;
+        std::optional<uint64_t> end;
+        for (uint64_t i = size - 22 + 1; i-- > lowest;) {
+            if (read_le32(m_file.data() + i) == zip_end_signature) {
+                end = i;
+                break;
+            }
+        }
+        if (!end.has_value()) {
+            throw std::runtime_error("zip end of central directory not found");
+        }
+        auto record = m_file.data() + *end;
+        uint64_t count = read_le16(record + 10);
+        uint64_t directory_size = read_le32(record + 12);
+        uint64_t directory_offset = read_le32(record + 16);
+        if ((count == 0xffff || directory_size == 0xffffffff ||
+                directory_offset == 0xffffffff) &&
+            *end >= 20) {
+            auto locator = m_file.data() + *end - 20;
+            if (read_le32(locator) == zip64_end_locator_signature) {
+                auto record64 = at(read_le64(locator + 8), 56);
+                if (read_le32(record64) != zip64_end_signature) {
+                    throw std::runtime_error("invalid zip64 end record");
+                }
+                count = read_le64(record64 + 32);
+                directory_size = read_le64(record64 + 40);
+                directory_offset = read_le64(record64 + 48);
+            }
+        }
+        auto p = at(directory_offset, directory_size);
+        auto directory_end = p + directory_size;
+        auto capacity = std::min<uint64_t>(count, directory_size / 46);
+        m_entries.reserve(static_cast<size_t>(capacity));
+        for (uint64_t i = 0; i < count; i++) {
+            if (directory_end - p < 46 ||
+                read_le32(p) != zip_central_header_signature) {
+                throw std::runtime_error("invalid zip central directory");
+            }
+            zip_entry entry;
+            auto host = read_le16(p + 4) >> 8;
+            entry.flags = read_le16(p + 8);
+            entry.method = read_le16(p + 10);
+            entry.crc = read_le32(p + 16);
+            entry.compressed_size = read_le32(p + 20);
+            entry.uncompressed_size = read_le32(p + 24);
+            size_t name_length = read_le16(p + 28);
+            size_t extra_length = read_le16(p + 30);
+            size_t comment_length = read_le16(p + 32);
+            if (host == zip_host_unix) {
+                entry.mode = static_cast<uint16_t>(read_le32(p + 38) >> 16);
+            }
+            entry.local_header_offset = read_le32(p + 42);
+            auto record_size = 46 + name_length + extra_length + comment_length;
+            if (static_cast<size_t>(directory_end - p) < record_size) {
+                throw std::runtime_error("invalid zip central directory");
+            }
+            entry.name = std::string_view(p + 46, name_length);
+            auto extra = p + 46 + name_length;
+            for (size_t j = 0; j + 4 <= extra_length;) {
+                auto id = read_le16(extra + j);
+                auto length = read_le16(extra + j + 2);
+                auto field = extra + j + 4;
+                if (j + 4 + length > extra_length) {
+                    break;
+                }
+                if (id == 0x0001) {
+                    // ZIP64 values are only present if the field is full.
+                    size_t offset = 0;
+                    for (auto value : { &entry.uncompressed_size,
+                             &entry.compressed_size,
+                             &entry.local_header_offset }) {
+                        if (*value == 0xffffffff && offset + 8 <= length) {
+                            *value = read_le64(field + offset);
+                            offset += 8;
+                        }
+                    }
+                }
+                j += 4 + length;
+            }
+            m_entries.push_back(entry);
+            p += record_size;
+        }
+    }
+
+    mapped_file m_file;
+    std::vector<zip_entry> m_entries;
+};
+
+// Extracts a ZIP file to a given target directory. If requested, the root
+// directory is omitted, when all entries are located within a single one.
+// The size of the archive is checked against the budget before anything
+// is written, if it is set. Returns whether the root directory was omitted.
+inline bool zip_file_extract(std::filesystem::path const& zip_path,
+    std::filesystem::path const& target_directory, bool strip_root = false,
+    extraction_budget* budget = nullptr)
+{
+    zip_reader reader(zip_path);
+    auto stripped = strip_root && reader.strip_root_directory();
+    if (budget != nullptr) {
+        budget->reserve(reader.entries().size(), reader.total_size());
+    }
+    reader.extract_all(target_directory);
+    return stripped;
+}
+
+} // namespace ungive::update::internal
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "ungive/update/internal/archive.h"
+#include "ungive/update/internal/inflate.h"
+#include "ungive/update/internal/resources.h"
+#include "ungive/update/internal/stream.h"
+
+namespace ungive::update::internal
+{
+
+constexpr uint32_t zip_local_header_signature = 0x04034b50;
+constexpr uint32_t zip_central_header_signature = 0x02014b50;
+constexpr uint32_t zip_end_signature = 0x06054b50;
+constexpr uint32_t zip_data_descriptor_signature = 0x08074b50;
+
+constexpr uint16_t zip_flag_encrypted = 1 << 0;
+constexpr uint16_t zip_flag_data_descriptor = 1 << 3;
+
+constexpr uint16_t zip_method_stored = 0;
+constexpr uint16_t zip_method_deflated = 8;
+
+// Extracts a ZIP archive while it is being read, e.g. during a download,
+// by reading the local file header that precedes each entry.
+// The central directory at the end of the archive is not needed.
+// Supports stored and deflated entries, data descriptors and ZIP64.
+// Stored entries with a data descriptor are not supported,
+// since their size is not known until after their data.
+// Extracted entries and bytes are accounted for in the budget, if set.
+inline void zip_stream_extract(stream_reader& source,
+    std::filesystem::path const& target_directory,
+    extraction_budget* budget = nullptr)
+{
+    std::vector<char> buffer(256 * 1024);
+    while (true) {
+        char signature[4];
+        if (source.read(signature, 1) == 0) {
+            // Tolerate archives without a central directory.
+            return;
+        }
+        source.read_exact(signature + 1, 3);
+        auto sig = read_le32(signature);
+        if (sig == zip_central_header_signature || sig == zip_end_signature) {
+            return;
+        }
+        if (sig != zip_local_header_signature) {
+            throw std::runtime_error("invalid zip local file header");
+        }
+        char header[26];
+        source.read_exact(header, sizeof(header));
+        auto flags = read_le16(header + 2);
+        auto method = read_le16(header + 4);
+        uint32_t expected_crc = read_le32(header + 10);
+        uint64_t compressed_size = read_le32(header + 14);
+        uint64_t uncompressed_size = read_le32(header + 18);
+        std::string name(read_le16(header + 22), '\0');
+        std::vector<char> extra(read_le16(header + 24));
+        source.read_exact(name.data(), name.size());
+        source.read_exact(extra.data(), extra.size());
+        bool zip64 = false;
+        for (size_t i = 0; i + 4 <= extra.size();) {
+            auto id = read_le16(extra.data() + i);
+            auto length = read_le16(extra.data() + i + 2);
+            auto field = extra.data() + i + 4;
+            if (i + 4 + length > extra.size()) {
+                break;
+            }
+            if (id == 0x0001) {
+                zip64 = true;
+                size_t offset = 0;
+                if (uncompressed_size == 0xffffffff && offset + 8 <= length) {
+                    uncompressed_size = read_le64(field + offset);
+                    offset += 8;
+                }
+                if (compressed_size == 0xffffffff && offset + 8 <= length) {
+                    compressed_size = read_le64(field + offset);
+                    offset += 8;
+                }
+            }
+            i += 4 + length;
+        }
+        if (flags & zip_flag_encrypted) {
+            throw std::runtime_error("encrypted zip entries are not supported");
+        }
+        bool has_descriptor = (flags & zip_flag_data_descriptor) != 0;
+        auto read_descriptor = [&] {
+            // The descriptor may start with an optional signature.
+            char descriptor[20];
+            source.read_exact(descriptor, 4);
+            if (read_le32(descriptor) == zip_data_descriptor_signature) {
+                source.read_exact(descriptor, 4);
+            }
+            expected_crc = read_le32(descriptor);
+            source.read_exact(descriptor + 4, zip64 ? 16 : 8);
+            uncompressed_size = zip64 ? read_le64(descriptor + 12)
+                                      : read_le32(descriptor + 8);
+        };
+        auto path = archive_entry_path(target_directory, name);
+        if (budget != nullptr) {
+            budget->add_entry();
+        }
+        if (!name.empty() && name.back() == '/') {
+            std::filesystem::create_directories(path);
+            if (has_descriptor) {
+                read_descriptor();
+            } else {
+                source.skip(compressed_size);
+            }
+        } else {
+            auto out = create_archive_file(path);
+            uLong crc = crc32(0L, Z_NULL, 0);
+            uint64_t written = 0;
+            auto emit = [&](char const* data, size_t size) {
+                if (budget != nullptr) {
+                    budget->add_bytes(size);
+                }
+                crc = crc32_z(crc, reinterpret_cast<Bytef const*>(data), size);
+                out.write(data, size);
+                if (out.fail()) {
+                    throw std::runtime_error(
+                        "failed to write extracted file: " + path.string());
+                }
+                written += size;
+            };
+            if (method == zip_method_stored) {
+                if (has_descriptor) {
+                    throw std::runtime_error("stored zip entries with a data "
+                                             "descriptor are not supported");
+                }
+                auto remaining = compressed_size;
+                while (remaining > 0) {
+                    auto n = static_cast<size_t>(
+                        std::min<uint64_t>(remaining, buffer.size()));
+                    source.read_exact(buffer.data(), n);
+                    emit(buffer.data(), n);
+                    remaining -= n;
+                }
+            } else if (method == zip_method_deflated) {
+                auto start = source.position();
+                inflater inflate(inflater::format::raw);
+                while (auto n =
+                           inflate.read(source, buffer.data(), buffer.size())) {
+                    emit(buffer.data(), n);
+                }
+                if (!has_descriptor &&
+                    source.position() - start != compressed_size) {
+                    throw std::runtime_error(
+                        "zip entry has an invalid compressed size: " + name);
+                }
+            } else {
+                throw std::runtime_error(
+                    "unsupported zip compression method " +
+                    std::to_string(method) + ": " + name);
+            }
+            out.close();
+            if (has_descriptor) {
+                read_descriptor();
+            }
+            if (static_cast<uint32_t>(crc) != expected_crc ||
+                written != uncompressed_size) {
+                throw std::runtime_error("zip entry is corrupted: " + name);
+            }
+        }
+    }
+}
+
+} // namespace ungive::update::internal
@@ -0,0 +1,98 @@
+#pragma once
+
+#ifdef UPDATE_WITH_ZSTD
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <zstd.h>
+
+#include "ungive/update/internal/stream.h"
+
+namespace ungive::update::internal
+{
+
+// Decompresses Zstandard data from a stream reader.
+// Frames whose window is larger than 2^window_log_max bytes are rejected,
+// since the window is allocated before any data is verified.
+// Frames that were compressed with long-distance matching,
+// e.g. with "zstd --long=31", need a limit of at least 31.
+class zstd_decompressor
+{
+public:
+    static constexpr int default_window_log_max = 27;
+
+    zstd_decompressor(int window_log_max = default_window_log_max)
+        : m_context{ ZSTD_createDCtx() }
+    {
+        if (m_context == nullptr) {
+            throw std::runtime_error("zstd: failed to create context");
+        }
+        auto result = ZSTD_DCtx_setParameter(
+            m_context, ZSTD_d_windowLogMax, window_log_max);
+        if (ZSTD_isError(result)) {
+            ZSTD_freeDCtx(m_context);
+            check(result);
+        }
+    }
+
+    ~zstd_decompressor() { ZSTD_freeDCtx(m_context); }
+
+    zstd_decompressor(zstd_decompressor const&) = delete;
+    zstd_decompressor& operator=(zstd_decompressor const&) = delete;
+
+    // Decompresses up to size bytes into data and returns how many
+    // were written. Returns 0 once all frames have been decompressed.
+    // Multiple concatenated frames are decompressed as one stream.
+    std::size_t read(stream_reader& source, char* data, std::size_t size)
+    {
+        if (size == 0) {
+            return 0;
+        }
+        ZSTD_outBuffer output{ data, size, 0 };
+        while (output.pos == 0) {
+            auto [buffered, available] = source.peek();
+            ZSTD_inBuffer input{ buffered, available, 0 };
+            auto result = ZSTD_decompressStream(m_context, &output, &input);
+            source.consume(input.pos);
+            check(result);
+            m_frame_complete = result == 0;
+            if (available == 0 && output.pos == 0) {
+                if (!m_frame_complete) {
+                    throw std::runtime_error(
+                        "unexpected end of compressed data");
+                }
+                return 0;
+            }
+        }
+        return output.pos;
+    }
+
+private:
+    static void check(std::size_t result)
+    {
+        if (ZSTD_isError(result)) {
+            throw std::runtime_error(
+                std::string("zstd: ") + ZSTD_getErrorName(result));
+        }
+    }
+
+    ZSTD_DCtx* m_context;
+    bool m_frame_complete{ true };
+};
+
+// Returns a byte reader which decompresses Zstandard data from the source.
+inline byte_reader zstd_reader(stream_reader& source,
+    int window_log_max = zstd_decompressor::default_window_log_max)
+{
+    auto state = std::make_shared<zstd_decompressor>(window_log_max);
+    return [&source, state](char* data, std::size_t size) -> std::size_t {
+        return state->read(source, data, size);
+    };
+}
+
+} // namespace ungive::update::internal
+
+#endif // UPDATE_WITH_ZSTD
@@ -2,24 +2,35 @@
 #define UNGIVE_UPDATE_MANAGER_H_
 
 #include <filesystem>
+#include <functional>
+#include <memory>
 #include <optional>
 #include <string>
 #include <unordered_set>
+#include <vector>
 #include <utility>
 
 #include "ungive/update/detail/common.h"
 #include "ungive/update/detail/launcher.h"
 #include "ungive/update/detail/log.h"
+#include "ungive/update/internal/exchange.h"
+#include "ungive/update/internal/object_store.h"
+#include "ungive/update/internal/platform.h"
+#include "ungive/update/internal/retained_versions.h"
 #include "ungive/update/internal/sentinel.h"
-
-#ifdef WIN32
-#include "ungive/update/internal/win/lock.h"
-#include "ungive/update/internal/win/process.h"
-
-#endif
+#include "ungive/update/internal/staging.h"
+#include "ungive/update/internal/sync.h"
+#include "ungive/update/internal/trash.h"
+#include "ungive/update/internal/version_index.h"
 
 #define DEFAULT_LATEST_DIRECTORY "current"
 #define UPDATE_LOCK_FILENAME "update.lock"
+#define STAGING_DIRECTORY ".staging"
+#define OBJECTS_DIRECTORY ".objects"
+#define INDEX_DIRECTORY ".index"
+#define TRASH_DIRECTORY ".trash"
+#define RETAINED_DIRECTORY ".retained"
+#define EXIT_DIRECTORY ".exit"
 
 namespace ungive::update
 {
@@ -59,6 +70,13 @@ namespace ungive::update
 class manager
 {
 public:
+    // Command line arguments for launched processes,
+    // which are wide strings on Windows.
+    using arguments = std::vector<std::filesystem::path::string_type>;
+
+    // Serves requests to prepare to exit, see listen_for_exit_requests().
+    using exit_listener = internal::platform::exit_listener;
+
     // Creates a new manager instance.
     // May throw an exception if the update lock in the working directory
     // could not be acquired.
@@ -67,9 +85,20 @@ public:
         std::string const& latest_directory_name)
         : m_working_directory{ working_directory },
           m_current_version{ current_version },
-          m_latest_directory_name{ latest_directory_name }
+          m_latest_directory_name{ latest_directory_name },
+          m_staging_area{ working_directory / STAGING_DIRECTORY },
+          m_object_store{ working_directory / OBJECTS_DIRECTORY },
+          m_version_index{ working_directory,
+              working_directory / INDEX_DIRECTORY / "versions" },
+          m_retained_versions{ working_directory / RETAINED_DIRECTORY },
+          m_trash{ working_directory / TRASH_DIRECTORY }
     {
         acquire_lock();
+        // Nothing can be staged by another process while we hold the lock,
+        // so anything in the staging area was left behind.
+        m_staging_area.clear();
+        // Continue deleting what an earlier process could not finish.
+        empty_trash();
         write_sentinel_for_current_process();
     }
 
@@ -97,6 +126,105 @@ public:
         return m_latest_directory_name;
     }
 
+    // Returns the staging area in the working directory, in which updates
+    // are prepared before they are moved to their version directory.
+    internal::staging_area const& staging_area() const
+    {
+        return m_staging_area;
+    }
+
+    // Returns the store in the working directory in which installed files
+    // are kept by their content, if files are deduplicated by the updater.
+    internal::object_store const& object_store() const
+    {
+        return m_object_store;
+    }
+
+    // Returns the index of installed versions in the working directory,
+    // which must be updated when a version directory is added or removed.
+    internal::version_index const& version_index() const
+    {
+        return m_version_index;
+    }
+
+    // Sets how updates are flushed to disk when they are installed
+    // and applied. By default nothing is flushed explicitly,
+    // see the durability enumeration for the available modes.
+    void durability(update::durability mode) { m_durability = mode; }
+
+    // Returns how updates are flushed to disk.
+    update::durability durability() const { return m_durability; }
+
+    // Sets which versions are kept when an update replaces them
+    // in the latest directory, so that rollback() can restore them.
+    // By default replaced versions are deleted.
+    void retention(retention_policy const& policy) { m_retention = policy; }
+
+    // Returns which replaced versions are kept.
+    retention_policy const& retention() const { return m_retention; }
+
+    // Sets how running processes are stopped before the files
+    // they use are replaced or deleted, see shutdown_policy.
+    void shutdown(shutdown_policy const& policy) { m_shutdown = policy; }
+
+    // Returns how running processes are stopped.
+    shutdown_policy const& shutdown() const { return m_shutdown; }
+
+    // Sets how launch_latest() and start_latest() start processes.
+    // By default a detached process is started, see launch_mode.
+    // Throws on Windows if the current process should be replaced.
+    void launch_mode(update::launch_mode mode)
+    {
+#ifdef WIN32
+        if (mode == update::launch_mode::replace) {
+            throw std::invalid_argument(
+                "replacing the process is not supported on Windows");
+        }
+#endif
+        m_launch_mode = mode;
+    }
+
+    // Returns how processes are launched.
+    update::launch_mode launch_mode() const { return m_launch_mode; }
+
+    // Lets this process be asked to prepare to exit by the manager
+    // of another process, before that one stops this process to replace
+    // its files, e.g. by the launcher when it applies an update.
+    // The callback should save any state and return once it is safe
+    // to stop this process, which should then exit. An update is then
+    // applied as soon as the process has exited, without waiting
+    // for the timeouts of the shutdown policy. Requests are served
+    // on a background thread until the returned listener is destructed.
+    // The update lock is not needed for this.
+    // Throws on Windows, where this is not supported yet.
+    //
+    // Example usage of this method within the main executable:
+    //
+    //  auto listener = manager.listen_for_exit_requests([&] {
+    //      app.save_state();
+    //      app.quit();
+    //  });
+    //
+    std::unique_ptr<exit_listener> listen_for_exit_requests(
+        std::function<void()> prepare_to_exit) const
+    {
+        return std::make_unique<exit_listener>(
+            m_working_directory / EXIT_DIRECTORY, std::move(prepare_to_exit));
+    }
+
+    // Returns the versions that can be restored with rollback(),
+    // the most recently replaced version first.
+    std::vector<version_number> retained_versions()
+    {
+        acquire_lock();
+
+        std::vector<version_number> result;
+        for (auto const& entry : m_retained_versions.list()) {
+            result.push_back(entry.version);
+        }
+        return result;
+    }
+
     // Sets a list of files that should be retained when an update is applied.
     // This could e.g. be an uninstaller executable which was extracted
     // in to the application directory by the application's installer,
@@ -133,7 +261,8 @@ public:
     void set_launcher(std::unique_ptr<ungive::update::launcher> launcher)
     {
         m_launcher = std::move(launcher);
-        auto process_executable = internal::win::current_process_executable();
+        auto process_executable =
+            internal::platform::current_process_executable();
         if (!m_launcher->working_directory().has_value()) {
             // Set the working directory to the directory
             // of the executable of the current process.
@@ -144,54 +273,20 @@ public:
 
     // Returns the latest installed version in the manager's working directory,
     // excluding the version that might be present in the "latest" directory.
+    // Installed versions are read from the version index, the directory
+    // is only scanned if it was modified without updating the index.
     // May throw an exception if any error occurs.
     std::optional<std::pair<version_number, std::filesystem::path>>
     latest_available_update()
     {
         acquire_lock();
 
-        std::filesystem::create_directories(m_working_directory);
-        auto it = std::filesystem::directory_iterator(m_working_directory);
-        std::optional<std::pair<version_number, std::filesystem::path>> result;
-        for (auto const& entry : it) {
-            if (!entry.is_directory() || !entry.path().has_filename()) {
-                continue;
-            }
-            auto filename = entry.path().filename().string();
-            version_number directory_version;
-            try {
-                directory_version = version_number::from_string(filename);
-            }
-            catch (...) {
-                // The path does not contain a valid version number.
-                continue;
-            }
-            internal::sentinel sentinel(entry.path());
-            if (!sentinel.read()) {
-                // The sentinel does not exist or has an invalid format.
-                continue;
-            }
-            if (directory_version != sentinel.version()) {
-                // The sentinel file contains a different version.
-                continue;
-            }
-            if (result.has_value() && directory_version == result->first) {
-                // two directories represent the same version,
-                // e.g. "2.1" and "2.1.0". this should not happen in practice,
-                // but if it does, simply return nothing,
-                // so that the caller clears and redownloads the newest version,
-                // as the working directory is in an inconsistent state.
-                return std::nullopt;
-            }
-            if (!result.has_value() || directory_version > result->first) {
-                result = std::make_pair(directory_version, entry.path());
-            }
-        }
-        return result;
+        return latest_of(m_version_index.load());
     }
 
     // Deletes all directories in the manager's working directory,
     // except the one of the current process.
+    // They are moved to the trash and deleted in the background.
     // This is useful if automatic updates should be disabled
     // and the application should not launch any new versions anymore.
     // Do not call this while an update is in progress.
@@ -202,9 +297,11 @@ public:
 
         std::unordered_set<std::filesystem::path> exclude_directories;
         exclude_directories.insert(UPDATE_LOCK_FILENAME);
+        exclude_directories.insert(TRASH_DIRECTORY);
+        exclude_directories.insert(EXIT_DIRECTORY);
         // Exclude the directory in which the current process is executing.
         // Other than that we don't exclude any other directories.
-        auto process = internal::win::current_process_executable();
+        auto process = internal::platform::current_process_executable();
         if (process.has_parent_path()) {
             auto path = std::filesystem::relative(process, m_working_directory);
             if (path.begin() != path.end() && *path.begin() != "..") {
@@ -213,6 +310,7 @@ public:
             }
         }
         unlink_files(exclude_directories);
+        empty_trash();
     }
 
     // Prunes all files in the manager's working directory
@@ -220,6 +318,11 @@ public:
     // the subdirectory for the newest installed version
     // and the subdirectory for the latest version
     // as indicated by the return value of latest_available_update().
+    // The staging area is kept as well, as an update might be in progress,
+    // and so are retained versions, which the retention policy limits.
+    // Pruned directories are moved to the trash and deleted in the background.
+    // Stored objects which are not used by any remaining version are removed
+    // once the trash is empty.
     // May throw an exception if any error occurs.
     void prune()
     {
@@ -227,14 +330,21 @@ public:
 
         std::unordered_set<std::filesystem::path> exclude_directories;
         exclude_directories.insert(UPDATE_LOCK_FILENAME);
+        exclude_directories.insert(STAGING_DIRECTORY);
+        exclude_directories.insert(OBJECTS_DIRECTORY);
+        exclude_directories.insert(INDEX_DIRECTORY);
+        exclude_directories.insert(TRASH_DIRECTORY);
+        exclude_directories.insert(RETAINED_DIRECTORY);
+        exclude_directories.insert(EXIT_DIRECTORY);
         exclude_directories.insert(m_latest_directory_name);
         exclude_directories.insert(m_current_version.string());
-        auto latest_installed = latest_available_update();
+        auto installed = m_version_index.load();
+        auto latest_installed = latest_of(installed);
         if (latest_installed.has_value()) {
             exclude_directories.insert(latest_installed->first.string());
         }
         // Exclude the directory in which the current process is executing.
-        auto process = internal::win::current_process_executable();
+        auto process = internal::platform::current_process_executable();
         if (process.has_parent_path()) {
             auto path = std::filesystem::relative(process, m_working_directory);
             if (path.begin() != path.end()) {
@@ -243,6 +353,15 @@ public:
             }
         }
         unlink_files(exclude_directories);
+        m_version_index.update(installed, [&](auto& entries) {
+            for (auto const& entry : installed) {
+                if (exclude_directories.find(entry.directory) ==
+                    exclude_directories.end()) {
+                    internal::version_index::remove(entries, entry.directory);
+                }
+            }
+        });
+        empty_trash();
     }
 
     // Only call this method from the main executable.
@@ -256,6 +375,8 @@ public:
     // or false if there is no newer version than the one of the current process
     // or starting the launcher failed.
     // If true is returned, the application should terminate.
+    // If the launch mode replaces the current process,
+    // the launcher is executed in its place and this does not return.
     //
     // The application is expected to ship with
     // a standalone launcher executable which is used to apply updates
@@ -286,7 +407,7 @@ public:
     // The lock is released such that the launched process
     // can acquire it and manage updates.
     //
-    bool launch_latest(std::vector<std::wstring> const& launcher_arguments = {})
+    bool launch_latest(arguments const& launcher_arguments = {})
     {
         if (m_launcher == nullptr) {
             throw std::runtime_error("cannot launch latest without a launcher");
@@ -294,7 +415,7 @@ public:
 
         acquire_lock();
 
-        auto process = internal::win::current_process_executable();
+        auto process = internal::platform::current_process_executable();
         auto latest = internal::sentinel(latest_path());
         auto update = latest_available_update();
 
@@ -332,8 +453,7 @@ public:
             auto copied_executable = m_launcher->copy_to(temp_directory);
             // Release the lock and launch the executable.
             release_lock();
-            internal::win::start_process_detached(
-                copied_executable, launcher_arguments);
+            start(copied_executable, launcher_arguments);
             return true;
         }
         return false;
@@ -343,6 +463,8 @@ public:
     //
     // Applies the latest available update by moving it
     // into the latest directory and deleting the update directory.
+    // The update replaces the latest directory in one atomic operation
+    // where the platform supports it, otherwise with two renames.
     // Any executable that might be running in either of those directories
     // will be killed by this method if kill_processes is true.
     // Returns whether any update has been applied successfully.
@@ -361,7 +483,15 @@ public:
 
         auto latest_directory = latest_path();
         auto latest = internal::sentinel(latest_directory);
-        auto update = latest_available_update();
+        auto installed = m_version_index.load();
+        auto update = latest_of(installed);
+        if (update.has_value() && !is_intact(*update)) {
+            // The directory changed without invalidating the index,
+            // e.g. its sentinel was removed, so the index is not trusted.
+            installed = m_version_index.scan();
+            m_version_index.update(installed, [](auto&) {});
+            update = latest_of(installed);
+        }
         if (update.has_value() &&
             (!latest.read() || latest.version() < update->first)) {
             auto update_directory = update->second;
@@ -370,23 +500,85 @@ public:
             }
             // Kill any processes that were started in these directories.
             if (kill_processes) {
-                internal::win::kill_processes(latest_directory);
-                internal::win::kill_processes(update_directory);
+                stop_processes({ latest_directory, update_directory });
             }
             // Move the files to retain into the update's directory,
-            // then delete the latest directory.
+            // then put the update in place of the latest directory.
             if (std::filesystem::exists(latest_directory)) {
                 move_retained_files(latest_directory, update_directory);
-                std::filesystem::remove_all(latest_directory);
+                replace_latest(update_directory,
+                    latest.read() ? std::make_optional(latest.version())
+                                  : std::nullopt);
+            } else {
+                std::filesystem::rename(update_directory, latest_directory);
             }
-            // Rename update to the latest name and delete the update directory.
-            std::filesystem::rename(update_directory, latest_directory);
-            std::filesystem::remove_all(update_directory);
+            m_version_index.update(installed, [&](auto& entries) {
+                internal::version_index::remove(
+                    entries, update_directory.filename().string());
+            });
+            finish_replacing_latest();
             return update->first;
         }
         return std::nullopt;
     }
 
+    // Only call this method from the launcher executable.
+    //
+    // Restores a version that was kept according to the retention policy
+    // into the latest directory, e.g. because the latest version is broken.
+    // If no version is given, the newest retained version that is older
+    // than the one in the latest directory is restored.
+    // The version that is replaced is retained in turn, if the policy
+    // allows it, so that it can be restored the same way.
+    // Like applying an update, the latest directory is replaced
+    // in constant time and nothing is downloaded. Any executable
+    // that is running in the latest directory will be killed
+    // if kill_processes is true. Returns the restored version or nothing,
+    // if there is no such retained version.
+    //
+    // Updates that were installed before the rollback are still applied
+    // by apply_latest() and the updater may download the version again,
+    // unless the application disables or skips it.
+    //
+    // May throw an exception if any error occurs.
+    //
+    std::optional<version_number> rollback(
+        std::optional<version_number> const& version = std::nullopt,
+        bool kill_processes = true)
+    {
+        acquire_lock();
+
+        auto latest_directory = latest_path();
+        auto latest = internal::sentinel(latest_directory);
+        std::optional<version_number> latest_version;
+        if (latest.read()) {
+            latest_version = latest.version();
+        }
+        auto retained = m_retained_versions.find(version, latest_version);
+        if (!retained.has_value() ||
+            (latest_version.has_value() &&
+                retained->version == *latest_version)) {
+            return std::nullopt;
+        }
+        // Processes of the retained version that are still running
+        // would otherwise be moved along with their directory.
+        if (kill_processes) {
+            stop_processes({ latest_directory, retained->path });
+        }
+        // Replacing the latest directory modifies the working directory,
+        // but does not change the installed versions.
+        auto installed = m_version_index.read();
+        if (std::filesystem::exists(latest_directory)) {
+            move_retained_files(latest_directory, retained->path);
+            replace_latest(retained->path, latest_version);
+        } else {
+            std::filesystem::rename(retained->path, latest_directory);
+        }
+        m_version_index.update(installed, [](auto&) {});
+        finish_replacing_latest();
+        return retained->version;
+    }
+
     // Only call this method from the launcher executable.
     //
     // Starts the version of the application that is in the latest directory,
@@ -396,6 +588,8 @@ public:
     // The path to the main executable must be a relative path
     // which will be resolved in relation to the latest directory.
     // It must therefore be relative to the root of the application directory.
+    // If the launch mode replaces the current process, the main executable
+    // is executed in place of the launcher and this does not return.
     //
     // Calling this method releases the update lock.
     // If the manager is to be used again, the lock must be reacquired.
@@ -403,7 +597,7 @@ public:
     // can acquire it and manage updates.
     //
     void start_latest(std::filesystem::path const& main_executable,
-        std::vector<std::wstring> const& main_arguments = {})
+        arguments const& main_arguments = {})
     {
         release_lock();
 
@@ -419,7 +613,7 @@ public:
             throw std::runtime_error("the specified main executable does not "
                                      "exist in the latest directory");
         }
-        internal::win::start_process_detached(executable_path, main_arguments);
+        start(executable_path, main_arguments);
     }
 
     // Acquires the update lock in the working directory of the manager
@@ -430,7 +624,7 @@ public:
             return;
         }
         try {
-            m_update_lock = std::make_unique<internal::win::lock_file>(
+            m_update_lock = std::make_unique<internal::platform::lock_file>(
                 m_working_directory / UPDATE_LOCK_FILENAME);
         }
         catch (std::exception const& err) {
@@ -442,8 +636,11 @@ public:
     // Releases the lock that was acquired when creating the manager instance.
     // The manager is left in a dirty state and may not be used anymore
     // until the lock has been acquired again with acquire_lock().
+    // Deleting the content of the trash stops and is continued
+    // by the next manager that acquires the lock.
     void release_lock()
     {
+        m_trash.stop();
         if (m_update_lock != nullptr) {
             m_update_lock.reset();
             m_update_lock = nullptr;
@@ -455,12 +652,131 @@ public:
     inline operator bool() const { return has_lock(); }
 
 private:
+    // Returns the newest of the installed versions and its directory.
+    std::optional<std::pair<version_number, std::filesystem::path>> latest_of(
+        internal::version_index::entries const& installed) const
+    {
+        std::optional<std::pair<version_number, std::filesystem::path>> result;
+        for (auto const& entry : installed) {
+            if (result.has_value() && entry.version == result->first) {
+                // two directories represent the same version,
+                // e.g. "2.1" and "2.1.0". this should not happen in practice,
+                // but if it does, simply return nothing,
+                // so that the caller clears and redownloads the newest version,
+                // as the working directory is in an inconsistent state.
+                return std::nullopt;
+            }
+            if (!result.has_value() || entry.version > result->first) {
+                result = std::make_pair(
+                    entry.version, m_working_directory / entry.directory);
+            }
+        }
+        return result;
+    }
+
+    // Returns whether the directory of a version contains a sentinel
+    // for that version, i.e. whether the version is completely installed.
+    static bool is_intact(
+        std::pair<version_number, std::filesystem::path> const& version)
+    {
+        internal::sentinel sentinel(version.second);
+        return sentinel.read() && sentinel.version() == version.first;
+    }
+
+    // Replaces the latest directory with the given directory,
+    // such that the latest directory is never missing or incomplete,
+    // whatever the size of either directory. The previous content
+    // is retired once the new content is in place.
+    void replace_latest(std::filesystem::path const& directory,
+        std::optional<version_number> const& previous_version) const
+    {
+        auto latest_directory = latest_path();
+        if (internal::exchange_paths(directory, latest_directory)) {
+            retire(directory, previous_version);
+            return;
+        }
+        // Without an atomic exchange the latest directory is missing
+        // between two renames, which take constant time.
+        auto previous = retire(latest_directory, previous_version);
+        try {
+            std::filesystem::rename(directory, latest_directory);
+        }
+        catch (...) {
+            std::error_code ec;
+            if (!previous.empty()) {
+                std::filesystem::rename(previous, latest_directory, ec);
+            }
+            throw;
+        }
+    }
+
+    // Moves a version that was replaced in the latest directory
+    // to the retained versions, if the retention policy keeps any
+    // and its version is known, or to the trash otherwise.
+    // Returns its new path or an empty path, if it was deleted.
+    std::filesystem::path retire(std::filesystem::path const& directory,
+        std::optional<version_number> const& version) const
+    {
+        if (!version.has_value() || m_retention.versions == 0) {
+            return m_trash.move(directory);
+        }
+        auto retained = m_retained_versions.path(*version);
+        if (std::filesystem::exists(retained)) {
+            m_trash.move(retained);
+        }
+        return m_retained_versions.add(directory, *version);
+    }
+
+    // Removes retained versions which exceed the retention policy,
+    // flushes the replaced latest directory, if requested,
+    // and starts deleting what was replaced.
+    void finish_replacing_latest()
+    {
+        for (auto const& path : m_retained_versions.evict(m_retention)) {
+            m_trash.move(path);
+        }
+        if (m_durability != update::durability::none) {
+            internal::sync_directory(m_working_directory);
+        }
+        empty_trash();
+    }
+
+    // Deletes the content of the trash in the background
+    // and removes stored objects that are not used anymore afterwards,
+    // as trashed versions might have been the last ones to use them.
+    void empty_trash()
+    {
+        m_trash.empty_in_background([store = m_object_store] {
+            store.collect();
+        });
+    }
+
+    // Starts the executable according to the launch mode.
+    void start(std::filesystem::path const& executable,
+        arguments const& process_arguments) const
+    {
+        if (m_launch_mode == update::launch_mode::replace) {
+            internal::platform::replace_process(
+                executable, process_arguments);
+        }
+        internal::platform::start_process_detached(
+            executable, process_arguments);
+    }
+
+    // Stops the processes with their executable in any of the paths,
+    // asking those that listen for exit requests to prepare first.
+    void stop_processes(std::vector<std::filesystem::path> const& paths) const
+    {
+        internal::platform::kill_processes(
+            paths, m_shutdown, m_working_directory / EXIT_DIRECTORY);
+    }
+
     void unlink_files(
         std::unordered_set<std::filesystem::path> excluded = {}) const
     {
         std::filesystem::create_directories(m_working_directory);
         auto it = std::filesystem::directory_iterator(m_working_directory);
-        std::optional<std::pair<version_number, std::filesystem::path>> result;
+        std::vector<std::filesystem::path> entries;
         for (auto const& entry : it) {
             if (!entry.path().has_filename()) {
                 continue;
@@ -469,12 +785,13 @@ private:
             if (excluded.find(filename) != excluded.end()) {
                 continue;
             }
-            // Kill any processes that might live in these directories.
-            // This might be inefficient in a loop, but in practice
-            // there won't be many files in the working directory.
-            internal::win::kill_processes(entry.path());
-            // Remove all files.
-            std::filesystem::remove_all(entry.path());
+            entries.push_back(entry.path());
+        }
+        // Kill any processes that might live in these directories,
+        // walking the list of running processes only once.
+        stop_processes(entries);
+        for (auto const& entry : entries) {
+            m_trash.move(entry);
         }
     }
 
@@ -490,17 +807,22 @@ private:
             return;
         }
         try {
-            auto process = internal::win::current_process_executable();
+            auto process = internal::platform::current_process_executable();
             bool is_process_latest = internal::is_subpath(process, latest);
             if (is_process_latest) {
                 internal::sentinel sentinel(latest);
+                // Keep how the current version was verified, if known.
+                if (sentinel.read() &&
+                    sentinel.version() != m_current_version) {
+                    sentinel = internal::sentinel(latest);
+                }
                 // Skip this check for now, we just always overwrite it.
                 // if (sentinel.read() &&
                 //     sentinel.version() == m_current_version) {
                 //     return;
                 // }
                 sentinel.version(m_current_version);
-                sentinel.write();
+                sentinel.write(m_durability);
             }
         }
         catch (...) {
@@ -533,15 +855,31 @@ private:
     std::filesystem::path m_working_directory;
     version_number m_current_version;
     std::string m_latest_directory_name;
+    internal::staging_area m_staging_area;
+    internal::object_store m_object_store;
+    internal::version_index m_version_index;
+    internal::retained_versions m_retained_versions;
 
     std::unique_ptr<ungive::update::launcher> m_launcher{ nullptr };
-    std::unique_ptr<internal::win::lock_file> m_update_lock{ nullptr };
+    std::unique_ptr<internal::platform::lock_file> m_update_lock{ nullptr };
     std::vector<std::filesystem::path> m_retain_paths{};
+    update::durability m_durability{ update::durability::none };
+    retention_policy m_retention{};
+    shutdown_policy m_shutdown{};
+    update::launch_mode m_launch_mode{ update::launch_mode::detached };
+    // Declared last, so that deleting stops before the lock is released.
+    internal::trash m_trash;
 };
 
 } // namespace ungive::update
 
 #undef DEFAULT_LATEST_DIRECTORY
 #undef UPDATE_LOCK_FILENAME
+#undef STAGING_DIRECTORY
+#undef OBJECTS_DIRECTORY
+#undef INDEX_DIRECTORY
+#undef TRASH_DIRECTORY
+#undef RETAINED_DIRECTORY
+#undef EXIT_DIRECTORY
 
 #endif // UNGIVE_UPDATE_MANAGER_H_
@@ -19,14 +19,16 @@
 #include "ungive/update/detail/operations.h"
 #include "ungive/update/detail/types.h"
 #include "ungive/update/detail/verifiers.h"
+#include "ungive/update/internal/copy.h"
+#include "ungive/update/internal/extract.h"
 #include "ungive/update/internal/sentinel.h"
+#include "ungive/update/internal/staging.h"
+#include "ungive/update/internal/sync.h"
 #include "ungive/update/internal/util.h"
+#include "ungive/update/internal/verification_record.h"
+#include "ungive/update/internal/version_index.h"
 #include "ungive/update/manager.hpp"
 
-#ifdef WIN32
-#include "ungive/update/internal/zip.h"
-#endif
-
 namespace ungive::update::internal
 {
 
@@ -52,7 +54,7 @@ class updater
 {
 public:
     // Creates an updater from the given manager.
-    updater(std::shared_ptr<manager> manager)
+    updater(std::shared_ptr<ungive::update::manager> manager)
         : m_manager{ manager },
           m_downloader{ std::make_shared<http_downloader>() }
     {
@@ -137,14 +139,76 @@ public:
         m_downloader->add_verification(verifier);
     }
 
+    // Keeps downloaded update files in the given directory until the update
+    // has been installed, so that an interrupted update does not need
+    // to download and hash the file again (see http_downloader).
+    inline void download_directory(std::filesystem::path const& path)
+    {
+        m_downloader->download_directory(path);
+    }
+
+    // Sets whether downloaded files are always hashed again,
+    // even if they were verified before and have not been modified since.
+    inline void always_reverify(bool state)
+    {
+        m_downloader->always_reverify(state);
+    }
+
+    // Sets whether updates are extracted while they are being downloaded,
+    // without storing the archive on disk first. Supported for ZIP
+    // and tar archives. Extracted content is only installed once
+    // the download passed verification, but verifiers must be able to
+    // verify the file by its digests alone (see http_downloader::stream),
+    // e.g. sha256sums or b3sums with a message digest, or a chunk manifest.
+    // Downloads are not kept in the download directory in this mode.
+    inline void stream_extraction(bool state) { m_stream_extraction = state; }
+
+    // Sets limits for the size of downloads and extracted content
+    // and for the number of files in an archive. No limits are set
+    // by default. Downloads fail before any data is received if the server
+    // announces a size beyond the limit, ZIP files before anything
+    // is extracted, other archives once they exceed a limit.
+    inline void resource_limits(update::resource_limits const& limits)
+    {
+        m_resource_limits = limits;
+    }
+
+    // Sets whether free disk space is checked before writing anything.
+    // Before a download, the size announced by the server is expected
+    // to be needed twice, for the download and for its extracted files,
+    // which are added up for each volume they are written to.
+    // The extracted size of archives with an index, like ZIP files,
+    // is checked against the volumes of the staging area and the working
+    // directory before extracting them. Enabled by default.
+    inline void check_disk_space(bool state) { m_check_disk_space = state; }
+
+    // Sets whether installed files are deduplicated by their content.
+    // Each file of a new version is replaced with a hard link to a file
+    // in the manager's object store, so files which did not change
+    // between versions occupy disk space only once. Stored files which
+    // are not used by any version anymore are removed by prune().
+    // Only enable this if the application does not modify its files
+    // in place, as a change would affect every version sharing the file.
+    // Disabled by default.
+    inline void deduplicate_files(bool state) { m_deduplicate_files = state; }
+
     // Add any number of operations for extracted update content.
     // If the operation throws an exception, the update is cancelled
     // and not applied or copied into the updater's working directory.
+    // If the first operation flattens the extracted directory, the root
+    // directory is omitted while extracting, if possible, instead.
     template <typename O,
         typename std::enable_if<std::is_base_of<types::content_operation,
             O>::value>::type* = nullptr>
     void add_content_operation(O const& operation)
     {
+        if constexpr (std::is_same<O,
+                          operations::flatten_extracted_directory>::value) {
+            if (m_content_operations.empty() && !m_flatten_root) {
+                m_flatten_root = true;
+                return;
+            }
+        }
         m_content_operations.push_back(operation);
     }
 
@@ -242,14 +306,49 @@ private:
         check_url(url, version);
         // Make sure files from previous updates are not reused.
         m_downloader->clear();
+        m_downloader->max_download_size(m_resource_limits.max_download_size);
+        m_downloader->check_disk_space(m_check_disk_space);
+        m_downloader->preflight([this](uint64_t size,
+                                    std::filesystem::path const& location) {
+            if (!m_check_disk_space) {
+                return;
+            }
+            // The extracted size is not known yet, but archives rarely
+            // extract to less than their own size. A stored download
+            // needs space on its volume as well, in addition to that.
+            std::vector<std::pair<std::filesystem::path, uint64_t>> writes{
+                { m_manager->working_directory(), size }
+            };
+            if (!location.empty()) {
+                writes.emplace_back(location.has_parent_path()
+                        ? location.parent_path()
+                        : std::filesystem::path("."),
+                    size);
+            }
+            internal::require_free_space(writes);
+        });
         // TODO maybe separate the configuration and execution stage?
         // don't allow changing parameters once the updater has been created.
         m_downloader->base_url(url.base_url());
         for (auto const& [filename, func] : m_file_url_overrides) {
             m_downloader->override_file_url(filename, func(version));
         }
+        if (m_stream_extraction) {
+            return stream_update(version, url.filename());
+        }
         auto latest_release = m_downloader->get(url.filename());
-        return extract_archive(version, latest_release.path());
+        internal::verification_record record(latest_release.path());
+        std::optional<internal::verification_info> verification;
+        if (record.read()) {
+            verification = record.info();
+        }
+        auto result =
+            extract_archive(version, latest_release.path(), verification);
+        // The kept download is not needed anymore once it is installed.
+        std::error_code ec;
+        record.remove();
+        std::filesystem::remove(latest_release.path(), ec);
+        return result;
     }
 
     void check_url(file_url const& url, version_number const& version)
@@ -291,78 +390,176 @@ private:
         }
     }
 
+    // Downloads and extracts the update at the same time.
+    std::filesystem::path stream_update(
+        version_number const& version, std::string const& filename)
+    {
+        if (m_archive_type != archive_type::zip &&
+            m_archive_type != archive_type::tar_gz &&
+            m_archive_type != archive_type::tar_zst &&
+            m_archive_type != archive_type::tar_xz) {
+            throw std::runtime_error("archive type cannot be streamed");
+        }
+        auto staged = m_manager->staging_area().create();
+        auto const& temp_dir = staged.path();
+        internal::extraction_budget budget(m_resource_limits.max_extracted_size,
+            m_resource_limits.max_entry_count);
+        internal::streaming_extractor extractor(m_archive_type, temp_dir,
+            internal::streaming_extractor::default_capacity, &budget,
+            m_resource_limits);
+        internal::verification_info verification;
+        try {
+            verification = m_downloader->stream(
+                filename, [&](char const* data, size_t size) {
+                    return extractor.write(data, size);
+                });
+        }
+        catch (...) {
+            // The download is stopped when extraction fails,
+            // in which case the extraction error is the cause.
+            extractor.abort();
+            extractor.rethrow();
+            throw;
+        }
+        extractor.finish();
+        return install(version, staged, verification);
+    }
+
     std::filesystem::path extract_archive(version_number const& version,
-        std::filesystem::path const& archive_path) const
+        std::filesystem::path const& archive_path,
+        std::optional<internal::verification_info> const& verification) const
+    {
+        auto staged = m_manager->staging_area().create();
+        auto const& temp_dir = staged.path();
+        internal::extraction_budget budget(m_resource_limits.max_extracted_size,
+            m_resource_limits.max_entry_count);
+        bool flattened = false;
+        switch (m_archive_type) {
+        case archive_type::zip:
+        case archive_type::tar_gz:
+        case archive_type::tar_zst:
+        case archive_type::tar_xz:
+            if (m_check_disk_space) {
+                auto size =
+                    internal::extracted_size(m_archive_type, archive_path);
+                if (size.has_value()) {
+                    internal::require_free_space(
+                        { temp_dir, m_manager->working_directory() }, *size);
+                }
+            }
+            flattened = internal::extract_file(m_archive_type, archive_path,
+                temp_dir, m_flatten_root, &budget, m_resource_limits);
+            break;
+        default:
+            throw std::runtime_error("archive type not supported yet");
+        }
+        return install(version, staged, verification, flattened);
+    }
+
+    // Runs the content operations on the extracted content and moves it
+    // to the working directory. Returns the directory of the new version.
+    // Flattened is whether the root directory was omitted during extraction.
+    std::filesystem::path install(version_number const& version,
+        internal::staging_directory& staged,
+        std::optional<internal::verification_info> const& verification,
+        bool flattened = false) const
     {
+        auto temp_dir = staged.path();
         auto output_directory =
             m_manager->working_directory() / version.string();
+        // Read before the working directory is modified below.
+        auto installed = m_manager->version_index().read();
         if (std::filesystem::exists(output_directory)) {
             std::filesystem::remove_all(output_directory);
         }
         if (std::filesystem::exists(output_directory)) {
             throw std::runtime_error("update directory could not be cleared");
         }
-        auto temp_dir = internal::create_temporary_directory();
-        std::shared_ptr<void> defer(nullptr, std::bind([temp_dir] {
-            // Delete the temporary directory once this method terminates.
-            // Make sure it doesn't throw, as it's called in a destructor.
+        std::vector<internal::types::content_operation_func> content_operations;
+        if (m_flatten_root && !flattened) {
+            content_operations.push_back(
+                operations::flatten_extracted_directory());
+        }
+        content_operations.insert(content_operations.end(),
+            m_content_operations.begin(), m_content_operations.end());
+        for (auto const& operation : content_operations) {
             try {
-                std::filesystem::remove_all(temp_dir);
+                operation(temp_dir);
             }
-            catch (...) {
-            }
-        }));
-        switch (m_archive_type) {
-#ifdef WIN32
-        case archive_type::zip:
-            internal::zip_extract(archive_path, temp_dir);
-            for (auto const& operation : m_content_operations) {
-                try {
-                    operation(temp_dir);
-                }
-                catch (std::exception const& e) {
-                    throw std::runtime_error(
-                        std::string("content operation failed: ") + e.what());
-                }
+            catch (std::exception const& e) {
+                throw std::runtime_error(
+                    std::string("content operation failed: ") + e.what());
             }
-            // After the content has been verified, move it.
-            // That way only verified content can live in the working directory
-            // and the extracted directory is created there in one operation.
+        }
+        // After the content has been verified, move it.
+        // That way only verified content can live in the working directory
+        // and the extracted directory is created there in one operation.
+        // The staging area is in the working directory, so this is a rename.
+        try {
+            staged.commit(output_directory);
+        }
+        catch (...) {
+            // If moving the directory does not work, copy it recursively.
+            // This can happen if the staging area is a mount point
+            // on another volume. It is copied next to the output
+            // directory first, so it still appears in one operation.
+            auto staging = m_manager->working_directory() /
+                ("." + internal::unique_name());
+            auto defer_staging = remove_on_exit(staging);
+            internal::copy_tree(temp_dir, staging);
+            std::filesystem::rename(staging, output_directory);
+        }
+        for (auto const& operation : m_post_update_operations) {
             try {
-                std::filesystem::rename(temp_dir, output_directory);
+                operation(output_directory);
             }
-            catch (...) {
-                // If moving the directory does not work, copy it recursively.
-                // This can happen if the source and target directory
-                // are located on different volumes.
-                std::filesystem::copy(temp_dir, output_directory,
-                    std::filesystem::copy_options::recursive);
-            }
-            for (auto const& operation : m_post_update_operations) {
-                try {
-                    operation(output_directory);
-                }
-                catch (std::exception const& e) {
-                    throw std::runtime_error(
-                        std::string("post-update operation failed: ") +
-                        e.what());
-                }
+            catch (std::exception const& e) {
+                throw std::runtime_error(
+                    std::string("post-update operation failed: ") + e.what());
             }
-            create_sentinel_file(output_directory, version);
-            break;
-#endif
-        default:
-            throw std::runtime_error("archive type not supported yet");
         }
+        // Without a sentinel the version is not used if this is interrupted.
+        if (m_deduplicate_files) {
+            m_manager->object_store().link_files(output_directory);
+        }
+        // The sentinel may only reach the disk after the files it vouches for.
+        auto durability = m_manager->durability();
+        if (durability != update::durability::none) {
+            internal::sync_tree(output_directory, durability);
+            internal::sync_directory(m_manager->working_directory());
+        }
+        create_sentinel_file(output_directory, version, verification);
+        m_manager->version_index().update(installed, [&](auto& entries) {
+            internal::version_index::remove(entries, version.string());
+            entries.push_back({ version, version.string() });
+        });
         return output_directory;
     }
 
-    inline void create_sentinel_file(
-        std::filesystem::path directory, version_number const& version) const
+    // Deletes the given directory once the returned value is destructed.
+    static std::shared_ptr<void> remove_on_exit(
+        std::filesystem::path const& directory)
+    {
+        return std::shared_ptr<void>(nullptr, std::bind([directory] {
+            // Make sure it doesn't throw, as it's called in a destructor.
+            try {
+                std::filesystem::remove_all(directory);
+            }
+            catch (...) {
+            }
+        }));
+    }
+
+    inline void create_sentinel_file(std::filesystem::path directory,
+        version_number const& version,
+        std::optional<internal::verification_info> const& verification) const
     {
         internal::sentinel sentinel(directory);
         sentinel.version(version);
-        sentinel.write();
+        if (verification.has_value()) {
+            sentinel.verification(verification.value());
+        }
+        sentinel.write(m_manager->durability());
     }
 
     std::shared_ptr<ungive::update::manager> m_manager;
@@ -373,9 +570,14 @@ private:
     std::optional<std::regex> m_download_url_pattern{};
     internal::types::latest_retriever_func m_latest_retriever_func{};
     std::vector<internal::types::content_operation_func> m_content_operations{};
+    bool m_flatten_root{ false };
     std::vector<internal::types::content_operation_func>
         m_post_update_operations{};
     std::optional<bool> m_filename_contains_version{};
+    bool m_stream_extraction{ false };
+    update::resource_limits m_resource_limits{};
+    bool m_check_disk_space{ true };
+    bool m_deduplicate_files{ false };
     std::unordered_map<std::string,
         std::function<std::string(version_number const& version)>>
         m_file_url_overrides;
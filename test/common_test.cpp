@@ -1,10 +1,18 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <openssl/pem.h>
 
 #include "ungive/update/updater.hpp"
 
 using namespace ungive::update;
 
+// The public key of the test releases, which is shared by all test files.
+const char* PUBLIC_KEY = R"key(
+-----BEGIN PUBLIC KEY-----
+MCowBQYDK2VwAyEAIcbwANvTnDDB6KqmrL64/jEApW41sA//feKQYQMjGeU=
+-----END PUBLIC KEY-----
+)key";
+
 TEST(version_number, ComparisonWorksWhenComparingTwoIdenticalLengthVersions)
 {
     EXPECT_TRUE(version_number({ 1, 2, 2 }) < version_number({ 1, 2, 3 }));
@@ -79,3 +87,1407 @@ fef29d7f40be8d62c6ea654404275e7d4776f055edc7b18e65923fbbab53cfaa *music-presence
     EXPECT_EQ("music-presence-2.2.2-win64.exe", res[2].second);
     EXPECT_EQ("music-presence-2.2.2-win64.zip", res[3].second);
 }
+
+TEST(task_group, AllTasksAreExecutedWhenNoTaskFails)
+{
+    std::atomic<int> count{ 0 };
+    internal::task_group group;
+    for (int i = 0; i < 64; i++) {
+        group.add([&](auto const&) {
+            count += 1;
+        });
+    }
+    EXPECT_NO_THROW(group.run());
+    EXPECT_EQ(64, count.load());
+}
+
+TEST(task_group, ExceptionIsRethrownAndOtherTasksCancelledWhenTaskFails)
+{
+    std::atomic<bool> observed_cancel{ false };
+    internal::thread_pool pool(2);
+    internal::task_group group(pool);
+    group.add([&](std::atomic<bool> const& cancelled) {
+        while (!cancelled.load()) {
+            std::this_thread::yield();
+        }
+        observed_cancel = true;
+    });
+    group.add([](auto const&) {
+        throw verifiers::verification_failed("failed");
+    });
+    EXPECT_THROW(group.run(), verifiers::verification_failed);
+    EXPECT_TRUE(observed_cancel.load());
+}
+
+TEST(task_group, BatchesCoverAllItemsOnceAndRespectTheirLimits)
+{
+    std::vector<std::atomic<int>> seen(100);
+    std::vector<uint64_t> weights(100, 1);
+    weights[10] = 50;
+    std::mutex mutex;
+    std::vector<std::pair<size_t, size_t>> batches;
+    internal::task_group group;
+    group.add_batches(
+        seen.size(), 16,
+        [&](size_t begin, size_t end, auto const&) {
+            for (auto i = begin; i < end; i++) {
+                seen[i] += 1;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            batches.emplace_back(begin, end);
+        },
+        [&](size_t i) {
+            return weights[i];
+        },
+        8);
+    group.run();
+    for (auto const& count : seen) {
+        EXPECT_EQ(1, count.load());
+    }
+    std::sort(batches.begin(), batches.end());
+    // The heavy item ends its batch early.
+    EXPECT_EQ(8, batches[1].first);
+    EXPECT_EQ(11, batches[1].second);
+    for (auto const& [begin, end] : batches) {
+        EXPECT_LE(end - begin, 8);
+    }
+}
+
+TEST(sha256_files, HashesMatchWhenHashingFilesConcurrently)
+{
+    auto directory = internal::create_temporary_directory();
+    std::vector<std::filesystem::path> paths;
+    for (int i = 0; i < 8; i++) {
+        paths.push_back(directory / std::to_string(i));
+        internal::write_file(paths.back(), std::string(i * 4096, 'a' + i));
+    }
+    auto hashes = internal::crypto::sha256_files(paths);
+    ASSERT_EQ(paths.size(), hashes.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        EXPECT_EQ(internal::crypto::sha256_file(paths[i]), hashes[i]);
+    }
+    std::filesystem::remove_all(directory);
+}
+
+TEST(blake3, HashMatchesTestVectors)
+{
+    internal::blake3::hasher empty;
+    EXPECT_EQ(
+        "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262",
+        empty.hexdigest());
+    internal::blake3::hasher abc;
+    abc.update("abc", 3);
+    EXPECT_EQ(
+        "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85",
+        abc.hexdigest());
+}
+
+TEST(blake3, HashMatchesTestVectorsWhenInputHasMultipleChunks)
+{
+    // From the official test vectors, where byte i of the input is i % 251.
+    std::vector<std::pair<size_t, std::string>> vectors{
+        { 1023,
+            "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11" },
+        { 1024,
+            "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7" },
+        { 1025,
+            "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" },
+        { 2049,
+            "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030" },
+        { 3073,
+            "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3" },
+        { 8192,
+            "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63" },
+        { 8193,
+            "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b" },
+        { 31744,
+            "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47" },
+        { 102400,
+            "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085" },
+    };
+    for (auto const& [size, expected] : vectors) {
+        std::string input(size, '\0');
+        for (size_t i = 0; i < size; i++) {
+            input[i] = static_cast<char>(i % 251);
+        }
+        internal::blake3::hasher whole;
+        whole.update(input.data(), input.size());
+        EXPECT_EQ(expected, whole.hexdigest()) << size;
+        // Updates which do not end on chunk boundaries.
+        internal::blake3::hasher pieces;
+        for (size_t i = 0; i < size; i += 1000) {
+            pieces.update(input.data() + i, std::min<size_t>(1000, size - i));
+        }
+        EXPECT_EQ(expected, pieces.hexdigest()) << size;
+    }
+}
+
+TEST(blake3, FileHashMatchesIncrementalHashWhenFileHasMultipleSubtrees)
+{
+    auto directory = internal::create_temporary_directory();
+    std::string content(3 * internal::blake3::subtree_len + 5, '\0');
+    for (size_t i = 0; i < content.size(); i++) {
+        content[i] = static_cast<char>(i % 251);
+    }
+    internal::write_file(directory / "file", content);
+    internal::blake3::hasher hasher;
+    hasher.update(content.data(), content.size());
+    EXPECT_EQ(hasher.hexdigest(),
+        internal::crypto::blake3_file(directory / "file"));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(parse_b3sums, ParsesB3Sums)
+{
+    const char* sums = "b76b0958634d3f0e0140f294373615d88f1d36ed1f65c720605b6ca9"
+                       "d0160f11  release-1.2.3.zip\n"
+                       "\\c4aaf74e72909e677dcbbbab47c867a16a921d5699d69ffdd50df"
+                       "9fa672b2c7b  dir\\\\name\r\n";
+    auto res = internal::crypto::parse_b3sums(sums);
+    ASSERT_EQ(2, res.size());
+    EXPECT_EQ(
+        "b76b0958634d3f0e0140f294373615d88f1d36ed1f65c720605b6ca9d0160f11",
+        res[0].first);
+    EXPECT_EQ("release-1.2.3.zip", res[0].second);
+    EXPECT_EQ(
+        "c4aaf74e72909e677dcbbbab47c867a16a921d5699d69ffdd50df9fa672b2c7b",
+        res[1].first);
+    EXPECT_EQ("dir\\name", res[1].second);
+}
+
+TEST(merkle_root, RootMatchesWhenNumberOfLeavesIsOdd)
+{
+    std::vector<std::string> digests{
+        "ca978112ca1bbdcafac231b39a23dc4da786eff8147c4e72b9807785afee48bb",
+        "3e23e8160039594a33894f6564e1b1348bbd7a0088d42c4acb73eeaed59c009d",
+        "2e7d2c03a9507ae265ecf5b5356885a53393a2029d241394997265a1a25aefc6"
+    };
+    EXPECT_EQ(digests[0], internal::crypto::merkle_root({ digests[0] }));
+    EXPECT_EQ(
+        "7075152d03a5cd92104887b476862778ec0c87be5c2fa1c0a90f87c49fad6eff",
+        internal::crypto::merkle_root(digests));
+}
+
+TEST(chunk_manifest, ParsedManifestMatchesWhenManifestWasEncoded)
+{
+    auto directory = internal::create_temporary_directory();
+    internal::write_file(directory / "file.bin", std::string(2500, 'x'));
+    auto manifest =
+        internal::chunk_manifest::create(directory / "file.bin", 1024);
+    auto parsed = internal::chunk_manifest::parse(manifest.encode());
+    EXPECT_EQ("file.bin", parsed.file());
+    EXPECT_EQ(2500, parsed.layout().size);
+    EXPECT_EQ(1024, parsed.layout().chunk_size);
+    ASSERT_EQ(3, parsed.layout().digests.size());
+    EXPECT_EQ(manifest.layout().digests, parsed.layout().digests);
+    EXPECT_EQ(internal::crypto::merkle_root(parsed.layout().digests),
+        parsed.layout().root);
+    EXPECT_ANY_THROW(internal::chunk_manifest::parse(
+        "file=file.bin\nsize=2500\nchunk_size=1024\nroot=" +
+        parsed.layout().root + "\nchunk=" + parsed.layout().digests[0] + "\n"));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(chunk_hasher, OnlyModifiedChunkIsReportedWhenDataIsCorrupted)
+{
+    auto directory = internal::create_temporary_directory();
+    std::string content(10 * 1000 + 7, '\0');
+    for (size_t i = 0; i < content.size(); i++) {
+        content[i] = static_cast<char>(i % 251);
+    }
+    internal::write_file(directory / "file.bin", content);
+    auto layout =
+        internal::chunk_manifest::create(directory / "file.bin", 1000).layout();
+    content[4321] ^= 1;
+    internal::chunk_hasher hasher(layout);
+    for (size_t i = 0; i < content.size(); i += 333) {
+        auto size = std::min<size_t>(333, content.size() - i);
+        hasher.update(content.data() + i, size);
+    }
+    EXPECT_EQ(std::vector<size_t>{ 4 }, hasher.finish());
+    content[4321] ^= 1;
+    EXPECT_TRUE(hasher.replace(4, content.substr(4000, 1000)));
+    EXPECT_EQ(layout.root, internal::crypto::merkle_root(hasher.digests()));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(chunk_hasher, LastChunkIsReportedWhenDataIsAppended)
+{
+    auto directory = internal::create_temporary_directory();
+    std::string content(2500, 'a');
+    internal::write_file(directory / "file.bin", content);
+    auto layout =
+        internal::chunk_manifest::create(directory / "file.bin", 1000).layout();
+    internal::chunk_hasher hasher(layout);
+    hasher.update(content.data(), content.size());
+    hasher.update("appended", 8);
+    EXPECT_EQ(std::vector<size_t>{ 2 }, hasher.finish());
+    EXPECT_EQ(8, hasher.overflow());
+    std::filesystem::remove_all(directory);
+}
+
+TEST(verifiers, IdentityChangesWhenPublicKeyOrAlgorithmChanges)
+{
+    auto create = [](std::string const& type, std::string const& key) {
+        return verifiers::message_digest(
+            "SHA256SUMS", "SHA256SUMS.sig", "PEM", type, key);
+    };
+    EXPECT_FALSE(create("ED25519", "a").id().empty());
+    EXPECT_EQ(create("ED25519", "a").id(), create("ED25519", "a").id());
+    EXPECT_NE(create("ED25519", "a").id(), create("ED25519", "b").id());
+    EXPECT_NE(create("ED25519", "a").id(), create("RSA", "a").id());
+    EXPECT_NE(verifiers::sha256sums("SUMS").id(),
+        verifiers::b3sums("SUMS").id());
+}
+
+TEST(record_digest_cache, DigestIsReusedWhenFileIsUnchanged)
+{
+    auto directory = internal::create_temporary_directory();
+    auto file = directory / "file.bin";
+    internal::write_file(file, "content");
+    size_t computed = 0;
+    auto compute = [&] {
+        computed++;
+        return internal::crypto::sha256_file(file);
+    };
+    {
+        internal::record_digest_cache cache;
+        cache.get(file, "SHA256", compute);
+        cache.commit(file, { "verifier" });
+    }
+    internal::record_digest_cache cache;
+    EXPECT_EQ(internal::crypto::sha256_file(file),
+        cache.get(file, "SHA256", compute));
+    EXPECT_EQ(1, computed);
+    internal::write_file(file, "modified content");
+    internal::record_digest_cache modified;
+    EXPECT_EQ(internal::crypto::sha256_file(file),
+        modified.get(file, "SHA256", compute));
+    EXPECT_EQ(2, computed);
+    internal::record_digest_cache reverify(false);
+    reverify.get(file, "SHA256", compute);
+    EXPECT_EQ(3, computed);
+    std::filesystem::remove_all(directory);
+}
+
+// Takes files from disk instead of downloading them,
+// which makes the downloader usable without network access.
+struct offline_downloader : public http_downloader
+{
+    using http_downloader::http_downloader;
+
+    // Makes get() return the file, as if it was downloaded to the location.
+    void set_content(std::string const& path, std::string const& content,
+        std::filesystem::path location = {})
+    {
+        if (location.empty()) {
+            location = cwd() / internal::random_string(8) /
+                internal::strip_leading_slash(path);
+        }
+        internal::write_file(location, content);
+        m_downloaded_files.emplace(path, downloaded_file(location));
+    }
+};
+
+TEST(http_downloader, KeptDownloadIsReusedWhenItWasVerifiedBefore)
+{
+    auto directory = internal::create_temporary_directory();
+    std::string content = "Release file for version 1.2.3";
+    auto sums = internal::crypto::sha256(content.data(), content.size()) +
+        " *release-1.2.3.txt\n";
+    auto path = directory / "release-1.2.3.txt";
+    {
+        offline_downloader downloader("https://example.com");
+        downloader.download_directory(directory);
+        downloader.add_verification(verifiers::sha256sums("SHA256SUMS.txt"));
+        downloader.set_content("SHA256SUMS.txt", sums);
+        downloader.set_content("release-1.2.3.txt", content, path);
+        EXPECT_EQ(path, downloader.get("release-1.2.3.txt").path());
+    }
+    EXPECT_TRUE(std::filesystem::exists(path));
+    internal::verification_record record(path);
+    ASSERT_TRUE(record.read());
+    EXPECT_EQ(1, record.info().digests.count("SHA256"));
+    EXPECT_EQ(1, record.info().verifiers.size());
+    auto stat = internal::file_stat::of(path);
+    {
+        // Nothing is downloaded, since the file is reused.
+        offline_downloader downloader("https://example.com");
+        downloader.download_directory(directory);
+        downloader.add_verification(verifiers::sha256sums("SHA256SUMS.txt"));
+        downloader.set_content("SHA256SUMS.txt", sums);
+        EXPECT_EQ(path, downloader.get("release-1.2.3.txt").path());
+    }
+    EXPECT_EQ(stat, internal::file_stat::of(path));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(sentinel, VerificationIsReadWhenItWasWritten)
+{
+    auto directory = internal::create_temporary_directory();
+    internal::verification_info info;
+    info.size = 42;
+    info.digests["SHA256"] = "abc";
+    info.verifiers.push_back("sha256sums:SHA256SUMS");
+    internal::sentinel written(directory);
+    written.version(version_number(1, 1, 2));
+    written.verification(info);
+    written.write();
+    internal::sentinel sentinel(directory);
+    ASSERT_TRUE(sentinel.read());
+    ASSERT_TRUE(sentinel.verification().has_value());
+    EXPECT_EQ(42, sentinel.verification()->size);
+    EXPECT_EQ(info.digests, sentinel.verification()->digests);
+    EXPECT_EQ(info.verifiers, sentinel.verification()->verifiers);
+    std::filesystem::remove_all(directory);
+}
+
+
+TEST(parse_file_manifest, RejectsPathsWhichLeaveTheDirectory)
+{
+    std::string digest(64, 'a');
+    auto entries = internal::parse_file_manifest(
+        digest + " 12 app.exe\r\n" + digest + " 0 lib/file name.txt\n");
+    ASSERT_EQ(2, entries.size());
+    EXPECT_EQ("app.exe", entries[0].path);
+    EXPECT_EQ(12, entries[0].size);
+    EXPECT_EQ("lib/file name.txt", entries[1].path);
+    EXPECT_EQ(0, entries[1].size);
+    EXPECT_ANY_THROW(internal::parse_file_manifest(digest + " 1 ../x"));
+    EXPECT_ANY_THROW(internal::parse_file_manifest(digest + " 1 /etc/x"));
+    EXPECT_ANY_THROW(internal::parse_file_manifest(digest + " 1 a/./x"));
+}
+
+// Generates an Ed25519 key pair for signing test content.
+class test_signing_key
+{
+public:
+    test_signing_key() : m_key{ EVP_PKEY_Q_keygen(NULL, NULL, "ED25519") }
+    {
+        if (m_key == nullptr) {
+            throw std::runtime_error("failed to generate key");
+        }
+    }
+
+    ~test_signing_key() { EVP_PKEY_free(m_key); }
+
+    std::string public_key_pem() const
+    {
+        BIO* bio = BIO_new(BIO_s_mem());
+        PEM_write_bio_PUBKEY(bio, m_key);
+        char* data = nullptr;
+        auto length = BIO_get_mem_data(bio, &data);
+        std::string result(data, length);
+        BIO_free(bio);
+        return result;
+    }
+
+    std::string sign(std::string const& message) const
+    {
+        auto ctx = internal::crypto::create_digest_context();
+        size_t length = 0;
+        EVP_DigestSignInit(ctx.get(), NULL, NULL, NULL, m_key);
+        EVP_DigestSign(ctx.get(), NULL, &length,
+            reinterpret_cast<unsigned char const*>(message.data()),
+            message.size());
+        std::string result(length, '\0');
+        EVP_DigestSign(ctx.get(),
+            reinterpret_cast<unsigned char*>(result.data()), &length,
+            reinterpret_cast<unsigned char const*>(message.data()),
+            message.size());
+        return result;
+    }
+
+private:
+    EVP_PKEY* m_key;
+};
+
+static std::filesystem::path create_signed_tree(test_signing_key const& key)
+{
+    auto directory = internal::create_temporary_directory();
+    internal::write_file(directory / "app.exe", "executable");
+    internal::write_file(directory / "lib" / "a.dll", "library a");
+    internal::write_file(directory / "lib" / "b.dll", "library b");
+    auto manifest = internal::create_file_manifest(directory);
+    internal::write_file(directory / "MANIFEST", manifest);
+    internal::write_file(directory / "MANIFEST.sig", key.sign(manifest));
+    return directory;
+}
+
+TEST(operations, VerifyFileManifestSucceedsWhenTreeMatches)
+{
+    test_signing_key key;
+    auto directory = create_signed_tree(key);
+    operations::verify_file_manifest operation(
+        "MANIFEST", "MANIFEST.sig", "PEM", "ED25519", key.public_key_pem());
+    EXPECT_NO_THROW(operation(directory));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(operations, VerifyFileManifestFailsWhenFileIsModifiedMissingOrExtra)
+{
+    test_signing_key key;
+    operations::verify_file_manifest operation(
+        "MANIFEST", "MANIFEST.sig", "PEM", "ED25519", key.public_key_pem());
+    auto modified = create_signed_tree(key);
+    internal::write_file(modified / "lib" / "a.dll", "library x");
+    EXPECT_THROW(operation(modified), verifiers::verification_failed);
+    auto missing = create_signed_tree(key);
+    std::filesystem::remove(missing / "lib" / "b.dll");
+    EXPECT_THROW(operation(missing), verifiers::verification_failed);
+    auto extra = create_signed_tree(key);
+    internal::write_file(extra / "lib" / "c.dll", "library c");
+    EXPECT_THROW(operation(extra), verifiers::verification_failed);
+    test_signing_key other_key;
+    operations::verify_file_manifest other("MANIFEST", "MANIFEST.sig", "PEM",
+        "ED25519", other_key.public_key_pem());
+    auto unsigned_tree = create_signed_tree(key);
+    EXPECT_THROW(other(unsigned_tree), verifiers::verification_failed);
+    for (auto const& directory : { modified, missing, extra, unsigned_tree }) {
+        std::filesystem::remove_all(directory);
+    }
+}
+
+#ifndef WIN32
+TEST(operations, VerifyFileManifestFailsWhenTreeContainsSymbolicLink)
+{
+    test_signing_key key;
+    operations::verify_file_manifest operation(
+        "MANIFEST", "MANIFEST.sig", "PEM", "ED25519", key.public_key_pem());
+    auto directory = create_signed_tree(key);
+    std::filesystem::create_directory_symlink(
+        directory / "lib", directory / "link");
+    EXPECT_ANY_THROW(operation(directory));
+    EXPECT_ANY_THROW(internal::create_file_manifest(directory));
+    std::filesystem::remove_all(directory);
+}
+#endif
+
+TEST(byte_pipe, ReaderReceivesAllDataWhenPipeIsSmallerThanData)
+{
+    internal::byte_pipe pipe(7);
+    std::string data(10000, '\0');
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<char>(i % 251);
+    }
+    std::thread writer([&] {
+        EXPECT_TRUE(pipe.write(data.data(), data.size()));
+        pipe.close();
+    });
+    std::string received;
+    char buffer[13];
+    while (auto n = pipe.read(buffer, sizeof(buffer))) {
+        received.append(buffer, n);
+    }
+    writer.join();
+    EXPECT_EQ(data, received);
+}
+
+static auto TEST_FILES =
+    std::filesystem::path(__FILE__).parent_path() / "test_files";
+
+TEST(streaming_extractor, ZipIsExtractedWhenWrittenInSmallParts)
+{
+    auto directory = internal::create_temporary_directory();
+    auto data = internal::read_file(
+        TEST_FILES / "release-1.2.3-streamed.zip", std::ios::binary);
+    internal::streaming_extractor extractor(
+        archive_type::zip, directory, 16);
+    for (size_t i = 0; i < data.size(); i += 5) {
+        auto size = std::min<size_t>(5, data.size() - i);
+        ASSERT_TRUE(extractor.write(data.data() + i, size));
+    }
+    extractor.finish();
+    std::string expected;
+    for (int i = 0; i < 100; i++) {
+        expected += "release-1.2.3\n";
+    }
+    EXPECT_EQ(expected,
+        internal::read_file(directory / "release-1.2.3" / "release-1.2.3.txt",
+            std::ios::binary));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(zip_reader, EntriesAreReadFromCentralDirectory)
+{
+    internal::zip_reader reader(TEST_FILES / "release-1.2.3-streamed.zip");
+    auto const& entries = reader.entries();
+    ASSERT_EQ(2, entries.size());
+    EXPECT_EQ("release-1.2.3/", entries[0].name);
+    EXPECT_TRUE(entries[0].is_directory());
+    EXPECT_EQ("release-1.2.3/release-1.2.3.txt", entries[1].name);
+    EXPECT_EQ(internal::zip_method_deflated, entries[1].method);
+    EXPECT_EQ(1400, entries[1].uncompressed_size);
+}
+
+TEST(zip_reader, FileExistsWhenExtractingZip)
+{
+    auto directory = internal::create_temporary_directory();
+    internal::zip_file_extract(TEST_FILES / "release-1.2.3.zip", directory);
+    EXPECT_EQ("Release file for version 1.2.3",
+        internal::read_file(
+            directory / "release-1.2.3.txt", std::ios::binary));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(zip_reader, FileExistsWhenExtractingDeflatedZipWithSubfolder)
+{
+    auto directory = internal::create_temporary_directory();
+    internal::zip_file_extract(
+        TEST_FILES / "release-1.2.3-streamed.zip", directory);
+    std::string expected;
+    for (int i = 0; i < 100; i++) {
+        expected += "release-1.2.3\n";
+    }
+    EXPECT_EQ(expected,
+        internal::read_file(directory / "release-1.2.3" / "release-1.2.3.txt",
+            std::ios::binary));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(zip_reader, FilesAreExtractedWhenUsingSeparateThreadPool)
+{
+    auto directory = internal::create_temporary_directory();
+    internal::thread_pool pool(4);
+    internal::zip_reader reader(TEST_FILES / "release-1.2.3-streamed.zip");
+    reader.extract_all(directory, pool);
+    EXPECT_EQ(1400,
+        std::filesystem::file_size(
+            directory / "release-1.2.3" / "release-1.2.3.txt"));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(zip_reader, RootDirectoryIsOmittedWhenStrippingIt)
+{
+    auto directory = internal::create_temporary_directory();
+    EXPECT_TRUE(internal::zip_file_extract(
+        TEST_FILES / "release-1.2.3-streamed.zip", directory, true));
+    EXPECT_TRUE(std::filesystem::exists(directory / "release-1.2.3.txt"));
+    EXPECT_FALSE(std::filesystem::exists(directory / "release-1.2.3"));
+    EXPECT_FALSE(internal::zip_file_extract(
+        TEST_FILES / "release-1.2.3.zip", directory / "flat", true));
+    EXPECT_TRUE(
+        std::filesystem::exists(directory / "flat" / "release-1.2.3.txt"));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(zip_reader, NothingIsExtractedWhenArchiveExceedsBudget)
+{
+    auto directory = internal::create_temporary_directory();
+    internal::extraction_budget budget(1000, 10);
+    EXPECT_ANY_THROW(internal::zip_file_extract(
+        TEST_FILES / "release-1.2.3-streamed.zip", directory, false, &budget));
+    EXPECT_TRUE(std::filesystem::is_empty(directory));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(zip_reader, ThrowsWhenEntryIsCorrupted)
+{
+    auto directory = internal::create_temporary_directory();
+    auto data = internal::read_file(
+        TEST_FILES / "release-1.2.3.zip", std::ios::binary);
+    auto content = data.find("Release file");
+    ASSERT_NE(std::string::npos, content);
+    data[content] = 'r';
+    auto path = directory / "corrupted.zip";
+    std::ofstream(path, std::ios::binary) << data;
+    EXPECT_ANY_THROW(internal::zip_file_extract(path, directory / "out"));
+    std::filesystem::remove_all(directory);
+}
+
+// Creates a ZIP archive with stored entries in the order they are given.
+static std::string stored_zip(
+    std::vector<std::pair<std::string, std::string>> const& entries)
+{
+    auto le = [](std::string& out, uint32_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+    };
+    std::string data;
+    std::string directory;
+    for (auto const& [name, content] : entries) {
+        auto crc = static_cast<uint32_t>(crc32(0L,
+            reinterpret_cast<Bytef const*>(content.data()),
+            static_cast<uInt>(content.size())));
+        auto size = static_cast<uint32_t>(content.size());
+        auto offset = static_cast<uint32_t>(data.size());
+        le(data, 0x04034b50, 4);
+        le(data, 20, 2);
+        le(data, 0, 2);
+        le(data, 0, 2);
+        le(data, 0, 4);
+        le(data, crc, 4);
+        le(data, size, 4);
+        le(data, size, 4);
+        le(data, static_cast<uint32_t>(name.size()), 2);
+        le(data, 0, 2);
+        data += name + content;
+        le(directory, 0x02014b50, 4);
+        le(directory, 20, 2);
+        le(directory, 20, 2);
+        le(directory, 0, 2);
+        le(directory, 0, 2);
+        le(directory, 0, 4);
+        le(directory, crc, 4);
+        le(directory, size, 4);
+        le(directory, size, 4);
+        le(directory, static_cast<uint32_t>(name.size()), 2);
+        le(directory, 0, 2);
+        le(directory, 0, 2);
+        le(directory, 0, 2);
+        le(directory, 0, 2);
+        le(directory, 0, 4);
+        le(directory, offset, 4);
+        directory += name;
+    }
+    auto directory_offset = static_cast<uint32_t>(data.size());
+    data += directory;
+    le(data, 0x06054b50, 4);
+    le(data, 0, 2);
+    le(data, 0, 2);
+    le(data, static_cast<uint32_t>(entries.size()), 2);
+    le(data, static_cast<uint32_t>(entries.size()), 2);
+    le(data, static_cast<uint32_t>(directory.size()), 4);
+    le(data, directory_offset, 4);
+    le(data, 0, 2);
+    return data;
+}
+
+TEST(zip_reader, LastEntryIsExtractedWhenNameIsRepeated)
+{
+    auto directory = internal::create_temporary_directory();
+    // Larger than a batch, so that both entries are written concurrently.
+    std::string first(5 * 1024 * 1024, 'a');
+    auto path = directory / "repeated.zip";
+    std::ofstream(path, std::ios::binary) << stored_zip({ { "a.txt", first },
+        { "b.txt", "b" }, { "a.txt", "last" } });
+    internal::thread_pool pool(4);
+    internal::zip_reader reader(path);
+    reader.extract_all(directory / "out", pool);
+    EXPECT_EQ("last",
+        internal::read_file(directory / "out" / "a.txt", std::ios::binary));
+    EXPECT_EQ("b",
+        internal::read_file(directory / "out" / "b.txt", std::ios::binary));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(zip_reader, LastEntryIsExtractedWhenNamesOnlyDifferInCase)
+{
+    auto directory = internal::create_temporary_directory();
+    std::string first(5 * 1024 * 1024, 'a');
+    auto path = directory / "case.zip";
+    std::ofstream(path, std::ios::binary)
+        << stored_zip({ { "dir/A.txt", first }, { "DIR/a.txt", "last" } });
+    internal::thread_pool pool(4);
+    internal::zip_reader reader(path);
+    reader.extract_all(directory / "out", pool);
+    // Case-sensitive file systems keep both entries.
+    auto name = std::filesystem::exists(directory / "out" / "DIR" / "a.txt")
+        ? std::filesystem::path("DIR") / "a.txt"
+        : std::filesystem::path("dir") / "A.txt";
+    EXPECT_EQ("last",
+        internal::read_file(directory / "out" / name, std::ios::binary));
+    std::filesystem::remove_all(directory);
+}
+
+static std::string tar_entry(std::string const& name,
+    std::string const& content, char type = '0', std::string const& link = "",
+    unsigned mode = 0644)
+{
+    std::string header(internal::tar_block_size, '\0');
+    std::copy(name.begin(), name.end(), header.begin());
+    std::copy(link.begin(), link.end(), header.begin() + 157);
+    std::snprintf(header.data() + 100, 8, "%07o", mode);
+    std::snprintf(header.data() + 124, 12, "%011o",
+        static_cast<unsigned>(content.size()));
+    header[156] = type;
+    std::copy_n("ustar", 6, header.data() + 257);
+    std::fill_n(header.data() + 148, 8, ' ');
+    unsigned checksum = 0;
+    for (auto c : header) {
+        checksum += static_cast<unsigned char>(c);
+    }
+    std::snprintf(header.data() + 148, 8, "%06o", checksum);
+    auto padding = (512 - content.size() % 512) % 512;
+    return header + content + std::string(padding, '\0');
+}
+
+static std::string gzip(std::string const& data)
+{
+    z_stream stream{};
+    EXPECT_EQ(Z_OK,
+        deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+            MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY));
+    std::string result(deflateBound(&stream, data.size()), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(result.data());
+    stream.avail_out = static_cast<uInt>(result.size());
+    EXPECT_EQ(Z_STREAM_END, deflate(&stream, Z_FINISH));
+    result.resize(stream.total_out);
+    deflateEnd(&stream);
+    return result;
+}
+
+static void extract_tar(archive_type type, std::string const& data,
+    std::filesystem::path const& directory,
+    resource_limits const& limits = {})
+{
+    size_t offset = 0;
+    internal::extract_stream(
+        type,
+        [&](char* buffer, size_t size) {
+            auto n = std::min(size, data.size() - offset);
+            std::copy_n(data.data() + offset, n, buffer);
+            offset += n;
+            return n;
+        },
+        directory, nullptr, limits);
+}
+
+static void extract_tar_gz(
+    std::string const& data, std::filesystem::path const& directory)
+{
+    extract_tar(archive_type::tar_gz, data, directory);
+}
+
+TEST(extract_stream, TarGzIsExtractedWhenItContainsLongNames)
+{
+    auto directory = internal::create_temporary_directory();
+    std::string long_name = "app/" + std::string(120, 'x') + ".txt";
+    auto tar = tar_entry("app/", "", '5') + tar_entry("app/a.txt", "a") +
+        tar_entry("././@LongLink", long_name + '\0', 'L') +
+        tar_entry(long_name.substr(0, 99), std::string(1000, 'b')) +
+        std::string(1024, '\0');
+    extract_tar_gz(gzip(tar), directory);
+    EXPECT_EQ("a", internal::read_file(directory / "app" / "a.txt"));
+    EXPECT_EQ(std::string(1000, 'b'),
+        internal::read_file(directory / std::filesystem::u8path(long_name)));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(extract_stream, TarIsExtractedWhenNamesStartWithCurrentDirectory)
+{
+    auto directory = internal::create_temporary_directory();
+    // Created like with "tar -C dist -czf release.tar.gz .".
+    auto tar = tar_entry("./", "", '5') + tar_entry("./app/", "", '5') +
+        tar_entry("./app/a.txt", "a") + tar_entry(".//b.txt", "b") +
+        std::string(1024, '\0');
+    extract_tar_gz(gzip(tar), directory);
+    EXPECT_EQ("a", internal::read_file(directory / "app" / "a.txt"));
+    EXPECT_EQ("b", internal::read_file(directory / "b.txt"));
+    auto evil = tar_entry("./../evil.txt", "evil") + std::string(1024, '\0');
+    EXPECT_ANY_THROW(extract_tar_gz(gzip(evil), directory));
+    EXPECT_FALSE(std::filesystem::exists(directory.parent_path() / "evil.txt"));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(extract_stream, ThrowsWhenTarEntryLeavesTheDirectory)
+{
+    auto directory = internal::create_temporary_directory();
+    auto tar = tar_entry("../evil.txt", "evil") + std::string(1024, '\0');
+    EXPECT_ANY_THROW(extract_tar_gz(gzip(tar), directory));
+    EXPECT_FALSE(std::filesystem::exists(directory.parent_path() / "evil.txt"));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(extract_stream, ThrowsWhenTarExceedsEntryLimit)
+{
+    auto directory = internal::create_temporary_directory();
+    auto tar = tar_entry("a.txt", "a") + tar_entry("b.txt", "b") +
+        tar_entry("c.txt", "c") + std::string(1024, '\0');
+    internal::extraction_budget budget(1000, 2);
+    size_t offset = 0;
+    EXPECT_ANY_THROW(internal::extract_stream(
+        archive_type::tar_gz,
+        [&, data = gzip(tar)](char* buffer, size_t size) {
+            auto n = std::min(size, data.size() - offset);
+            std::copy_n(data.data() + offset, n, buffer);
+            offset += n;
+            return n;
+        },
+        directory, &budget));
+    EXPECT_FALSE(std::filesystem::exists(directory / "c.txt"));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(extract_stream, LaterTarEntryWinsWhenNamesRepeat)
+{
+    auto directory = internal::create_temporary_directory();
+    std::string large(internal::batch_writer::max_file_size + 1, 'l');
+    auto tar = tar_entry("a.txt", "small") + tar_entry("a.txt", large) +
+        tar_entry("b.txt", large) + tar_entry("b.txt", "small") +
+        std::string(1024, '\0');
+    extract_tar_gz(gzip(tar), directory);
+    EXPECT_EQ(large, internal::read_file(directory / "a.txt"));
+    EXPECT_EQ("small", internal::read_file(directory / "b.txt"));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(batch_writer, FilesAreWrittenWithEachBackend)
+{
+    using backend = internal::batch_writer::backend;
+    for (auto type : { backend::thread_pool, backend::automatic }) {
+        auto directory = internal::create_temporary_directory();
+        internal::batch_writer writer(type);
+        for (int i = 0; i < 1100; i++) {
+            writer.add(directory / ("dir" + std::to_string(i % 7)) /
+                    ("file" + std::to_string(i)),
+                std::to_string(i), 0640);
+        }
+        writer.add(directory / "dir0" / "file0", "again");
+        writer.finish();
+        EXPECT_EQ("again", internal::read_file(directory / "dir0" / "file0"));
+        EXPECT_EQ("1099", internal::read_file(directory / "dir0" / "file1099"));
+#ifndef WIN32
+        auto status = std::filesystem::status(directory / "dir1" / "file1");
+        EXPECT_EQ(static_cast<std::filesystem::perms>(0640),
+            status.permissions());
+#endif
+        std::filesystem::remove_all(directory);
+    }
+}
+
+TEST(copy_tree, TreeIsCopiedWithPermissions)
+{
+    namespace fs = std::filesystem;
+    auto source = internal::create_temporary_directory();
+    auto target = internal::create_temporary_directory() / "copy";
+    internal::write_file(source / "a.txt", "a");
+    internal::write_file(source / "sub" / "dir" / "b.txt", "b");
+    internal::write_file(source / "run", std::string(100000, 'r'));
+    fs::permissions(
+        source / "run", fs::perms::owner_exec, fs::perm_options::add);
+#ifndef WIN32
+    fs::create_symlink("a.txt", source / "link");
+#endif
+    internal::copy_tree(source, target);
+    EXPECT_EQ("a", internal::read_file(target / "a.txt"));
+    EXPECT_EQ("b", internal::read_file(target / "sub" / "dir" / "b.txt"));
+    EXPECT_EQ(std::string(100000, 'r'), internal::read_file(target / "run"));
+    EXPECT_EQ(fs::status(source / "run").permissions(),
+        fs::status(target / "run").permissions());
+#ifndef WIN32
+    EXPECT_TRUE(fs::is_symlink(target / "link"));
+#endif
+    fs::remove_all(source);
+    fs::remove_all(target.parent_path());
+}
+
+TEST(staging_area, DirectoryIsRemovedUnlessItIsCommitted)
+{
+    namespace fs = std::filesystem;
+    auto root = internal::create_temporary_directory();
+    internal::staging_area area(root / ".staging");
+    fs::path discarded;
+    {
+        auto staged = area.create();
+        discarded = staged.path();
+        internal::write_file(discarded / "a.txt", "a");
+    }
+    EXPECT_FALSE(fs::exists(discarded));
+    auto staged = area.create();
+    auto other = area.create();
+    EXPECT_NE(staged.path(), other.path());
+    internal::write_file(staged.path() / "b.txt", "b");
+    staged.commit(root / "1.0.0");
+    EXPECT_TRUE(staged.path().empty());
+    EXPECT_EQ("b", internal::read_file(root / "1.0.0" / "b.txt"));
+    EXPECT_EQ(1, area.clear());
+    EXPECT_TRUE(fs::is_empty(area.root()));
+    fs::remove_all(root);
+}
+
+TEST(version_index, IndexIsOnlyReadWhileDirectoryIsUnmodified)
+{
+    namespace fs = std::filesystem;
+    auto root = internal::create_temporary_directory();
+    auto install = [&](std::string const& name) {
+        internal::sentinel sentinel(root / name);
+        sentinel.version(version_number::from_string(name));
+        sentinel.write();
+    };
+    install("1.0.0");
+    fs::create_directories(root / "1.0.1");
+    internal::version_index index(root, root / ".index" / "versions");
+    EXPECT_FALSE(index.read().has_value());
+    ASSERT_EQ(1, index.load().size());
+    auto installed = index.read();
+    ASSERT_TRUE(installed.has_value());
+    ASSERT_EQ(1, installed->size());
+    EXPECT_EQ("1.0.0", installed->at(0).directory);
+    EXPECT_EQ(version_number(1, 0, 0), installed->at(0).version);
+    // A version that is installed without updating the index is found.
+    install("1.1.0");
+    EXPECT_FALSE(index.read().has_value());
+    EXPECT_EQ(2, index.load().size());
+    // Changes which update the index keep it valid.
+    installed = index.read();
+    fs::remove_all(root / "1.0.0");
+    index.update(installed, [](auto& entries) {
+        internal::version_index::remove(entries, "1.0.0");
+    });
+    installed = index.read();
+    ASSERT_TRUE(installed.has_value());
+    ASSERT_EQ(1, installed->size());
+    EXPECT_EQ("1.1.0", installed->at(0).directory);
+    fs::remove_all(root);
+}
+
+TEST(manager, IndexedVersionIsNotAppliedWhenItsSentinelIsMissing)
+{
+    namespace fs = std::filesystem;
+    auto root = internal::create_temporary_directory();
+    manager manager(root, version_number(1, 0, 0));
+    for (auto name : { "1.1.0", "1.2.0" }) {
+        internal::sentinel sentinel(root / name);
+        sentinel.version(version_number::from_string(name));
+        sentinel.write();
+    }
+    ASSERT_EQ(version_number(1, 2, 0),
+        manager.latest_available_update().value().first);
+    // Only the version's directory is modified, the index stays valid.
+    fs::remove(root / "1.2.0" / internal::sentinel_filename());
+    ASSERT_TRUE(manager.version_index().read().has_value());
+    EXPECT_EQ(version_number(1, 1, 0), manager.apply_latest(false));
+    internal::sentinel latest(root / "current");
+    ASSERT_TRUE(latest.read());
+    EXPECT_EQ(version_number(1, 1, 0), latest.version());
+    fs::remove_all(root);
+}
+
+// Installs a version into the working directory of a manager,
+// like the updater does, with files that are linked into its store.
+static void install_version(manager const& manager, std::string const& name,
+    std::map<std::string, std::string> const& files)
+{
+    auto directory = manager.working_directory() / name;
+    for (auto const& [path, content] : files) {
+        internal::write_file(directory / path, content);
+    }
+    manager.object_store().link_files(directory);
+    internal::sentinel sentinel(directory);
+    sentinel.version(version_number::from_string(name));
+    sentinel.write();
+}
+
+TEST(manager, ReplacedVersionsAreRetainedWhenSeveralVersionsAreApplied)
+{
+    namespace fs = std::filesystem;
+    auto root = internal::create_temporary_directory();
+    {
+        manager manager(root, version_number(1, 0, 0));
+        retention_policy policy;
+        policy.versions = 2;
+        manager.retention(policy);
+        for (auto name : { "1.0.0", "1.1.0", "1.2.0", "1.3.0" }) {
+            install_version(manager, name, { { "app.txt", name } });
+            EXPECT_EQ(version_number::from_string(name),
+                manager.apply_latest(false));
+            // The latest directory is replaced while it exists.
+            EXPECT_EQ(name, internal::read_file(root / "current" / "app.txt"));
+            EXPECT_FALSE(fs::exists(root / name));
+        }
+        EXPECT_EQ(std::nullopt, manager.apply_latest(false));
+        // The least recently replaced version exceeds the policy.
+        std::vector<version_number> expected{ version_number(1, 2, 0),
+            version_number(1, 1, 0) };
+        EXPECT_EQ(expected, manager.retained_versions());
+    }
+    fs::remove_all(root);
+}
+
+TEST(manager, OlderVersionsAreRestoredWhenRollingBackTwice)
+{
+    namespace fs = std::filesystem;
+    auto root = internal::create_temporary_directory();
+    {
+        manager manager(root, version_number(1, 0, 0));
+        retention_policy policy;
+        policy.versions = 3;
+        manager.retention(policy);
+        for (auto name : { "1.0.0", "1.1.0", "1.2.0" }) {
+            install_version(manager, name, { { "app.txt", name } });
+            ASSERT_TRUE(manager.apply_latest(false).has_value());
+        }
+        EXPECT_EQ(version_number(1, 1, 0), manager.rollback());
+        EXPECT_EQ("1.1.0", internal::read_file(root / "current" / "app.txt"));
+        EXPECT_EQ(version_number(1, 0, 0), manager.rollback());
+        EXPECT_EQ("1.0.0", internal::read_file(root / "current" / "app.txt"));
+        // There is nothing older, but both newer versions were retained.
+        EXPECT_EQ(std::nullopt, manager.rollback());
+        std::vector<version_number> expected{ version_number(1, 1, 0),
+            version_number(1, 2, 0) };
+        EXPECT_EQ(expected, manager.retained_versions());
+        EXPECT_EQ(version_number(1, 2, 0),
+            manager.rollback(version_number(1, 2, 0)));
+        EXPECT_EQ("1.2.0", internal::read_file(root / "current" / "app.txt"));
+        EXPECT_EQ(std::nullopt, manager.apply_latest(false));
+    }
+    fs::remove_all(root);
+}
+
+TEST(manager, OnlyUnsharedFilesCountTowardsDiskBudgetOfRetainedVersions)
+{
+    namespace fs = std::filesystem;
+    auto root = internal::create_temporary_directory();
+    {
+        manager manager(root, version_number(1, 0, 0));
+        retention_policy policy;
+        policy.versions = 2;
+        // Too small for one shared file, large enough for two own files.
+        policy.disk_budget = 500;
+        manager.retention(policy);
+        std::string shared(1000, 's');
+        for (auto name : { "1.0.0", "1.1.0", "1.2.0" }) {
+            install_version(manager, name,
+                { { "shared.bin", shared },
+                    { "own.bin", std::string(100, name[2]) } });
+            ASSERT_TRUE(manager.apply_latest(false).has_value());
+        }
+        EXPECT_EQ(2, manager.retained_versions().size());
+        // One own file still fits, two do not anymore.
+        policy.disk_budget = 150;
+        manager.retention(policy);
+        install_version(manager, "1.3.0",
+            { { "shared.bin", shared }, { "own.bin", "3" } });
+        ASSERT_TRUE(manager.apply_latest(false).has_value());
+        std::vector<version_number> expected{ version_number(1, 2, 0) };
+        EXPECT_EQ(expected, manager.retained_versions());
+        EXPECT_EQ(shared,
+            internal::read_file(root / "current" / "shared.bin"));
+    }
+    fs::remove_all(root);
+}
+
+TEST(exchange_paths, DirectoriesAreSwappedWhenSupported)
+{
+    namespace fs = std::filesystem;
+    auto root = internal::create_temporary_directory();
+    internal::write_file(root / "current" / "app.txt", "1.0.0");
+    internal::write_file(root / "1.1.0" / "app.txt", "1.1.0");
+    if (internal::exchange_paths(root / "1.1.0", root / "current")) {
+        EXPECT_EQ("1.1.0", internal::read_file(root / "current" / "app.txt"));
+        EXPECT_EQ("1.0.0", internal::read_file(root / "1.1.0" / "app.txt"));
+    } else {
+        EXPECT_EQ("1.0.0", internal::read_file(root / "current" / "app.txt"));
+        EXPECT_EQ("1.1.0", internal::read_file(root / "1.1.0" / "app.txt"));
+    }
+    EXPECT_FALSE(internal::exchange_paths(root / "missing", root / "current"));
+    fs::remove_all(root);
+}
+
+TEST(trash, TrashedPathsAreDeletedWhenTrashIsEmptied)
+{
+    namespace fs = std::filesystem;
+    auto root = internal::create_temporary_directory();
+    for (int i = 0; i < 100; i++) {
+        internal::write_file(root / "1.0.0" / ("dir" + std::to_string(i % 4)) /
+                ("file" + std::to_string(i)),
+            "1.0.0");
+    }
+    internal::write_file(root / "1.1.0" / "app.txt", "1.1.0");
+    internal::trash trash(root / ".trash");
+    auto trashed = trash.move(root / "1.0.0");
+    EXPECT_FALSE(fs::exists(root / "1.0.0"));
+    EXPECT_TRUE(fs::exists(trashed / "dir0" / "file0"));
+    EXPECT_EQ(1, trash.empty());
+    EXPECT_TRUE(fs::is_empty(trash.root()));
+    trash.move(root / "1.1.0");
+    bool emptied = false;
+    trash.empty_in_background([&] {
+        emptied = true;
+    });
+    trash.wait();
+    EXPECT_TRUE(emptied);
+    EXPECT_TRUE(fs::is_empty(trash.root()));
+    fs::remove_all(root);
+}
+
+TEST(trash, TrashIsEmptiedWhenItWasMovedWhileEmptying)
+{
+    namespace fs = std::filesystem;
+    static_assert(std::is_move_constructible_v<manager>);
+    auto root = internal::create_temporary_directory();
+    internal::write_file(root / "1.0.0" / "app.txt", "1.0.0");
+    internal::trash trash(root / ".trash");
+    trash.move(root / "1.0.0");
+    std::atomic<bool> emptied{ false };
+    trash.empty_in_background([&] {
+        emptied = true;
+    });
+    internal::trash moved(std::move(trash));
+    moved.wait();
+    EXPECT_TRUE(emptied.load());
+    EXPECT_TRUE(fs::is_empty(moved.root()));
+    internal::trash assigned(root / ".other");
+    assigned = std::move(moved);
+    EXPECT_EQ(root / ".trash", assigned.root());
+    fs::remove_all(root);
+}
+
+TEST(retained_versions, LeastRecentlyReplacedVersionsAreEvicted)
+{
+    namespace fs = std::filesystem;
+    auto root = internal::create_temporary_directory();
+    internal::retained_versions retained(root / ".retained");
+    auto now = fs::file_time_type::clock::now();
+    int age = 3;
+    for (auto version : { "1.2.0", "1.0.0", "1.1.0" }) {
+        internal::sentinel sentinel(root / version);
+        sentinel.version(version_number::from_string(version));
+        sentinel.write();
+        auto path = retained.add(root / version, sentinel.version());
+        fs::last_write_time(path, now - std::chrono::hours(age--));
+    }
+    fs::create_directories(retained.root() / "invalid");
+    auto list = retained.list();
+    ASSERT_EQ(3, list.size());
+    EXPECT_EQ(version_number(1, 1, 0), list[0].version);
+    EXPECT_EQ(version_number(1, 2, 0), list[2].version);
+    auto older = retained.find(std::nullopt, version_number(1, 2, 0));
+    ASSERT_TRUE(older.has_value());
+    EXPECT_EQ(version_number(1, 1, 0), older->version);
+    EXPECT_FALSE(retained.find(version_number(2, 0, 0), std::nullopt));
+    retention_policy policy;
+    policy.versions = 2;
+    auto evicted = retained.evict(policy);
+    std::sort(evicted.begin(), evicted.end());
+    ASSERT_EQ(2, evicted.size());
+    EXPECT_EQ(retained.path(version_number(1, 2, 0)), evicted[0]);
+    EXPECT_EQ(retained.root() / "invalid", evicted[1]);
+    fs::remove_all(root);
+}
+
+TEST(retained_versions, SharedFilesDoNotCountTowardsDiskBudget)
+{
+    namespace fs = std::filesystem;
+    auto root = internal::create_temporary_directory();
+    internal::retained_versions retained(root / ".retained");
+    internal::object_store store(root / ".objects");
+    auto now = fs::file_time_type::clock::now();
+    int age = 2;
+    for (auto version : { "1.0.0", "1.1.0" }) {
+        internal::write_file(root / version / "shared.bin",
+            std::string(1000, 's'));
+        internal::write_file(root / version / "own.bin",
+            std::string(100, version[2]));
+        store.link_files(root / version);
+        internal::sentinel sentinel(root / version);
+        sentinel.version(version_number::from_string(version));
+        sentinel.write();
+        auto path = retained.add(root / version, sentinel.version());
+        fs::last_write_time(path, now - std::chrono::hours(age--));
+    }
+    ASSERT_EQ(3, fs::hard_link_count(
+                     retained.path(version_number(1, 0, 0)) / "shared.bin"));
+    retention_policy policy;
+    policy.versions = 2;
+    // Each version only occupies its own file and its sentinel.
+    policy.disk_budget = 500;
+    EXPECT_TRUE(retained.evict(policy).empty());
+    policy.disk_budget = 150;
+    auto evicted = retained.evict(policy);
+    ASSERT_EQ(1, evicted.size());
+    EXPECT_EQ(retained.path(version_number(1, 0, 0)), evicted[0]);
+    fs::remove_all(root);
+}
+
+TEST(object_store, IdenticalFilesShareObjectUntilCollected)
+{
+    namespace fs = std::filesystem;
+    auto root = internal::create_temporary_directory();
+    internal::object_store store(root / ".objects");
+    internal::write_file(root / "1.0.0" / "a.txt", "same");
+    internal::write_file(root / "1.0.0" / "b.txt", "old");
+    internal::write_file(root / "1.0.1" / "sub" / "a.txt", "same");
+    internal::write_file(root / "1.0.1" / "b.txt", "new");
+    EXPECT_EQ(0, store.link_files(root / "1.0.0"));
+    EXPECT_EQ(1, store.link_files(root / "1.0.1"));
+    EXPECT_EQ(3, fs::hard_link_count(root / "1.0.1" / "sub" / "a.txt"));
+    EXPECT_EQ("same", internal::read_file(root / "1.0.1" / "sub" / "a.txt"));
+    EXPECT_EQ("new", internal::read_file(root / "1.0.1" / "b.txt"));
+    EXPECT_EQ(0, store.collect());
+    fs::remove_all(root / "1.0.0");
+    EXPECT_EQ(1, store.collect());
+    EXPECT_EQ(2, fs::hard_link_count(root / "1.0.1" / "sub" / "a.txt"));
+    fs::remove_all(root);
+}
+
+TEST(object_store, ModifiedObjectIsNotLinkedToNewFiles)
+{
+    namespace fs = std::filesystem;
+    auto root = internal::create_temporary_directory();
+    internal::object_store store(root / ".objects");
+    internal::write_file(root / "1.0.0" / "a.txt", "same");
+    store.link_files(root / "1.0.0");
+    // Writing in place modifies the object through the hard link.
+    std::ofstream(root / "1.0.0" / "a.txt", std::ios::binary) << "evil";
+    internal::write_file(root / "1.0.1" / "a.txt", "same");
+    internal::write_file(root / "1.0.1" / "b.txt", "same");
+    EXPECT_EQ(1, store.link_files(root / "1.0.1"));
+    EXPECT_EQ("same", internal::read_file(root / "1.0.1" / "a.txt"));
+    EXPECT_EQ("same", internal::read_file(root / "1.0.1" / "b.txt"));
+    EXPECT_EQ(3, fs::hard_link_count(root / "1.0.1" / "a.txt"));
+    internal::write_file(root / "1.0.2" / "a.txt", "same");
+    EXPECT_EQ(1, store.link_files(root / "1.0.2"));
+    EXPECT_EQ(4, fs::hard_link_count(root / "1.0.2" / "a.txt"));
+    fs::remove_all(root);
+}
+
+TEST(write_file_atomically, FileIsReplacedWhenItIsFlushed)
+{
+    namespace fs = std::filesystem;
+    auto directory = internal::create_temporary_directory();
+    internal::write_file(directory / "sub" / "a.txt", "a");
+    internal::sync_tree(directory, durability::sync_files);
+    internal::write_file_atomically(
+        directory / "a.txt", "old", durability::none);
+    internal::write_file_atomically(
+        directory / "a.txt", "new", durability::sync_files);
+    EXPECT_EQ("new", internal::read_file(directory / "a.txt"));
+    EXPECT_EQ(2, std::distance(fs::directory_iterator(directory),
+                     fs::directory_iterator()));
+    fs::remove_all(directory);
+}
+
+TEST(require_free_space, ThrowsWhenVolumeHasLessSpace)
+{
+    auto directory = internal::create_temporary_directory();
+    EXPECT_NO_THROW(internal::require_free_space({ directory }, 1));
+    EXPECT_NO_THROW(
+        internal::require_free_space({ directory / "missing" / "dir" }, 1));
+    EXPECT_ANY_THROW(internal::require_free_space(
+        { directory }, std::numeric_limits<uint64_t>::max()));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(require_free_space, WritesToTheSameVolumeAreAddedUp)
+{
+    auto directory = internal::create_temporary_directory();
+    auto half = std::filesystem::space(directory).available / 2 + 4096;
+    EXPECT_NO_THROW(internal::require_free_space({ { directory, half } }));
+    EXPECT_ANY_THROW(internal::require_free_space(
+        { { directory, half }, { directory / "missing", half } }));
+    auto max = std::numeric_limits<uint64_t>::max();
+    EXPECT_ANY_THROW(
+        internal::require_free_space({ { directory, max }, { directory, 1 } }));
+    std::filesystem::remove_all(directory);
+}
+
+#ifndef WIN32
+TEST(extract_stream, TarPermissionsAndLinksArePreserved)
+{
+    auto directory = internal::create_temporary_directory();
+    auto tar = tar_entry("app/run", "#!/bin/sh\n", '0', "", 0755) +
+        tar_entry("app/current", "", '2', "run") +
+        tar_entry("app/lib/libapp.so", "so") +
+        tar_entry("app/libapp.so", "", '2', "lib/libapp.so") +
+        std::string(1024, '\0');
+    extract_tar_gz(gzip(tar), directory);
+    auto perms =
+        std::filesystem::status(directory / "app" / "run").permissions();
+    EXPECT_NE(std::filesystem::perms::none,
+        perms & std::filesystem::perms::owner_exec);
+    EXPECT_TRUE(std::filesystem::is_symlink(directory / "app" / "current"));
+    EXPECT_EQ("so", internal::read_file(directory / "app" / "libapp.so"));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(extract_stream, TarLinkKeepsLongTargetWhenItAlsoHasLongName)
+{
+    auto directory = internal::create_temporary_directory();
+    auto target = "app/" + std::string(120, 't') + ".txt";
+    auto name = "app/" + std::string(120, 'n');
+    auto tar = tar_entry("././@LongLink", target + '\0', 'L') +
+        tar_entry(target.substr(0, 99), "target") +
+        tar_entry("././@LongLink", target.substr(4) + '\0', 'K') +
+        tar_entry("././@LongLink", name + '\0', 'L') +
+        tar_entry(name.substr(0, 99), "", '2', target.substr(4, 99)) +
+        std::string(1024, '\0');
+    extract_tar_gz(gzip(tar), directory);
+    auto link = directory / std::filesystem::u8path(name);
+    ASSERT_TRUE(std::filesystem::is_symlink(link));
+    EXPECT_EQ("target", internal::read_file(link));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(extract_stream, ThrowsWhenTarLinkLeavesTheDirectory)
+{
+    auto directory = internal::create_temporary_directory();
+    auto tar = tar_entry("app/evil", "", '2', "../../evil") +
+        std::string(1024, '\0');
+    EXPECT_ANY_THROW(extract_tar_gz(gzip(tar), directory));
+    EXPECT_FALSE(std::filesystem::exists(directory / "app" / "evil"));
+    std::filesystem::remove_all(directory);
+}
+#endif
+
+#ifdef UPDATE_WITH_XZ
+TEST(extract_stream, TarXzIsExtracted)
+{
+    auto directory = internal::create_temporary_directory();
+    auto tar = tar_entry("app/a.txt", std::string(5000, 'a')) +
+        std::string(1024, '\0');
+    std::string xz(lzma_stream_buffer_bound(tar.size()), '\0');
+    size_t size = 0;
+    ASSERT_EQ(LZMA_OK,
+        lzma_easy_buffer_encode(6, LZMA_CHECK_CRC64, nullptr,
+            reinterpret_cast<uint8_t const*>(tar.data()), tar.size(),
+            reinterpret_cast<uint8_t*>(xz.data()), &size, xz.size()));
+    xz.resize(size);
+    extract_tar(archive_type::tar_xz, xz, directory);
+    EXPECT_EQ(std::string(5000, 'a'),
+        internal::read_file(directory / "app" / "a.txt"));
+    resource_limits limits;
+    limits.max_xz_memory = 64 * 1024;
+    EXPECT_ANY_THROW(
+        extract_tar(archive_type::tar_xz, xz, directory / "limited", limits));
+    std::filesystem::remove_all(directory);
+}
+#endif
+
+#ifdef UPDATE_WITH_ZSTD
+TEST(extract_stream, TarZstIsExtracted)
+{
+    auto directory = internal::create_temporary_directory();
+    auto tar = tar_entry("app/a.txt", std::string(5000, 'a')) +
+        std::string(1024, '\0');
+    std::string zst(ZSTD_compressBound(tar.size()), '\0');
+    auto size =
+        ZSTD_compress(zst.data(), zst.size(), tar.data(), tar.size(), 3);
+    ASSERT_FALSE(ZSTD_isError(size));
+    zst.resize(size);
+    extract_tar(archive_type::tar_zst, zst, directory);
+    EXPECT_EQ(std::string(5000, 'a'),
+        internal::read_file(directory / "app" / "a.txt"));
+    std::filesystem::remove_all(directory);
+}
+
+TEST(extract_stream, ThrowsWhenZstdWindowExceedsLimit)
+{
+    auto directory = internal::create_temporary_directory();
+    auto tar = tar_entry("app/a.txt", std::string(5000, 'a')) +
+        std::string(1024, '\0');
+    // Without a known size the frame keeps its declared window of 256 MiB.
+    auto context = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(context, ZSTD_c_windowLog, 28);
+    ZSTD_CCtx_setParameter(context, ZSTD_c_contentSizeFlag, 0);
+    std::string zst(ZSTD_compressBound(tar.size()) + 1024, '\0');
+    ZSTD_outBuffer output{ zst.data(), zst.size(), 0 };
+    ZSTD_inBuffer input{ tar.data(), tar.size(), 0 };
+    ZSTD_compressStream2(context, &output, &input, ZSTD_e_continue);
+    ZSTD_inBuffer end{ nullptr, 0, 0 };
+    ASSERT_EQ(0, ZSTD_compressStream2(context, &output, &end, ZSTD_e_end));
+    ZSTD_freeCCtx(context);
+    zst.resize(output.pos);
+    EXPECT_ANY_THROW(extract_tar(archive_type::tar_zst, zst, directory));
+    resource_limits limits;
+    limits.max_zstd_window_log = 28;
+    extract_tar(archive_type::tar_zst, zst, directory, limits);
+    EXPECT_EQ(std::string(5000, 'a'),
+        internal::read_file(directory / "app" / "a.txt"));
+    std::filesystem::remove_all(directory);
+}
+#endif
@@ -0,0 +1,197 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <sys/wait.h>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "ungive/update/internal/posix/exit_channel.h"
+#include "ungive/update/internal/posix/lock.h"
+#include "ungive/update/internal/posix/process.h"
+
+using namespace ungive::update;
+
+namespace fs = std::filesystem;
+
+struct temp_dir
+{
+    temp_dir() : m_path{ internal::create_temporary_directory() } {}
+
+    ~temp_dir() { fs::remove_all(m_path); }
+
+    fs::path path() const { return m_path; }
+
+private:
+    fs::path m_path;
+};
+
+// Waits until the condition is true or a few seconds have passed.
+template <typename F>
+static bool wait_until(F&& condition)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return true;
+}
+
+TEST(lock, LockFailsWhileFileIsLockedAndSucceedsAfterwards)
+{
+    temp_dir dir;
+    auto path = dir.path() / "update.lock";
+    {
+        internal::posix::lock_file lock(path);
+        EXPECT_ANY_THROW(internal::posix::lock_file{ path });
+    }
+    EXPECT_NO_THROW(internal::posix::lock_file{ path });
+}
+
+TEST(process, CurrentProcessExecutableExists)
+{
+    auto executable = internal::posix::current_process_executable();
+    EXPECT_TRUE(executable.is_absolute());
+    EXPECT_TRUE(fs::is_regular_file(executable));
+}
+
+TEST(process, ExceptionIsThrownWhenLaunchingBadExecutable)
+{
+    temp_dir dir;
+    EXPECT_ANY_THROW(internal::posix::start_process_detached(
+        dir.path() / "madeupexecutable"));
+}
+
+TEST(process, ProcessIsReplacedWithExecutable)
+{
+    auto pid = ::fork();
+    if (pid == 0) {
+        try {
+            internal::posix::replace_process("/bin/sh", { "-c", "exit 7" });
+        }
+        catch (...) {
+        }
+        ::_exit(1);
+    }
+    int status = 0;
+    ASSERT_EQ(pid, ::waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(7, WEXITSTATUS(status));
+}
+
+TEST(process, ProcessIsUnchangedWhenReplacingWithBadExecutable)
+{
+    temp_dir dir;
+    auto working_directory = fs::current_path();
+    EXPECT_ANY_THROW(
+        internal::posix::replace_process(dir.path() / "madeupexecutable"));
+    EXPECT_EQ(working_directory, fs::current_path());
+}
+
+TEST(process, ProcessIsKilledWhenItsExecutableIsInDirectory)
+{
+    temp_dir dir;
+    auto sleep = dir.path() / "sleep";
+    fs::copy_file("/bin/sleep", sleep);
+    internal::posix::start_process_detached(sleep, { "30" });
+    ASSERT_TRUE(wait_until([&] {
+        return internal::posix::get_running_pids(dir.path()).size() == 1;
+    }));
+    EXPECT_EQ(1, internal::posix::kill_processes(dir.path()));
+    EXPECT_TRUE(internal::posix::get_running_pids(dir.path()).empty());
+}
+
+TEST(process, ProcessesInSeveralDirectoriesAreListedInOnePass)
+{
+    temp_dir dir;
+    auto a = dir.path() / "a";
+    auto b = dir.path() / "b";
+    fs::create_directories(a);
+    fs::create_directories(b);
+    fs::copy_file("/bin/sleep", a / "sleep");
+    internal::posix::start_process_detached(a / "sleep", { "30" });
+    ASSERT_TRUE(wait_until([&] {
+        return internal::posix::get_running_pids(a).size() == 1;
+    }));
+    // Trailing separators and redundant elements are normalized.
+    auto pids = internal::posix::get_running_pids(
+        { a / "", b, dir.path() / "b" / ".." / "a" / "sleep" });
+    ASSERT_EQ(3, pids.size());
+    EXPECT_EQ(1, pids[0].size());
+    EXPECT_TRUE(pids[1].empty());
+    EXPECT_EQ(pids[0], pids[2]);
+    EXPECT_EQ(1,
+        internal::posix::kill_processes({ a, b, dir.path() / "missing" }));
+    EXPECT_TRUE(internal::posix::get_running_pids(a).empty());
+}
+
+TEST(process, ProcessIsFoundWhenDirectoryIsReachedThroughSymlink)
+{
+    temp_dir dir;
+    auto real = dir.path() / "real";
+    auto link = dir.path() / "link";
+    fs::create_directories(real);
+    fs::create_directory_symlink(real, link);
+    fs::copy_file("/bin/sleep", real / "sleep");
+    internal::posix::start_process_detached(link / "sleep", { "30" });
+    ASSERT_TRUE(wait_until([&] {
+        return internal::posix::get_running_pids(real).size() == 1;
+    }));
+    EXPECT_EQ(1, internal::posix::get_running_pids(link).size());
+    EXPECT_EQ(1, internal::posix::get_running_pids(link / "sleep").size());
+    EXPECT_EQ(1, internal::posix::kill_processes({ link }));
+    EXPECT_TRUE(internal::posix::get_running_pids(real).empty());
+}
+
+TEST(process, ProcessesThatIgnoreSignalsAreKilledWithinOneDeadline)
+{
+    temp_dir dir;
+    auto sleep = dir.path() / "sleep";
+    fs::copy_file("/bin/sleep", sleep);
+    // Ignored signals remain ignored after exec().
+    auto script = "trap '' INT TERM; exec '" + sleep.string() + "' 30";
+    for (int i = 0; i < 3; i++) {
+        internal::posix::start_process_detached("/bin/sh", { "-c", script });
+    }
+    ASSERT_TRUE(wait_until([&] {
+        return internal::posix::get_running_pids(dir.path()).size() == 3;
+    }));
+    shutdown_policy policy;
+    policy.polite = std::chrono::milliseconds(200);
+    policy.terminate = std::chrono::milliseconds(200);
+    policy.kill = std::chrono::milliseconds::zero();
+    EXPECT_ANY_THROW(internal::posix::kill_processes(dir.path(), policy));
+    policy.kill = std::chrono::milliseconds(5000);
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(3, internal::posix::kill_processes(dir.path(), policy));
+    // Waiting for each process in turn would take three times as long.
+    EXPECT_LT(std::chrono::steady_clock::now() - start,
+        std::chrono::milliseconds(1000));
+    EXPECT_TRUE(internal::posix::get_running_pids(dir.path()).empty());
+}
+
+TEST(exit_channel, ExitRequestIsAcknowledgedOncePrepared)
+{
+    temp_dir dir;
+    auto directory = dir.path() / ".exit";
+    auto timeout = std::chrono::seconds(5);
+    std::atomic<bool> prepared{ false };
+    {
+        internal::posix::exit_listener listener(directory, [&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            prepared = true;
+        });
+        // Processes without a listener are skipped.
+        auto acknowledged = internal::posix::request_exit(directory,
+            { ::getpid(), ::getpid() + 1 },
+            std::chrono::steady_clock::now() + timeout);
+        EXPECT_TRUE(prepared);
+        EXPECT_THAT(acknowledged, testing::ElementsAre(::getpid()));
+    }
+    // The socket is removed with the listener.
+    EXPECT_TRUE(fs::is_empty(directory));
+}
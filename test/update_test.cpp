@@ -4,6 +4,7 @@
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <openssl/pem.h>
 
 #include "ungive/update/manager.hpp"
 #include "ungive/update/updater.hpp"
@@ -29,11 +30,7 @@ static const char* MOCK_URL_GITHUB_API_DOWNGRADE_ATTACK =
     "https://ungive.github.io/update_test/github-api-mock/"
     "latest-downgrade-attack.json";
 
-const char* PUBLIC_KEY = R"key(
------BEGIN PUBLIC KEY-----
-MCowBQYDK2VwAyEAIcbwANvTnDDB6KqmrL64/jEApW41sA//feKQYQMjGeU=
------END PUBLIC KEY-----
-)key";
+extern const char* PUBLIC_KEY;
 const char* BAD_PUBLIC_KEY = R"key(
 -----BEGIN PUBLIC KEY-----
 NCowBQYDK2VwAyEAIcbwANvTnDDB6KqmrL64/jEApW41sA//feKQYQMjGeU=
@@ -1201,6 +1198,14 @@ TEST(updater, UpdateSucceedsWhenUpdateIsFlattenedBeforeVerification)
     updater_update_test(updater, "release-1.2.3.txt", false);
 }
 
+TEST(updater, UpdateFailsWhenZipHasNoSubfolderButIsFlattenedBeforeVerification)
+{
+    auto updater = create_updater(PATTERN_ZIP, PREVIOUS_VERSION);
+    updater.add_content_operation(operations::flatten_extracted_directory());
+    updater.add_content_operation(check_file_exists("release-1.2.3.txt"));
+    updater_update_test(updater, "release-1.2.3.txt", true);
+}
+
 class ExpectCalled
 {
 public: